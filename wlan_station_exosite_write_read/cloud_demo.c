@@ -19,10 +19,16 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
+#include "simplelink.h"
 #include "sl_common.h"
 #include "exosite.h"
 #include "exosite_pal.h"
+#include "exosite_rpc.h"
+#include "exosite_queue.h"
+#include "exosite_clock.h"
+#include "exosite_fmt.h"
 #include "cloud_demo.h"
+#include "spi/spi.h"
 #include "driverlib/rom.h"
 #include "driverlib/rom_map.h"
 #include "driverlib/sysctl.h"
@@ -47,14 +53,67 @@
 #define SW1_ALIAS           "usrsw1"
 #define SW2_ALIAS           "usrsw2"
 
-#define TEMP_ALIAS_LENGTH          20
-#define BMP_ALIAS_LENGTH           20
-#define SHT_ALIAS_LENGTH           20
-#define ISL_ALIAS_LENGTH           20
-#define LED2_ALIAS_LENGTH          20
-#define LED3_ALIAS_LENGTH          20
-#define SW1_ALIAS_LENGTH           20
-#define SW2_ALIAS_LENGTH           20
+// Client model the device activates as, with its MAC address as the serial
+// number.  It has to be added to that model in Exosite Portals first.  Once
+// activated the CIK is kept on the serial flash and used from then on.
+#define EXOSITE_VENDOR      "texasinstruments"
+#define EXOSITE_MODEL       "cc3100_tm4c1294"
+
+// Set to 1 to print the SPI frames and bytes each Exosite request costs.
+// Build once with EXOPAL_TX_STAGING 0 and once with 1 to compare.
+#define SPI_BENCHMARK       0
+
+// Set to 1 to send each cycle's writes and reads as one RPC request,
+// 0 to use a separate exosite_write/exosite_read round trip for each.
+#define RPC_BATCHING        1
+
+// Set to 1 to long-poll ledd2/ledd3 so the LEDs follow the dashboard within
+// a round trip instead of on the read_interval tick.  There is one connection,
+// so the two aliases are long-polled in turn, one per loop.
+#define LONG_POLL           0
+#define LONG_POLL_TIMEOUT_MS    1000
+
+// Set to 1 to upload the sensor data with exosite_writeAsync, so sampling and
+// the buttons keep running while the request is in flight.  The loop delay is
+// split into ASYNC_POLL_SLICES slices that each step the upload.
+#define ASYNC_UPLOAD        0
+#define ASYNC_POLL_SLICES   50
+
+// Set to 1 to keep sampling while WiFi or Exosite is down.  Samples that
+// can't be uploaded are queued, in RAM then on the serial flash, and
+// uploaded with their original timestamps once the link is back, at most
+// DRAIN_REQUESTS requests per loop.
+#define OFFLINE_QUEUE       1
+#define DRAIN_REQUESTS      2
+
+// Set to 1 to sample every BATCH_SAMPLE_TICKS loops (500 ms each) but only
+// upload once BATCH_SIZE samples are queued or the oldest has waited
+// BATCH_MAX_LATENCY_MS.  Each sample is recorded at its acquisition time,
+// kept by exosite_clock, using one RPC record call per alias.  Uses the
+// OFFLINE_QUEUE.
+#define BATCH_UPLOAD        0
+#define BATCH_SAMPLE_TICKS  2
+#define BATCH_SIZE          60
+#define BATCH_MAX_LATENCY_MS    60000
+
+// Queued samples are stamped with the drift-corrected clock, which is
+// resynced with the server once it could be off by more than this
+#define CLOCK_MAX_ERROR_MS      5000
+
+// Digits after the decimal point in the uploaded sensor values
+#define SENSOR_DECIMALS     3
+
+// An alias is only written when it moved by more than its deadband, see
+// sensors[], or hasn't been written for SENSOR_MAX_SILENCE_MS.  The write is
+// skipped when no alias qualifies.  Counters are printed every
+// SENSOR_STATS_INTERVAL loops.
+#define SENSOR_MAX_SILENCE_MS   300000
+#define SENSOR_STATS_INTERVAL   120
+
+#if BATCH_UPLOAD && !OFFLINE_QUEUE
+#error "BATCH_UPLOAD needs OFFLINE_QUEUE"
+#endif
+
 
 // Global instance structure for the TMP006 sensor driver.
 extern tTMP006 g_sTMP006Inst;
@@ -83,6 +142,9 @@ extern tISL29023 g_sISL29023Inst;
 extern unsigned long ui32SysClock;
 extern unsigned long g_Status;
 
+// Identity and connection the demo talks to Exosite with
+static exosite_ctx_t g_sExosite;
+
 volatile int sw1_button_on = 0;
 volatile int sw2_button_on = 0;
 
@@ -93,8 +155,79 @@ extern volatile uint_fast8_t g_vui8ErrorFlag;
 
 extern void TMP006AppErrorHandler(char *pcFilename, uint_fast32_t ui32Line);
 
+// One alias in the write payload
+typedef struct
+{
+	const char *alias;
+	bool (*sample)(float *value);	// false if there's nothing to report
+	uint8_t decimals;				// digits after the decimal point
+	int32_t deadband;				// change to report, scaled by 10^decimals
+	uint32_t maxSilenceMs;			// longest time between writes
+	bool enabled;
+} Sensor_t;
+
+// What was last written for an alias
+typedef struct
+{
+	bool hasSent;
+	int32_t lastValue;				// scaled by 10^decimals
+	uint32_t lastSentMs;
+	uint32_t sent;
+	uint32_t suppressed;
+	bool isPending;					// in post_str, not yet accepted or queued
+	int32_t pendingValue;
+	uint32_t pendingMs;
+} SensorState_t;
+
 char post_str[512];
-int post_len = 0;
+uint16_t post_len = 0;
+
+// latest readings, taken by the read*Data functions
+static float g_fTmp006Ambient;
+static float g_fBmp180Temperature;
+static float g_fBmp180Pressure;
+static float g_fSht21Humidity;
+static float g_fSht21Temperature;
+static float g_fIsl29023Lux;
+static bool g_bIsl29023Fresh = false;
+
+#if OFFLINE_QUEUE && RPC_BATCHING && !ASYNC_UPLOAD
+// set when a write of this cycle's sample didn't reach Exosite
+static uint8_t post_failed = 0;
+#endif
+
+#if OFFLINE_QUEUE && ASYNC_UPLOAD
+// the sample exosite_writeAsync has in flight, queued if it fails
+static char async_str[sizeof(post_str)];
+static uint16_t async_len = 0;
+#endif
+
+#if SPI_BENCHMARK
+static SpiWriteStats_t spiStatsBefore;
+#define SPI_BENCHMARK_START()       spi_GetWriteStats(&spiStatsBefore)
+#define SPI_BENCHMARK_END(request)  Report_SpiStats(request)
+#else
+#define SPI_BENCHMARK_START()
+#define SPI_BENCHMARK_END(request)
+#endif
+
+#if ASYNC_UPLOAD
+static void Cloud_WriteDone(void *context, int16_t httpStatus, uint32_t latencyMs);
+#endif
+#if RPC_BATCHING && !ASYNC_UPLOAD
+static void Cloud_WriteResult(void *context, const char *alias, EXORPC_STATUS status,
+		const char *value, uint16_t length);
+#endif
+static void Cloud_Provision(void);
+static void Report_FirstUpload(void);
+static void Sample_Commit(const char *alias);
+#if OFFLINE_QUEUE
+static void Sample_Queue(void);
+#endif
+#if RPC_BATCHING
+static void Cloud_LedCallback(void *context, const char *alias, EXORPC_STATUS status,
+		const char *value, uint16_t length);
+#endif
 
 //*****************************************************************************
 //
@@ -192,7 +325,7 @@ void SW2_Pressed(void)
 *****************************************************************************/
 void Status_Indicate(void)
 {
-  int state = Exosite_StatusCode();
+  int state = Exosite_StatusCode(&g_sExosite);
 
   if (EXO_STATE_R_W_ERROR == state)
   {
@@ -201,6 +334,30 @@ void Status_Indicate(void)
 
 }
 
+/*****************************************************************************
+*
+* Cloud_SetLed
+*
+*  \param  led - the LED to switch, CLP_D2 or CLP_D3
+*  \param  value - value read from its alias, 1 for ON and 0 for OFF
+*
+*  \return None
+*
+*  \brief  Turns an LED ON/OFF from the value of its alias, ignores other values
+*
+*****************************************************************************/
+static void Cloud_SetLed(uint32_t led, int32_t value)
+{
+	if (value == 1)
+	{
+		LEDWrite(led, led);
+	}
+	if (value == 0)
+	{
+		LEDWrite(led, ~led);
+	}
+}
+
 /*****************************************************************************
 *
 * Cloud_Read
@@ -214,64 +371,466 @@ void Status_Indicate(void)
 *****************************************************************************/
 void Cloud_Read(void)
 {
-
-	char ledx[10] = "DEADBEEFDE";
-	int32_t Read_status = 0;
-	int32_t	switch1_data = 0;
-	int32_t	switch2_data = 0;
-	uint16_t response_length = 0;
-
-
-	//use exosite_read to read multiple aliases values
-	//returns "ledd2=0"
-	Read_status = exosite_read("ledd2", ledx, 10, &response_length);
-
-	if (Read_status == 0)
+#if LONG_POLL
+	static exosite_longPoll_t polls[2] =
 	{
-		switch1_data = exoPal_atoi(&ledx[strlen(LED2_ALIAS) + 1]);
-		if (switch1_data == 1)
+		{LED2_ALIAS, LONG_POLL_TIMEOUT_MS, ""},
+		{LED3_ALIAS, LONG_POLL_TIMEOUT_MS, ""}
+	};
+	static const uint32_t leds[2] = {CLP_D2, CLP_D3};
+	static uint8_t next = 0;
+	exosite_value_t value = {0};
+	exosite_result_t result;
+	char response[16];
+
+	// returns "ledd2=0" as soon as ledd2 changes, 304 if it didn't
+	result = exosite_readLongPoll(&g_sExosite, &polls[next], response, sizeof(response));
+	if (result.status == 200)
+	{
+		exosite_decodeValues(response, result.bodyLength, &polls[next].alias, 1, &value);
+		if (value.isNumber)
+		{
+			Cloud_SetLed(leds[next], value.number);
+		}
+	}
+	next ^= 1;
+#elif RPC_BATCHING
+	// answered by Cloud_LedCallback when the batch is flushed
+	exoRpc_queueRead(LED2_ALIAS, Cloud_LedCallback, (void *)CLP_D2);
+	exoRpc_queueRead(LED3_ALIAS, Cloud_LedCallback, (void *)CLP_D3);
+#else
+	static const char *aliases[] = {LED2_ALIAS, LED3_ALIAS};
+	exosite_value_t values[2] = {{0}};
+	char response[32];
+
+	// one request for both aliases, returns "ledd2=0&ledd3=1"
+	SPI_BENCHMARK_START();
+	if (exosite_readMany(&g_sExosite, aliases, 2, values, response, sizeof(response)).status == 200)
+	{
+		if (values[0].isNumber)
 		{
-			LEDWrite(CLP_D2, CLP_D2);
+			Cloud_SetLed(CLP_D2, values[0].number);
 		}
-		if (switch1_data == 0)
+		if (values[1].isNumber)
 		{
-			LEDWrite(CLP_D2, ~CLP_D2);
+			Cloud_SetLed(CLP_D3, values[1].number);
 		}
-		//UARTprintf(" Exosite Read:  %s=%d\r\n", LED2_ALIAS, switch1_data);
 	}
+	SPI_BENCHMARK_END("read");
+#endif
+}
 
-	Read_status = exosite_read("ledd3", ledx, 10, &response_length);
+#if RPC_BATCHING
+/*****************************************************************************
+*
+* Cloud_LedCallback
+*
+*  \param  context - the LED to switch, CLP_D2 or CLP_D3
+*  \param  alias - the alias that was read
+*  \param  status - result of the read
+*  \param  value - latest value of the alias, not null terminated
+*  \param  length - length of value
+*
+*  \return None
+*
+*  \brief  Turns an LED ON/OFF from the value of its alias in the batch
+*
+*****************************************************************************/
+static void Cloud_LedCallback(void *context, const char *alias, EXORPC_STATUS status,
+		const char *value, uint16_t length)
+{
+	if (status == EXORPC_STATUS_OK && length == 1)
+	{
+		Cloud_SetLed((uint32_t)context, value[0] - '0');
+	}
+}
 
-	if (Read_status == 0)
+/*****************************************************************************
+*
+* Cloud_Flush
+*
+*  \param  None
+*
+*  \return None
+*
+*  \brief  Sends the writes and reads queued this cycle in one request
+*
+*****************************************************************************/
+void Cloud_Flush(void)
+{
+	if (exoRpc_pendingCalls() == 0 || exosite_isBusy(&g_sExosite))
 	{
-		switch2_data = exoPal_atoi(&ledx[strlen(LED3_ALIAS) + 1]);
-		if (switch2_data == 1)
-		{
-			LEDWrite(CLP_D3, CLP_D3);
-		}
-		if (switch2_data == 0)
+		// nothing queued, or an async upload has the connection
+		return;
+	}
+
+	SPI_BENCHMARK_START();
+	exoRpc_flush(&g_sExosite);
+	SPI_BENCHMARK_END("rpc");
+
+#if OFFLINE_QUEUE && !ASYNC_UPLOAD
+	if (post_failed)
+	{
+		// keep the sample for exoQueue_drain
+		Sample_Queue();
+		post_failed = 0;
+	}
+#endif
+
+	Report_ConnStats();
+}
+
+#if !ASYNC_UPLOAD
+/*****************************************************************************
+*
+* Cloud_WriteResult
+*
+*  \param  context - unused
+*  \param  alias - the alias that was written
+*  \param  status - result of the write
+*  \param  value - unused
+*  \param  length - unused
+*
+*  \return None
+*
+*  \brief  Marks the alias as sent once Exosite accepts it and, with the
+*          offline queue, flags this cycle's sample for it if a write got no
+*          answer
+*
+*****************************************************************************/
+static void Cloud_WriteResult(void *context, const char *alias, EXORPC_STATUS status,
+		const char *value, uint16_t length)
+{
+	if (status == EXORPC_STATUS_OK)
+	{
+		Sample_Commit(alias);
+		Report_FirstUpload();
+	}
+#if OFFLINE_QUEUE
+	else if (status == EXORPC_STATUS_REQUEST_ERROR || status == EXORPC_STATUS_NO_RESULT)
+	{
+		post_failed = 1;
+	}
+#endif
+}
+#endif
+#endif
+
+/*****************************************************************************
+*
+* Report_ConnStats
+*
+*  \param  None
+*
+*  \return None
+*
+*  \brief  Prints how many Exosite requests reused the kept-alive connection
+*          and how often the server address was looked up
+*
+*****************************************************************************/
+void Report_ConnStats(void)
+{
+	exoPal_connStats_t stats;
+	exoPal_dnsStats_t dns;
+
+	exoPal_getConnStats(&g_sExosite.socket, &stats);
+	UARTprintf(" Exosite connections: opened %d reused %d reopened %d idle closed %d\r\n",
+			stats.opened, stats.reused, stats.reopened, stats.idleClosed);
+	exoPal_getDnsStats(&dns);
+	UARTprintf(" Exosite DNS: lookups %d failed %d stale %d invalidated %d\r\n",
+			dns.lookups, dns.failures, dns.stale, dns.invalidated);
+}
+
+/*****************************************************************************
+*
+* Cloud_Provision
+*
+*  \param  None
+*
+*  \return None
+*
+*  \brief  Activates the device with Exosite again while it has no CIK,
+*          after a failed activation in exosite_init or a request answered
+*          with 401.  exosite_provision backs off between attempts, so this
+*          is called every loop and only prints when it made one.
+*
+*****************************************************************************/
+static void Cloud_Provision(void)
+{
+	EXO_STATE state;
+
+	if (!g_sExosite.isProvisionDue)
+	{
+		return;
+	}
+
+	state = exosite_provision(&g_sExosite);
+	if (state == EXO_STATE_INIT_COMPLETE)
+	{
+		UARTprintf(" Activated with Exosite\r\n");
+	}
+	else if (state == EXO_STATE_DEVICE_NOT_ENABLED)
+	{
+		UARTprintf(" Device not enabled in Exosite, retrying activation\r\n");
+	}
+	else if (state != EXO_STATE_NOT_COMPLETE)
+	{
+		UARTprintf(" Exosite activation failed, retrying\r\n");
+	}
+}
+
+/*****************************************************************************
+*
+* Report_FirstUpload
+*
+*  \param  None
+*
+*  \return None
+*
+*  \brief  Prints the time from boot to the first sample Exosite accepted,
+*          once.  Counted from when main starts the PAL time base, just
+*          before the NWP is brought up.
+*
+*****************************************************************************/
+static void Report_FirstUpload(void)
+{
+	static bool reported = false;
+
+	if (!reported)
+	{
+		UARTprintf(" Boot to first upload: %d ms\r\n", exoPal_getTimeMs());
+		reported = true;
+	}
+}
+
+#if SPI_BENCHMARK
+/*****************************************************************************
+*
+* Report_SpiStats
+*
+*  \param  request - name of the request that was just made
+*
+*  \return None
+*
+*  \brief  Prints the SPI write frames and bytes since SPI_BENCHMARK_START
+*
+*****************************************************************************/
+void Report_SpiStats(const char *request)
+{
+	SpiWriteStats_t stats;
+
+	spi_GetWriteStats(&stats);
+	UARTprintf(" SPI %s: %d frames %d bytes\r\n", request,
+			stats.frames - spiStatsBefore.frames,
+			stats.bytes - spiStatsBefore.bytes);
+}
+#endif
+
+#if ASYNC_UPLOAD
+/*****************************************************************************
+*
+* Cloud_WriteDone
+*
+*  \param  context - unused
+*  \param  httpStatus - HTTP status of the response, 0 if there was none
+*  \param  latencyMs - time from exosite_writeAsync to the response
+*
+*  \return None
+*
+*  \brief  Reports the result and latency of an async upload.  A sample
+*          Exosite didn't take is queued with the offline queue, else its
+*          aliases stay due for the next sample.
+*
+*****************************************************************************/
+static void Cloud_WriteDone(void *context, int16_t httpStatus, uint32_t latencyMs)
+{
+	UARTprintf(" Exosite Write: status %d in %d ms\r\n", httpStatus, latencyMs);
+	if (httpStatus >= 200 && httpStatus < 300)
+	{
+		Sample_Commit(0);
+		Report_FirstUpload();
+	}
+#if OFFLINE_QUEUE
+	else if (httpStatus == 0 || httpStatus >= 500)
+	{
+		// never reached Exosite or it couldn't take it, try again later
+		if (exoQueue_push(async_str, async_len) == 0)
 		{
-			LEDWrite(CLP_D3, ~CLP_D3);
+			Sample_Commit(0);
 		}
-		//UARTprintf(" Exosite Read:  %s=%d\r\n", LED3_ALIAS, switch2_data);
 	}
+#endif
+	Report_ConnStats();
 }
+#endif
 
+#if OFFLINE_QUEUE
 /*****************************************************************************
 *
-* Report_Sensors
+* Report_QueueStats
 *
 *  \param  None
 *
 *  \return None
 *
-*  \brief  Posts the data to Exosite Cloud
+*  \brief  Prints the offline queue depth, spill and drain counters
 *
 *****************************************************************************/
-void Report_Sensors(void)
+void Report_QueueStats(void)
 {
-	post_str[0]="";
-	post_len = 0;
+	exoQueue_stats_t stats;
+
+	exoQueue_getStats(&stats);
+	UARTprintf(" Offline queue: %d in RAM %d on flash, %d bytes spilled, %d dropped\r\n",
+			stats.ramDepth, stats.spillDepth, stats.spillBytes, stats.dropped);
+	UARTprintf(" Offline queue: %d drained in %d requests, %d ms\r\n",
+			stats.drained, stats.drainRequests, stats.drainMs);
+}
+#endif
+
+/*****************************************************************************
+*
+* Sensor samplers
+*
+*  \param  value  Set to the latest reading
+*
+*  \return true if there is a reading to report this cycle
+*
+*****************************************************************************/
+static bool Sensor_Sw1(float *value)
+{
+	*value = sw1_button_on;
+	return true;
+}
+
+static bool Sensor_Sw2(float *value)
+{
+	*value = sw2_button_on;
+	return true;
+}
+
+static bool Sensor_Tmp006(float *value)
+{
+	*value = g_fTmp006Ambient;
+	return true;
+}
+
+static bool Sensor_Bmp180Temperature(float *value)
+{
+	*value = g_fBmp180Temperature;
+	return true;
+}
+
+static bool Sensor_Bmp180Pressure(float *value)
+{
+	*value = g_fBmp180Pressure;
+	return true;
+}
+
+static bool Sensor_Sht21Humidity(float *value)
+{
+	*value = g_fSht21Humidity;
+	return true;
+}
+
+static bool Sensor_Sht21Temperature(float *value)
+{
+	*value = g_fSht21Temperature;
+	return true;
+}
+
+static bool Sensor_Isl29023(float *value)
+{
+	// only reported when the ISL29023 has finished a conversion
+	*value = g_fIsl29023Lux;
+	return g_bIsl29023Fresh;
+}
+
+// Aliases written to Exosite, in payload order.  Adding a sensor is one row.
+// Deadbands: any switch change, 0.1 C, 20 Pa, 0.5 %RH and 1 lux.
+static const Sensor_t sensors[] =
+{
+	{SW1_ALIAS,  Sensor_Sw1,               0,               0,     SENSOR_MAX_SILENCE_MS, true},
+	{SW2_ALIAS,  Sensor_Sw2,               0,               0,     SENSOR_MAX_SILENCE_MS, true},
+	{TEMP_ALIAS, Sensor_Tmp006,            SENSOR_DECIMALS, 100,   SENSOR_MAX_SILENCE_MS, true},
+	{BMPT_ALIAS, Sensor_Bmp180Temperature, SENSOR_DECIMALS, 100,   SENSOR_MAX_SILENCE_MS, true},
+	{BMPP_ALIAS, Sensor_Bmp180Pressure,    SENSOR_DECIMALS, 20000, SENSOR_MAX_SILENCE_MS, true},
+	{SHTH_ALIAS, Sensor_Sht21Humidity,     SENSOR_DECIMALS, 500,   SENSOR_MAX_SILENCE_MS, true},
+	{SHTT_ALIAS, Sensor_Sht21Temperature,  SENSOR_DECIMALS, 100,   SENSOR_MAX_SILENCE_MS, true},
+	{ISL_ALIAS,  Sensor_Isl29023,          SENSOR_DECIMALS, 1000,  SENSOR_MAX_SILENCE_MS, true}
+};
+
+#define SENSOR_COUNT    (sizeof(sensors) / sizeof(sensors[0]))
+
+static SensorState_t sensorState[SENSOR_COUNT];
+static uint32_t writesSkipped = 0;
+
+/*****************************************************************************
+*
+*  Cloud_ToFixed
+*
+*  \param  value     Sensor reading
+*  \param  decimals  Digits after the decimal point
+*
+*  \return The reading scaled by 10^decimals and rounded, for exoFmt_fixed
+*
+*****************************************************************************/
+static int32_t Cloud_ToFixed(float value, uint8_t decimals)
+{
+	int32_t scale = 1;
+
+	while (decimals-- > 0)
+	{
+		scale *= 10;
+	}
+	return (int32_t)(value * scale + (value < 0 ? -0.5f : 0.5f));
+}
+
+/*****************************************************************************
+*
+*  Sensor_IsDue
+*
+*  \param  index  Row in sensors[]
+*  \param  value  Reading, scaled by 10^decimals
+*  \param  now    exoPal_getTimeMs()
+*
+*  \return true if the alias moved past its deadband or has been silent for
+*          too long
+*
+*****************************************************************************/
+static bool Sensor_IsDue(uint8_t index, int32_t value, uint32_t now)
+{
+	const SensorState_t *state = &sensorState[index];
+	int32_t change;
+
+	if (!state->hasSent || now - state->lastSentMs >= sensors[index].maxSilenceMs)
+	{
+		return true;
+	}
+	change = value - state->lastValue;
+	return (change < 0 ? -change : change) > sensors[index].deadband;
+}
+
+/*****************************************************************************
+*
+* Sample_Sensors
+*
+*  \param  None
+*
+*  \return true if any alias is due, false if the write can be skipped
+*
+*  \brief  Reads the sensors and builds the aliases that are due into
+*          post_str.  Their deadband state only moves on at Sample_Commit,
+*          so a sample that is lost is sent again.
+*
+*****************************************************************************/
+bool Sample_Sensors(void)
+{
+	SensorState_t *state;
+	uint32_t now;
+	int32_t fixed;
+	float value;
+	uint8_t i;
 
 	readTmp006Data();
 
@@ -281,14 +840,213 @@ void Report_Sensors(void)
 
 	readIsl29023Data();
 
+	post_str[0] = '\0';
+	post_len = 0;
+	now = exoPal_getTimeMs();
+	for (i = 0; i < SENSOR_COUNT; i++)
+	{
+		// a sample that never got through is replaced by this one
+		state = &sensorState[i];
+		state->isPending = false;
+		if (!sensors[i].enabled || !sensors[i].sample(&value))
+		{
+			continue;
+		}
+		fixed = Cloud_ToFixed(value, sensors[i].decimals);
+		if (!Sensor_IsDue(i, fixed, now))
+		{
+			state->suppressed++;
+			continue;
+		}
+		if (exoFmt_appendField(post_str, sizeof(post_str), &post_len, sensors[i].alias,
+				fixed, sensors[i].decimals) != 0)
+		{
+			UARTprintf(" No room for %s\r\n", sensors[i].alias);
+			continue;
+		}
+		state->isPending = true;
+		state->pendingValue = fixed;
+		state->pendingMs = now;
+	}
+	g_bIsl29023Fresh = false;
+
+	if (post_len == 0)
+	{
+		writesSkipped++;
+		return false;
+	}
 
 	UARTprintf(" Exosite Write: %s\r\n", post_str);
 
-	//Exosite Write: usrsw1=0&usrsw2=0&tmp006=24.93&bmp180_T=23.850&bmp180_P=100266.20&sht21_H=47.764&sht21_T=16.63&isl29023=63.980
+	//Exosite Write: usrsw1=0&usrsw2=0&tmp006=24.093&bmp180_T=23.850&bmp180_P=100266.200&sht21_H=47.764&sht21_T=16.630&isl29023=63.980
 
 	UARTprintf(".");
+	return true;
+}
+
+/*****************************************************************************
+*
+* Sample_Commit
+*
+*  \param  alias - the alias Exosite accepted, 0 for every alias in post_str
+*
+*  \return None
+*
+*  \brief  Marks the pending readings as sent once Exosite has accepted them
+*          or they are in the offline queue
+*
+*****************************************************************************/
+static void Sample_Commit(const char *alias)
+{
+	SensorState_t *state;
+	uint8_t i;
+
+	for (i = 0; i < SENSOR_COUNT; i++)
+	{
+		state = &sensorState[i];
+		if (!state->isPending || (alias != 0 && strcmp(alias, sensors[i].alias) != 0))
+		{
+			continue;
+		}
+		state->hasSent = true;
+		state->lastValue = state->pendingValue;
+		state->lastSentMs = state->pendingMs;
+		state->sent++;
+		state->isPending = false;
+	}
+}
+
+#if OFFLINE_QUEUE
+/*****************************************************************************
+*
+* Sample_Queue
+*
+*  \param  None
+*
+*  \return None
+*
+*  \brief  Keeps post_str for exoQueue_drain
+*
+*****************************************************************************/
+static void Sample_Queue(void)
+{
+	if (exoQueue_push(post_str, post_len) == 0)
+	{
+		Sample_Commit(0);
+	}
+}
+#endif
+
+/*****************************************************************************
+*
+* Report_SensorStats
+*
+*  \param  None
+*
+*  \return None
+*
+*  \brief  Prints how many readings of each alias were sent and suppressed
+*
+*****************************************************************************/
+void Report_SensorStats(void)
+{
+	uint8_t i;
+
+	for (i = 0; i < SENSOR_COUNT; i++)
+	{
+		UARTprintf(" %s: %d sent %d suppressed\r\n", sensors[i].alias,
+				sensorState[i].sent, sensorState[i].suppressed);
+	}
+	UARTprintf(" Exosite Write: %d skipped, nothing changed\r\n", writesSkipped);
+}
 
-	exosite_write(post_str, post_len);
+/*****************************************************************************
+*
+* Report_Sensors
+*
+*  \param  None
+*
+*  \return None
+*
+*  \brief  Posts the data to Exosite Cloud
+*
+*****************************************************************************/
+void Report_Sensors(void)
+{
+#if OFFLINE_QUEUE && !ASYNC_UPLOAD && !RPC_BATCHING
+	exosite_result_t result;
+
+#endif
+#if ASYNC_UPLOAD
+	if (exosite_isBusy(&g_sExosite))
+	{
+		// the readings stay due and are sampled next time
+		UARTprintf(" Exosite Write: previous upload still in flight, skipped\r\n");
+		return;
+	}
+#endif
+	if (!Sample_Sensors())
+	{
+		// nothing moved, no request
+		return;
+	}
+
+#if BATCH_UPLOAD
+	// uploaded by exoQueue_drain once the batch is due
+	Sample_Queue();
+	return;
+#elif OFFLINE_QUEUE
+	if (exoQueue_depth() > 0)
+	{
+		// older samples are still queued, this one goes after them
+		Sample_Queue();
+		return;
+	}
+#endif
+
+#if ASYNC_UPLOAD
+	// post_str is copied, so the next sample can be taken straight away
+#if OFFLINE_QUEUE
+	exoPal_memcpy(async_str, post_str, post_len);
+	async_len = post_len;
+#endif
+	if (exosite_writeAsync(&g_sExosite, post_str, post_len, Cloud_WriteDone, 0) != 0)
+	{
+		UARTprintf(" Exosite Write: not started\r\n");
+	}
+#elif RPC_BATCHING
+	// sent along with this cycle's reads by Cloud_Flush, which writes the
+	// values straight from post_str, so it's left alone until then
+	exoRpc_queueWriteForm(post_str, post_len, Cloud_WriteResult, 0);
+#else
+	SPI_BENCHMARK_START();
+#if OFFLINE_QUEUE
+	result = exosite_write(&g_sExosite, post_str, post_len);
+	if (result.error != EXO_ERROR_NONE || result.status >= 500)
+	{
+		// never reached Exosite or it couldn't take it, try again later
+		Sample_Queue();
+	}
+	else if (result.status != 204)
+	{
+		UARTprintf(" Exosite Write: HTTP %d\r\n", result.status);
+	}
+	else
+	{
+		Sample_Commit(0);
+		Report_FirstUpload();
+	}
+#else
+	if (exosite_write(&g_sExosite, post_str, post_len).status == 204)
+	{
+		Sample_Commit(0);
+		Report_FirstUpload();
+	}
+#endif
+	SPI_BENCHMARK_END("write");
+
+	Report_ConnStats();
+#endif
 }
 
 /*****************************************************************************
@@ -307,13 +1065,39 @@ void cloud_demo(void)
 
 	int exo_state = -1;
 	unsigned int delay_multiplier = 1;
+#if !LONG_POLL
 	unsigned int read_interval = 2;
+#endif
+#if BATCH_UPLOAD
+	unsigned int write_interval = BATCH_SAMPLE_TICKS;
+#else
 	unsigned int write_interval = 4;
+#endif
 	unsigned int interval_counter = 0;
+#if ASYNC_UPLOAD
+	unsigned int slice;
+#endif
+#if OFFLINE_QUEUE
+	bool was_connected = true;
+#endif
 
 	UARTprintf("\r\n\r\n");
 	UARTprintf(" Exosite Cloud App Start.\r\n");
 
+	exosite_ctxInit(&g_sExosite, 0, 0);
+
+	// a CIK cached by an earlier activation is used straight away, without
+	// asking Exosite, otherwise the device activates now or from
+	// Cloud_Provision
+	if (exosite_init(&g_sExosite, EXOSITE_VENDOR, EXOSITE_MODEL) == EXO_STATE_INIT_ERROR)
+	{
+		UARTprintf(" Unable to read the device serial number\r\n");
+	}
+
+#if OFFLINE_QUEUE
+	exoQueue_init();
+#endif
+
 	exo_state = EXO_STATUS_OK; //No status code return yet from Exosite
 
 	while (1)
@@ -322,15 +1106,53 @@ void cloud_demo(void)
 		{
 			if (EXO_STATUS_OK == exo_state)
 			{
+				Cloud_Provision();
+
+#if OFFLINE_QUEUE
+				// only makes a request when the clock may have drifted too far
+				exoClock_service(&g_sExosite, CLOCK_MAX_ERROR_MS);
+#endif
+#if BATCH_UPLOAD
+				if (exoQueue_isDue(BATCH_SIZE, BATCH_MAX_LATENCY_MS) && !exosite_isBusy(&g_sExosite))
+				{
+					if (exoQueue_drain(&g_sExosite, DRAIN_REQUESTS) > 0)
+					{
+						Report_FirstUpload();
+					}
+					Report_QueueStats();
+				}
+				was_connected = true;
+#elif OFFLINE_QUEUE
+				// catch up on samples taken while the link was down
+				if (exoQueue_depth() > 0 && !exosite_isBusy(&g_sExosite))
+				{
+					if (exoQueue_drain(&g_sExosite, DRAIN_REQUESTS) > 0)
+					{
+						Report_FirstUpload();
+					}
+					Report_QueueStats();
+				}
+				was_connected = true;
+#endif
+
 				if(interval_counter % write_interval == 0)
 				{
 					Report_Sensors();
 				}
 
+#if LONG_POLL
+				// waits up to LONG_POLL_TIMEOUT_MS for an LED change
+				Cloud_Read();
+#else
 				if(interval_counter % read_interval == 0)
 				{
 					Cloud_Read();
 				}
+#endif
+
+#if RPC_BATCHING
+				Cloud_Flush();
+#endif
 			}
 
 			if (EXO_STATE_R_W_ERROR == exo_state)
@@ -344,13 +1166,54 @@ void cloud_demo(void)
 		}
 		else
 		{
+#if OFFLINE_QUEUE
+			// keep sampling at the normal rate, queued for later
+			if (was_connected)
+			{
+				UARTprintf(" WiFi Disconnected, queueing samples\r\n");
+				was_connected = false;
+			}
+			if(interval_counter % write_interval == 0)
+			{
+				if (Sample_Sensors())
+				{
+					Sample_Queue();
+				}
+			}
+			delay_multiplier = 1;
+#else
 			UARTprintf(" WiFi Disconnected\r\n");
 			UARTprintf(" Check connections and restart device . . .\r\n");
 			delay_multiplier = 60;
+#endif
+		}
+
+		// close the kept-alive Exosite connection once it has been idle too long
+		exoPal_socketService(&g_sExosite.socket);
+
+		// look up the Exosite address again before it expires, between
+		// requests so no connect has to wait for it
+		if (IS_CONNECTED(g_Status) && !exosite_isBusy(&g_sExosite))
+		{
+			exoPal_dnsService();
+		}
+
+		if(interval_counter % SENSOR_STATS_INTERVAL == 0)
+		{
+			Report_SensorStats();
 		}
 
 		Status_Indicate();
+#if ASYNC_UPLOAD
+		for (slice = 0; slice < delay_multiplier * ASYNC_POLL_SLICES; slice++)
+		{
+			_SlNonOsMainLoopTask();
+			exosite_poll(&g_sExosite);
+			SysCtlDelay(ui32SysClock / (2 * 3 * ASYNC_POLL_SLICES)); //    * 500 ms in total
+		}
+#else
 		SysCtlDelay(delay_multiplier * (ui32SysClock / (2 * 3))); //    * 500 ms
+#endif
 
 		if(interval_counter == UINT_MAX) //UINT_MAX from limits.h value 65536
 		{
@@ -364,8 +1227,6 @@ void cloud_demo(void)
 void readTmp006Data(void)
 {
 	float fAmbient, fObject;
-    int_fast32_t i32IntegerPart;
-    int_fast32_t i32FractionPart;
 
 	//
 	// Put the processor to sleep while we wait for the TMP006 to
@@ -397,55 +1258,12 @@ void readTmp006Data(void)
 	//
 	TMP006DataTemperatureGetFloat(&g_sTMP006Inst, &fAmbient, &fObject);
 
-    // Convert the floating point ambient temperature  to an integer part
-    // and fraction part for easy printing.
-    //
-    i32IntegerPart = (int32_t)fAmbient;
-    i32FractionPart = (int32_t)(fAmbient * 1000.0f);
-    i32FractionPart = i32FractionPart - (i32IntegerPart * 1000);
-    if(i32FractionPart < 0)
-    {
-        i32FractionPart *= -1;
-    }
-
-	memcpy(&post_str[post_len], SW1_ALIAS, SW1_ALIAS_LENGTH);
-	post_len += strlen(SW1_ALIAS);
-	post_str[post_len] = '=';
-	post_len++;
-	sprintf(&post_str[post_len], "%d", (char)sw1_button_on);
-
-	post_len = strlen(post_str);
-	post_str[post_len] = '&';
-	post_len++;
-
-	memcpy(&post_str[post_len], SW2_ALIAS, SW2_ALIAS_LENGTH);
-	post_len += strlen(SW2_ALIAS);
-	post_str[post_len] = '=';
-	post_len++;
-	sprintf(&post_str[post_len], "%d", (char)sw2_button_on);
-
-	post_len = strlen(post_str);
-	post_str[post_len] = '&';
-	post_len++;
-
-	//last
-	memcpy(&post_str[post_len], TEMP_ALIAS, TEMP_ALIAS_LENGTH);
-	post_len += strlen(TEMP_ALIAS);
-	post_str[post_len] = '=';
-	post_len++;
-	post_len += snprintf(&post_str[post_len], 10, "%2d.%02d", i32IntegerPart, i32FractionPart);
-
-	post_len = strlen(post_str);
-	post_str[post_len] = '&';
-	post_len++;
-
+	g_fTmp006Ambient = fAmbient;
 }
 
 void readBmp180Data(void)
 {
     float fTemperature, fPressure;// fAltitude;
-    int32_t i32IntegerPart;
-    int32_t i32FractionPart;
 
     //
     // The reads are started by SysTick Interrupt, we poll here to detect
@@ -470,27 +1288,7 @@ void readBmp180Data(void)
     BMP180DataTemperatureGetFloat(&g_sBMP180Inst, &fTemperature);
     BMP180DataPressureGetFloat(&g_sBMP180Inst, &fPressure);
 
-    //
-    // Convert the temperature to an integer part and fraction part for
-    // easy print.
-    //
-    i32IntegerPart = (int32_t) fTemperature;
-    i32FractionPart =(int32_t) (fTemperature * 1000.0f);
-    i32FractionPart = i32FractionPart - (i32IntegerPart * 1000);
-    if(i32FractionPart < 0)
-    {
-        i32FractionPart *= -1;
-    }
-
-	memcpy(&post_str[post_len], BMPT_ALIAS, BMP_ALIAS_LENGTH);
-	post_len += strlen(BMPT_ALIAS);
-	post_str[post_len] = '=';
-	post_len++;
-	post_len += snprintf(&post_str[post_len], 10, "%2d.%02d", i32IntegerPart, i32FractionPart);
-
-	post_len = strlen(post_str);
-	post_str[post_len] = '&';
-	post_len++;
+    g_fBmp180Temperature = fTemperature;
 
     //
     // Print temperature with three digits of decimal precision.
@@ -498,27 +1296,7 @@ void readBmp180Data(void)
     //UARTprintf(" Temperature %3d.%03d\n", i32IntegerPart,
     //           i32FractionPart);
 
-    //
-    // Convert the pressure to an integer part and fraction part for
-    // easy print.
-    //
-    i32IntegerPart = (int32_t) fPressure;
-    i32FractionPart =(int32_t) (fPressure * 1000.0f);
-    i32FractionPart = i32FractionPart - (i32IntegerPart * 1000);
-    if(i32FractionPart < 0)
-    {
-        i32FractionPart *= -1;
-    }
-
-	memcpy(&post_str[post_len], BMPP_ALIAS, BMP_ALIAS_LENGTH);
-	post_len += strlen(BMPP_ALIAS);
-	post_str[post_len] = '=';
-	post_len++;
-	post_len += snprintf(&post_str[post_len], 10, "%2d.%02d", i32IntegerPart, i32FractionPart);
-
-	post_len = strlen(post_str);
-	post_str[post_len] = '&';
-	post_len++;
+    g_fBmp180Pressure = fPressure;
 
     //
     // Print Pressure with three digits of decimal precision.
@@ -557,8 +1335,6 @@ void readBmp180Data(void)
 void readSht21Data(void)
 {
     float fTemperature, fHumidity;
-    int32_t i32IntegerPart;
-    int32_t i32FractionPart;
 
     //
     // Write the command to start a humidity measurement.
@@ -625,53 +1401,19 @@ void readSht21Data(void)
     SHT21DataTemperatureGetFloat(&g_sSHT21Inst, &fTemperature);
 
     //
-    // Convert the floats to an integer part and fraction part for easy
-    // print. Humidity is returned as 0.0 to 1.0 so multiply by 100 to get
-    // percent humidity.
+    // Humidity is returned as 0.0 to 1.0 so multiply by 100 to get percent
+    // humidity.
     //
     fHumidity *= 100.0f;
-    i32IntegerPart = (int32_t) fHumidity;
-    i32FractionPart = (int32_t) (fHumidity * 1000.0f);
-    i32FractionPart = i32FractionPart - (i32IntegerPart * 1000);
-    if(i32FractionPart < 0)
-    {
-        i32FractionPart *= -1;
-    }
 
-	memcpy(&post_str[post_len], SHTH_ALIAS, SHT_ALIAS_LENGTH);
-	post_len += strlen(SHTH_ALIAS);
-	post_str[post_len] = '=';
-	post_len++;
-	post_len += snprintf(&post_str[post_len], 10, "%2d.%02d", i32IntegerPart, i32FractionPart);
-
-	post_len = strlen(post_str);
-	post_str[post_len] = '&';
-	post_len++;
+    g_fSht21Humidity = fHumidity;
     //
     // Print the humidity value using the integers we just created.
     //
     //UARTprintf(" Humidity %3d.%03d\n", i32IntegerPart, i32FractionPart);
 
-    //
-    // Perform the conversion from float to a printable set of integers.
-    //
-    i32IntegerPart = (int32_t) fTemperature;
-    i32FractionPart = (int32_t) (fTemperature * 1000.0f);
-    i32FractionPart = i32FractionPart - (i32IntegerPart * 1000);
-    if(i32FractionPart < 0)
-    {
-        i32FractionPart *= -1;
-    }
-
-	memcpy(&post_str[post_len], SHTT_ALIAS, SHT_ALIAS_LENGTH);
-	post_len += strlen(SHTT_ALIAS);
-	post_str[post_len] = '=';
-	post_len++;
-	post_len += snprintf(&post_str[post_len], 10, "%2d.%02d", i32IntegerPart, i32FractionPart);
 
-	post_len = strlen(post_str);
-	post_str[post_len] = '&';
-	post_len++;
+    g_fSht21Temperature = fTemperature;
 
     //
     // Print the temperature as integer and fraction parts.
@@ -689,7 +1431,6 @@ void readSht21Data(void)
 void readIsl29023Data(void)
 {
     float fAmbient;
-    int32_t i32IntegerPart, i32FractionPart;
 
     //
     // Wait for the DataFlag which is set when a DataRead is complete.
@@ -703,22 +1444,8 @@ void readIsl29023Data(void)
         //
         ISL29023DataLightVisibleGetFloat(&g_sISL29023Inst, &fAmbient);
 
-        //
-        // Perform the conversion from float to a printable set of integers
-        //
-        i32IntegerPart = (int32_t)fAmbient;
-        i32FractionPart = (int32_t)(fAmbient * 1000.0f);
-        i32FractionPart = i32FractionPart - (i32IntegerPart * 1000);
-        if(i32FractionPart < 0)
-        {
-            i32FractionPart *= -1;
-        }
-
-    	memcpy(&post_str[post_len], ISL_ALIAS, ISL_ALIAS_LENGTH);
-    	post_len += strlen(ISL_ALIAS);
-    	post_str[post_len] = '=';
-    	post_len++;
-    	post_len += snprintf(&post_str[post_len], 10, "%2d.%02d", i32IntegerPart, i32FractionPart);
+        g_fIsl29023Lux = fAmbient;
+        g_bIsl29023Fresh = true;
 
 
         //
@@ -20,6 +20,12 @@ void SW1_Pressed(void);
 void SW2_Pressed(void);
 void Demo_Tick(void);
 void cloud_demo(void);
+void Cloud_Flush(void);
+void Report_ConnStats(void);
+void Report_QueueStats(void);
+bool Sample_Sensors(void);
+void Report_SensorStats(void);
+void Report_SpiStats(const char *request);
 
 void readTmp006Data(void);
 void readBmp180Data(void);
@@ -0,0 +1,2188 @@
+/*****************************************************************************
+*
+*  exosite.c - Exosite cloud communications.
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+#include "exosite_pal.h"
+#include "exosite_http.h"
+#include "exosite.h"
+
+static const char STR_TIMESTAMP_URL[] = "GET /timestamp ";
+static const char STR_CIK_HEADER[] = "X-Exosite-CIK: ";
+static const char STR_CONTENT_LENGTH[] = "Content-Length: ";
+static const char STR_READ_URL[] = "GET /onep:v1/stack/alias?";
+static const char STR_WRITE_URL[] = "POST /onep:v1/stack/alias ";
+static const char STR_ACTIVATE_URL[] = "POST /provision/activate ";
+static const char STR_RPC_URL[] = "POST /onep:v1/rpc/process ";
+static const char STR_HTTP[] = "HTTP/1.1";
+static const char STR_HOST[] = "Host: m2.exosite.com";
+static const char STR_ACCEPT[] = "Accept: application/x-www-form-urlencoded; charset=utf-8";
+static const char STR_ACCEPT_JSON[] = "Accept: application/json; charset=utf-8";
+static const char STR_CONTENT[] = "Content-Type: application/x-www-form-urlencoded; charset=utf-8";
+static const char STR_CONTENT_JSON[] = "Content-Type: application/json; charset=utf-8";
+static const char STR_CRLF[] = "\r\n";
+static const char STR_READ_HTTP[] = " HTTP/1.1\r\n";
+static const char STR_REQUEST_TIMEOUT[] = "Request-Timeout: ";
+static const char STR_IF_MODIFIED_SINCE[] = "If-Modified-Since: ";
+static const char STR_LAST_MODIFIED[] = "last-modified:";
+static const char STR_DATE[] = "date:";
+
+// used until a CIK is activated or set, replace to hard code one
+static const char STR_DEFAULT_CIK[CIK_LENGTH] = "YOUR EXOSITE CIK HERE";
+
+// local functions
+static uint8_t exosite_connect(exosite_ctx_t * ctx);
+static uint8_t exosite_disconnect(exosite_ctx_t * ctx);
+static EXO_ERROR exosite_open(exosite_ctx_t * ctx);
+static exosite_result_t exosite_failed(EXO_ERROR error);
+static void exosite_receive(exosite_ctx_t * ctx, exoHttp_parser_t * parser, exosite_result_t * result);
+static void exosite_trackStatus(exosite_ctx_t * ctx, int16_t httpStatus);
+static void exosite_bufferBody(void * context, const char * data, uint16_t length);
+static void exosite_findAliasValue(void * context, const char * data, uint16_t length);
+static void exosite_findModified(void * context, const char * line, uint16_t length);
+static uint8_t exosite_asyncAppend(exosite_ctx_t * ctx, const char * data, uint16_t length);
+static void exosite_asyncStart(exosite_ctx_t * ctx, char * body, uint16_t bodySize,
+                               exosite_asyncCallback callback, void * context);
+static void exosite_asyncComplete(exosite_ctx_t * ctx, int16_t httpStatus);
+static void exosite_shiftDigit(exosite_value_t * value, uint8_t digit);
+static void exosite_buildHeaders(exosite_ctx_t * ctx);
+static void exosite_startProvision(exosite_ctx_t * ctx);
+static void exosite_scheduleProvision(exosite_ctx_t * ctx);
+static void exosite_writeRpcBody(exosite_ctx_t * ctx, exoJson_writer_t * writer,
+                                 exosite_rpcCallsWriter writeCalls, void * context);
+
+
+#define STR_VENDOR  "vendor="
+#define STR_MODEL   "&model="
+#define STR_SN      "&sn="
+
+
+/*!
+ * Picks the value of one alias out of an urlencoded body, see
+ * exosite_findAliasValue.
+ */
+typedef struct exosite_aliasValue_tag
+{
+    const char * alias;
+    uint16_t matched;   /*!< chars of alias matched in the current key */
+    uint8_t state;      /*!< one of the ALIAS_VALUE_ states */
+    char * value;
+    uint16_t size;      /*!< size of value, including the null terminator */
+    uint16_t length;    /*!< value chars stored so far */
+}exosite_aliasValue_t;
+
+/*!
+ * Response of a long-poll read: the body goes to a caller buffer and the
+ * Last-Modified (or failing that Date) header is kept for the next request.
+ * body must stay the first member, see exosite_bufferBody.
+ */
+typedef struct exosite_longPollResponse_tag
+{
+    exosite_bodyBuffer_t body;
+    char modified[MAX_MODIFIED_SINCE_LENGTH + 1];
+    uint8_t hasLastModified;
+}exosite_longPollResponse_t;
+
+#define ALIAS_VALUE_KEY     0
+#define ALIAS_VALUE_SKIP    1
+#define ALIAS_VALUE_COPY    2
+#define ALIAS_VALUE_DONE    3
+
+
+/*!
+ * \brief Reset the cik to ""
+ *
+ * The following code would reset the contents of the cik to be an empty string.
+   \code{.c}
+   exosite_resetCik(&ctx);
+   \endcode
+ *
+ * \return Returns 0 if successful, else error code
+ * \sa
+ * \note
+ * \warning
+ */
+uint8_t exosite_resetCik(exosite_ctx_t * ctx)
+{
+
+    exoPal_setCik(ctx->cikSlot, "");
+    ctx->cik[0] = '\0';
+    exosite_buildHeaders(ctx);
+    return 0;
+}
+
+/*****************************************************************************
+*
+* Exosite_StatusCode
+*
+*  \param  ctx - context to report on
+*
+*  \return 1 success; 0 failure
+*
+*  \brief  Provides feedback from Exosite status codes
+*
+*****************************************************************************/
+int Exosite_StatusCode(const exosite_ctx_t * ctx)
+{
+  return ctx->status;
+}
+
+/*!
+ * \brief  Copies a string, truncated to \a maxLength chars and null terminated
+ */
+static void exosite_copyString(char * dst, const char * src, uint16_t maxLength)
+{
+    uint16_t length = exoPal_strlen(src);
+
+    if (length > maxLength)
+    {
+        length = maxLength;
+    }
+    exoPal_memcpy(dst, src, length);
+    dst[length] = '\0';
+}
+
+/*!
+ * \brief  Initializes a context
+ *
+ * This **MUST** be called on a context before it is passed to any other
+ * exosite library call.  Loads the CIK kept in \a cikSlot, if any, so requests
+ * can be made straight away by a device that was activated before.  Doesn't
+ * touch the network.
+ *
+   \code{.c}
+   static exosite_ctx_t ctx;
+   exosite_ctxInit(&ctx, 0, 0);
+   exosite_init(&ctx, "myVendor", "myModel");
+   \endcode
+ *
+ * \param[out] ctx Context to initialize
+ * \param[in] uuid Serial number to activate with, 0 for exoPal_getUuid
+ * \param[in] cikSlot NVM slot the CIK is kept in, one per device identity
+ */
+void exosite_ctxInit(exosite_ctx_t * ctx, const char * uuid, uint8_t cikSlot)
+{
+    ctx->vendor[0] = '\0';
+    ctx->model[0] = '\0';
+    ctx->uuid[0] = '\0';
+    ctx->cikSlot = cikSlot;
+    ctx->initState = EXO_STATE_NOT_COMPLETE;
+    ctx->status = EXO_STATUS_END;
+    ctx->asyncState = EXO_ASYNC_IDLE;
+    ctx->isAsyncActivation = 0;
+    ctx->isProvisionDue = 0;
+    ctx->provisionRetries = 0;
+    ctx->jitterSeed = 0;
+    exoPal_socketInit(&ctx->socket);
+
+    if (uuid)
+    {
+        exosite_copyString(ctx->uuid, uuid, MAX_UUID_LENGTH);
+    }
+    if (exoPal_getCik(ctx->cikSlot, ctx->cik) != 0)
+    {
+        exoPal_memcpy(ctx->cik, STR_DEFAULT_CIK, CIK_LENGTH);
+    }
+    exosite_buildHeaders(ctx);
+}
+
+/*!
+ * \brief  Initializes the Exosite libraries and activates the device with
+ *          Exosite if it has no CIK yet
+ *
+ * Must be called after exosite_ctxInit, before any requests are made on ctx.
+ *
+ * A CIK cached by an earlier activation is trusted without asking Exosite,
+ * so a device that has been activated before makes its first data call
+ * without a round trip to /provision/activate.  If Exosite rejects that CIK
+ * later, the 401 has exosite_provision activate the device again.
+ *
+ * Otherwise assumes that the modem is setup and ready to make a socket
+ * connection and calls exosite_activate.  This will fail if activation
+ * fails, in which case exosite_provision retries it.
+ *
+ * \param[in,out] ctx Context initialized with exosite_ctxInit
+ * \param[in] vendor Pointer to string containing vendor name
+ * \param[in] model Pointer to string containing model name
+ *
+ * \return Device Activation status
+ */
+EXO_STATE exosite_init(exosite_ctx_t * ctx, const char * vendor, const char *model)
+{
+    uint8_t retStatus = 0;
+    uint8_t i;
+    // reset state
+    ctx->initState = EXO_STATE_NOT_COMPLETE;
+    ctx->isProvisionDue = 0;
+    ctx->provisionRetries = 0;
+
+    exoPal_init();
+
+    // get cik and uuid and any other nvm stored data, into ram.
+    exoPal_getCik(ctx->cikSlot, ctx->cik);
+    if (ctx->uuid[0] == '\0')
+    {
+        retStatus = exoPal_getUuid(ctx->uuid);
+    }
+    exosite_copyString(ctx->vendor, vendor, MAX_VENDOR_LENGTH);
+    exosite_copyString(ctx->model, model, MAX_MODEL_LENGTH);
+    exosite_buildHeaders(ctx);
+    // create activation request
+    if (retStatus)
+    {
+        ctx->initState = EXO_STATE_INIT_ERROR;
+        return ctx->initState;
+    }
+
+    // seeds the retry jitter, different per device so a fleet that loses
+    // its CIKs at once doesn't retry in step
+    ctx->jitterSeed = exoPal_getTimeMs();
+    for (i = 0; ctx->uuid[i] != '\0'; i++)
+    {
+        ctx->jitterSeed = (ctx->jitterSeed ^ (uint8_t)ctx->uuid[i]) * 16777619;
+    }
+
+    if (exosite_isCIKValid(ctx->cik))
+    {
+        ctx->initState = EXO_STATE_INIT_COMPLETE;
+        return ctx->initState;
+    }
+    ctx->initState = exosite_activate(ctx);
+    if (ctx->initState == EXO_STATE_VALID_CIK)
+    {
+        ctx->initState = EXO_STATE_INIT_COMPLETE;
+    }
+    else
+    {
+        ctx->isProvisionDue = 1;
+        exosite_scheduleProvision(ctx);
+    }
+    return ctx->initState;
+}
+
+
+/*!
+ * \brief  Activates the device again, with backoff, while it has no CIK
+ *
+ * Call from the main loop after exosite_init.  Does nothing, and makes no
+ * request, unless activation failed in exosite_init or a request was
+ * answered with 401.  The rejected CIK is dropped at the 401, so requests
+ * fail with EXO_ERROR_NO_CIK until a new one is activated; it stays in NVM
+ * until then.  Retries wait PROVISION_RETRY_MIN_MS, doubling up to
+ * PROVISION_RETRY_MAX_MS, each shortened by a random part of up to half.
+ *
+ * \param[in,out] ctx Context initialized with exosite_init
+ *
+ * \return EXO_STATE_NOT_COMPLETE while waiting to retry, else the state of
+ *         the last activation, EXO_STATE_INIT_COMPLETE once it succeeded
+ */
+EXO_STATE exosite_provision(exosite_ctx_t * ctx)
+{
+    if (!ctx->isProvisionDue)
+    {
+        return ctx->initState;
+    }
+    if (exoPal_getTimeMs() - ctx->provisionFromMs < ctx->provisionDelayMs ||
+        exosite_isBusy(ctx))
+    {
+        return EXO_STATE_NOT_COMPLETE;
+    }
+
+    ctx->initState = exosite_activate(ctx);
+    if (ctx->initState == EXO_STATE_VALID_CIK)
+    {
+        ctx->isProvisionDue = 0;
+        ctx->provisionRetries = 0;
+        ctx->initState = EXO_STATE_INIT_COMPLETE;
+    }
+    else
+    {
+        exosite_scheduleProvision(ctx);
+    }
+    return ctx->initState;
+}
+
+
+/*!
+ * \brief  Drops a CIK Exosite rejected and has exosite_provision activate
+ *          the device straight away
+ */
+static void exosite_startProvision(exosite_ctx_t * ctx)
+{
+    ctx->isProvisionDue = 1;
+    ctx->provisionRetries = 0;
+    ctx->provisionFromMs = exoPal_getTimeMs();
+    ctx->provisionDelayMs = 0;
+    ctx->cik[0] = '\0';
+    exosite_buildHeaders(ctx);
+}
+
+
+/*!
+ * \brief  Schedules the next activation attempt after one failed
+ *
+ * Waits between half and all of an exponential backoff, picked with a
+ * linear congruential generator.
+ */
+static void exosite_scheduleProvision(exosite_ctx_t * ctx)
+{
+    uint32_t delayMs = PROVISION_RETRY_MIN_MS;
+    uint8_t i;
+
+    for (i = 0; i < ctx->provisionRetries && delayMs < PROVISION_RETRY_MAX_MS; i++)
+    {
+        delayMs <<= 1;
+    }
+    if (delayMs > PROVISION_RETRY_MAX_MS)
+    {
+        delayMs = PROVISION_RETRY_MAX_MS;
+    }
+    if (ctx->provisionRetries < 0xFF)
+    {
+        ctx->provisionRetries++;
+    }
+
+    ctx->jitterSeed = ctx->jitterSeed * 1664525 + 1013904223;
+    ctx->provisionDelayMs = delayMs - (ctx->jitterSeed >> 8) % (delayMs / 2 + 1);
+    ctx->provisionFromMs = exoPal_getTimeMs();
+}
+
+
+
+
+/*!
+ * \brief  Makes a provisioning request to Exosite.
+ *
+ *
+ *
+ * \return The devices activation status
+ */
+EXO_STATE exosite_activate(exosite_ctx_t * ctx)
+{
+    // fits any uint16_t body length
+    char contentLengthStr[6];
+    uint8_t len_of_contentLengthStr;
+    EXO_STATE retVal;
+    exosite_result_t result;
+    char cik[CIK_LENGTH + 1];
+    exosite_bodyBuffer_t body = {cik, sizeof(cik), 0};
+    exoHttp_parser_t parser;
+    int32_t results = 0;
+    
+    
+    // Try and activate device with Exosite, four possible cases:
+    // * We don't have a stored CIK and receive a 200 response with a CIK
+    //    * Means device was enabled and this was our first connection
+    // * We don't have a stored CIK and receive a 409 response
+    //    * The device is not enabled.
+    // * We have a CIK and receive a 409 response.
+    //     *  Device has already been activated and has a valid CIK,
+    //        unless exosite_startProvision dropped it for a 401
+    // * We have a stored CIK and receive a 401 response
+    //    * R/W error
+    
+    uint8_t vendorLength = exoPal_strlen(ctx->vendor);
+    uint8_t modelLength = exoPal_strlen(ctx->model);
+    uint8_t uuidLength = exoPal_strlen(ctx->uuid);
+
+    // get body length
+    uint16_t bodyLength = sizeof(STR_VENDOR) - 1 +
+                          sizeof(STR_MODEL) - 1 +
+                          sizeof(STR_SN) - 1;
+    bodyLength += vendorLength + modelLength + uuidLength;
+
+    
+    len_of_contentLengthStr = exoPal_itoa((int)bodyLength, contentLengthStr, sizeof(contentLengthStr));
+
+
+    if (exosite_connect(ctx) != 0)
+    {
+        return EXO_STATE_CONNECTION_ERROR;
+    }
+
+
+    // send request
+    results |= exoPal_socketWrite(&ctx->socket, STR_ACTIVATE_URL, sizeof(STR_ACTIVATE_URL) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, STR_HTTP, sizeof(STR_HTTP) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF) - 1);
+
+    // send Host header
+    results |= exoPal_socketWrite(&ctx->socket, STR_HOST, sizeof(STR_HOST) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF) - 1);
+
+    // send content type header
+    results |= exoPal_socketWrite(&ctx->socket, STR_CONTENT, sizeof(STR_CONTENT) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF) - 1);
+
+    // send content length header
+    results |= exoPal_socketWrite(&ctx->socket, STR_CONTENT_LENGTH, sizeof(STR_CONTENT_LENGTH) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, contentLengthStr, len_of_contentLengthStr);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF) - 1);
+
+    // send body
+    results |= exoPal_socketWrite(&ctx->socket, STR_VENDOR, sizeof(STR_VENDOR) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, ctx->vendor, vendorLength);
+    results |= exoPal_socketWrite(&ctx->socket, STR_MODEL, sizeof(STR_MODEL) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, ctx->model, modelLength);
+    results |= exoPal_socketWrite(&ctx->socket, STR_SN, sizeof(STR_SN) - 1);
+    results |= exoPal_socketWrite(&ctx->socket, ctx->uuid, uuidLength);
+   
+    results |= exoPal_sendingComplete(&ctx->socket);
+
+    if (results != 0)
+    {
+        // the request didn't go out, try again like any connection error
+        exosite_disconnect(ctx);
+        return EXO_STATE_CONNECTION_ERROR;
+    }
+
+
+    retVal = EXO_STATE_CONNECTION_ERROR;
+
+
+    
+
+    exoHttp_init(&parser, exosite_bufferBody, 0, &body);
+    exosite_receive(ctx, &parser, &result);
+
+    
+    if (result.error != EXO_ERROR_NONE)
+    {
+        // if we didn't receive a response from the modem
+        retVal = EXO_STATE_NO_RESPONSE;
+    }
+    else if (result.status == 200)
+    {
+        // we received a CIK.
+        if ((exosite_isCIKValid(cik)) && (body.length == CIK_LENGTH))
+        {
+            // got a valid cik in the response
+            exoPal_setCik(ctx->cikSlot, cik);
+            exoPal_memcpy(ctx->cik, cik, CIK_LENGTH);
+            exosite_buildHeaders(ctx);
+            retVal = EXO_STATE_VALID_CIK;
+        }
+    }
+    else if (result.status == 409)
+    {
+        if (exosite_isCIKValid(ctx->cik))
+        {
+            // If we receive a 409 and we do have a valid CIK, we will
+            // assume we are good to go.
+            retVal = EXO_STATE_VALID_CIK;
+
+        }
+        else
+        {
+            // if we don't have a CIK in nvm and we receive a 409
+            // The device isn't enabled in the dashboard
+            retVal = EXO_STATE_DEVICE_NOT_ENABLED;
+
+        }
+    }
+    else if (result.status == 404)
+    {
+		// platform doesn't know about this device
+		retVal = EXO_STATE_DEVICE_NOT_ENABLED;
+    }
+    else if (result.status == 401)
+    {
+        // RW error
+        retVal = EXO_STATE_R_W_ERROR;
+    }
+
+    return retVal;
+
+}
+
+
+/*!
+ * \brief Checks if the given cik is valid
+ *
+ * Checks that the first 40 chars of `cik` are valid, lowercase hexadecimal bytes.
+ *
+ *
+ *
+ * \param[in] cik array of CIK_LENGTH bytes
+ *
+ * \return Returns 1 if successful, else 0
+ * \sa
+ * \note
+ * \warning
+ */
+uint8_t exosite_isCIKValid(const char cik[CIK_LENGTH])
+{
+    uint8_t i;
+
+    for (i = 0; i < CIK_LENGTH; i++)
+    {
+        if (!((cik[i] >= 'a' && cik[i] <= 'f') || (cik[i] >= '0' && cik[i] <= '9')))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+
+/*!
+ *  \brief  Programs a new CIK to flash / non volatile
+ *
+ * \param[in] pCIK Pointer to CIK
+ *
+ */
+void exosite_setCIK(exosite_ctx_t * ctx, const char * pCIK)
+{
+    exoPal_setCik(ctx->cikSlot, pCIK);
+    exoPal_memcpy(ctx->cik, pCIK, CIK_LENGTH);
+    exosite_buildHeaders(ctx);
+    ctx->isProvisionDue = 0;
+    return;
+}
+
+
+
+/*!
+ *  \brief  Retrieves a the CIK from NVM and places it in to the string pointed
+ *			at by \a cik
+ *
+ * \param[out] cik Pointer to CIK
+ *
+ */
+void exosite_getCIK(const exosite_ctx_t * ctx, char * cik)
+{
+    exoPal_getCik(ctx->cikSlot, cik);
+
+    return;
+}
+
+
+
+/*!
+ *  \brief  Returns the CIK currently in use
+ *
+ * Unlike exosite_getCIK this doesn't read NVM.
+ *
+ * \return Pointer to the CIK_LENGTH chars of the CIK, not null terminated
+ */
+const char * exosite_currentCIK(const exosite_ctx_t * ctx)
+{
+    return ctx->cik;
+}
+
+
+/*!
+ *  \brief  Writes data to Exosite
+ *
+ * Writes the data in writeData to Exosite.  The data is written as the body of
+ * a POST request to Exosite's `/onep:v1/stack/alias request`.
+ *
+ * Below is how you would write a value of `5` to the `myAlias` alias.
+ * \code{.c}
+ * exosite_result_t result = exosite_write(&ctx, "myAlias=5", sizeof("myAlias=5") - 1);
+ * if (result.error == EXO_ERROR_NONE && result.status == 204)
+ * {
+ *     // written
+ * }
+ * \endcode
+ *
+ * \param[in] writeData Pointer to buffer of data to write to Exosite
+ * \param[in] length length of data in buffer
+ *
+ * \return Result of the request.  \a error is EXO_ERROR_NONE once a response
+ *         arrived, and \a status is then 204 if the write was accepted.  There
+ *         is no body.
+ *
+ */
+exosite_result_t exosite_write(exosite_ctx_t * ctx, const char * writeData, uint16_t length)
+{
+    // fits any uint16_t length
+    char contentLengthStr[6];
+    uint8_t len_of_contentLengthStr;
+    exosite_result_t result;
+    exoHttp_parser_t parser;
+    EXO_ERROR error;
+    int32_t results = 0;
+
+    // check the CIK and connect to exosite
+    error = exosite_open(ctx);
+    if (error != EXO_ERROR_NONE)
+    {
+        return exosite_failed(error);
+    }
+
+
+    len_of_contentLengthStr = exoPal_itoa((int)length, contentLengthStr, sizeof(contentLengthStr));
+
+    // send request line, Host, CIK and Content-Type headers
+    results |= exoPal_socketWrite(&ctx->socket, ctx->headerTemplate[EXO_REQUEST_WRITE],
+                                  ctx->headerTemplateLength[EXO_REQUEST_WRITE]);
+
+    // send content length value
+    results |= exoPal_socketWrite(&ctx->socket, contentLengthStr, len_of_contentLengthStr);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+
+    // send body
+    results |= exoPal_socketWrite(&ctx->socket, writeData, length);
+
+    results |= exoPal_sendingComplete(&ctx->socket);
+    
+    if (results != 0)
+    {
+        exosite_disconnect(ctx);
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+
+    // get response, no body expected
+    exoHttp_init(&parser, 0, 0, 0);
+    exosite_receive(ctx, &parser, &result);
+
+    return result;
+}
+
+
+
+/*!
+ *  \brief  Starts writing data to Exosite without blocking
+ *
+ * Queues the same request as exosite_write, which exosite_poll then connects,
+ * sends and reads the response of a step at a time.  writeData is copied, so
+ * the caller can reuse it straight away.  Only one request can be in flight
+ * per context, and its blocking calls fail until it completes.
+ *
+   \code{.c}
+   exosite_writeAsync(&ctx, "myAlias=5", sizeof("myAlias=5") - 1, onWritten, 0);
+   while (exosite_poll(&ctx))
+   {
+       // keep sampling, onWritten is called from exosite_poll on completion
+   }
+   \endcode
+ *
+ * \param[in] writeData Pointer to buffer of data to write to Exosite
+ * \param[in] length length of data in buffer
+ * \param[in] callback Called from exosite_poll when the write completes, may be 0
+ * \param[in] context Passed to callback
+ *
+ * \return 0 if queued, -99 without a valid CIK, 1 if a request is already in
+ *         flight, 2 if the request doesn't fit in ASYNC_REQUEST_SIZE
+ *
+ */
+int32_t exosite_writeAsync(exosite_ctx_t * ctx, const char * writeData, uint16_t length, exosite_asyncCallback callback, void * context)
+{
+    // fits any uint16_t length
+    char contentLengthStr[6];
+    uint8_t len_of_contentLengthStr;
+
+    if(!exosite_isCIKValid(ctx->cik))
+    {
+        // tried to write without a valid CIK
+        return -99;
+    }
+    if (ctx->asyncState != EXO_ASYNC_IDLE)
+    {
+        return 1;
+    }
+
+    // the body alone must fit before its length is even formatted
+    if (length > ASYNC_REQUEST_SIZE)
+    {
+        return 2;
+    }
+    len_of_contentLengthStr = exoPal_itoa((int)length, contentLengthStr, sizeof(contentLengthStr));
+    if (ctx->headerTemplateLength[EXO_REQUEST_WRITE] + len_of_contentLengthStr +
+        2 * (sizeof(STR_CRLF)-1) + length > ASYNC_REQUEST_SIZE)
+    {
+        return 2;
+    }
+
+    // request line, Host, CIK and Content-Type headers, then the body
+    ctx->asyncRequestLength = 0;
+    exosite_asyncAppend(ctx, ctx->headerTemplate[EXO_REQUEST_WRITE],
+                        ctx->headerTemplateLength[EXO_REQUEST_WRITE]);
+    exosite_asyncAppend(ctx, contentLengthStr, len_of_contentLengthStr);
+    exosite_asyncAppend(ctx, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_asyncAppend(ctx, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_asyncAppend(ctx, writeData, length);
+
+    // no body expected
+    exosite_asyncStart(ctx, 0, 0, callback, context);
+
+    return 0;
+}
+
+
+
+/*!
+ *  \brief  Starts reading data from Exosite without blocking
+ *
+ * Queues the same request as exosite_read for exosite_poll.  The body is
+ * stored in readResponse as it arrives, so readResponse must stay untouched
+ * until the callback has been called.
+ *
+   \code{.c}
+   exosite_readAsync(&ctx, "myAlias", readBuffer, sizeof(readBuffer), onRead, 0);
+   // onRead is called from exosite_poll, with readBuffer holding something
+   // like "myAlias=3" if httpStatus is 200
+   \endcode
+ *
+ * \param[in] alias Name/s of data source/s alias to read from
+ * \param[out] readResponse buffer to place the body in, null terminated
+ * \param[in] buflen length of buffer
+ * \param[in] callback Called from exosite_poll when the read completes, may be 0
+ * \param[in] context Passed to callback
+ *
+ * \return 0 if queued, -99 without a valid CIK, 1 if a request is already in
+ *         flight, 2 if the request doesn't fit in ASYNC_REQUEST_SIZE
+ *
+ */
+int32_t exosite_readAsync(exosite_ctx_t * ctx, const char * alias, char * readResponse, uint16_t buflen, exosite_asyncCallback callback, void * context)
+{
+    uint8_t results = 0;
+
+    if(!exosite_isCIKValid(ctx->cik))
+    {
+        return -99;
+    }
+    if (ctx->asyncState != EXO_ASYNC_IDLE)
+    {
+        return 1;
+    }
+
+    // request line with the aliases, then Host, CIK and Accept headers
+    ctx->asyncRequestLength = 0;
+    results |= exosite_asyncAppend(ctx, STR_READ_URL, sizeof(STR_READ_URL)-1);
+    results |= exosite_asyncAppend(ctx, alias, exoPal_strlen(alias));
+    results |= exosite_asyncAppend(ctx, ctx->headerTemplate[EXO_REQUEST_READ],
+                                   ctx->headerTemplateLength[EXO_REQUEST_READ]);
+    if (results != 0)
+    {
+        return 2;
+    }
+
+    readResponse[0] = '\0';
+    exosite_asyncStart(ctx, readResponse, buflen, callback, context);
+
+    return 0;
+}
+
+
+
+/*!
+ *  \brief  Starts activating the device with Exosite without blocking
+ *
+ * Queues the same request as exosite_activate for exosite_poll, for the uuid
+ * given to exosite_ctxInit.  If the response is a 200 with a valid CIK, the
+ * CIK is stored as with exosite_setCIK before the callback is called.  Like
+ * exosite_init, vendor and model are kept so a later 401 can activate the
+ * device again.
+ *
+ * \param[in] vendor Vendor name
+ * \param[in] model Model name
+ * \param[in] callback Called from exosite_poll when the activation completes,
+ *                     may be 0
+ * \param[in] context Passed to callback
+ *
+ * \return 0 if queued, 1 if a request is already in flight, 2 if the request
+ *         doesn't fit in ASYNC_REQUEST_SIZE
+ *
+ */
+int32_t exosite_activateAsync(exosite_ctx_t * ctx, const char * vendor, const char * model, exosite_asyncCallback callback, void * context)
+{
+    char contentLengthStr[6];
+    uint8_t len_of_contentLengthStr;
+    uint16_t bodyLength;
+    uint8_t results = 0;
+
+    if (ctx->asyncState != EXO_ASYNC_IDLE)
+    {
+        return 1;
+    }
+
+    exosite_copyString(ctx->vendor, vendor, MAX_VENDOR_LENGTH);
+    exosite_copyString(ctx->model, model, MAX_MODEL_LENGTH);
+    bodyLength = sizeof(STR_VENDOR) - 1 + exoPal_strlen(ctx->vendor) +
+                 sizeof(STR_MODEL) - 1 + exoPal_strlen(ctx->model) +
+                 sizeof(STR_SN) - 1 + exoPal_strlen(ctx->uuid);
+    len_of_contentLengthStr = exoPal_itoa((int)bodyLength, contentLengthStr, sizeof(contentLengthStr));
+
+    // request line, Host, Content-Type and Content-Length headers
+    ctx->asyncRequestLength = 0;
+    results |= exosite_asyncAppend(ctx, STR_ACTIVATE_URL, sizeof(STR_ACTIVATE_URL) - 1);
+    results |= exosite_asyncAppend(ctx, STR_HTTP, sizeof(STR_HTTP) - 1);
+    results |= exosite_asyncAppend(ctx, STR_CRLF, sizeof(STR_CRLF) - 1);
+    results |= exosite_asyncAppend(ctx, STR_HOST, sizeof(STR_HOST) - 1);
+    results |= exosite_asyncAppend(ctx, STR_CRLF, sizeof(STR_CRLF) - 1);
+    results |= exosite_asyncAppend(ctx, STR_CONTENT, sizeof(STR_CONTENT) - 1);
+    results |= exosite_asyncAppend(ctx, STR_CRLF, sizeof(STR_CRLF) - 1);
+    results |= exosite_asyncAppend(ctx, STR_CONTENT_LENGTH, sizeof(STR_CONTENT_LENGTH) - 1);
+    results |= exosite_asyncAppend(ctx, contentLengthStr, len_of_contentLengthStr);
+    results |= exosite_asyncAppend(ctx, STR_CRLF, sizeof(STR_CRLF) - 1);
+    results |= exosite_asyncAppend(ctx, STR_CRLF, sizeof(STR_CRLF) - 1);
+
+    // body
+    results |= exosite_asyncAppend(ctx, STR_VENDOR, sizeof(STR_VENDOR) - 1);
+    results |= exosite_asyncAppend(ctx, ctx->vendor, exoPal_strlen(ctx->vendor));
+    results |= exosite_asyncAppend(ctx, STR_MODEL, sizeof(STR_MODEL) - 1);
+    results |= exosite_asyncAppend(ctx, ctx->model, exoPal_strlen(ctx->model));
+    results |= exosite_asyncAppend(ctx, STR_SN, sizeof(STR_SN) - 1);
+    results |= exosite_asyncAppend(ctx, ctx->uuid, exoPal_strlen(ctx->uuid));
+    if (results != 0)
+    {
+        return 2;
+    }
+
+    // the CIK goes into asyncRequest, which is free once the request is sent
+    exosite_asyncStart(ctx, ctx->asyncRequest, CIK_LENGTH + 1, callback, context);
+    ctx->isAsyncActivation = 1;
+
+    return 0;
+}
+
+
+/*!
+ *  \brief  Steps the async request, if any, without blocking
+ *
+ * Must be called regularly from the application's main loop while
+ * exosite_writeAsync, exosite_readAsync or exosite_activateAsync has a
+ * request in flight.  The request's callback is
+ * called from here when it completes or fails.
+ *
+ * \return 1 while a request is in flight, else 0
+ *
+ */
+uint8_t exosite_poll(exosite_ctx_t * ctx)
+{
+    EXOPAL_ASYNC result;
+    uint16_t chunkLength;
+    int32_t consumed;
+
+    if (ctx->asyncState == EXO_ASYNC_IDLE)
+    {
+        return 0;
+    }
+
+    if (exoPal_getTimeMs() - ctx->asyncStartMs >= ASYNC_TIMEOUT_MS)
+    {
+        exoPal_tcpSocketClose(&ctx->socket);
+        exosite_asyncComplete(ctx, 0);
+        return 0;
+    }
+
+    if (ctx->asyncState == EXO_ASYNC_CONNECTING)
+    {
+        result = exoPal_tcpSocketOpenAsync(&ctx->socket);
+        if (result == EXOPAL_ASYNC_ERROR)
+        {
+            exosite_asyncComplete(ctx, 0);
+            return 0;
+        }
+        if (result == EXOPAL_ASYNC_PENDING)
+        {
+            return 1;
+        }
+        ctx->asyncState = EXO_ASYNC_SENDING;
+    }
+
+    if (ctx->asyncState == EXO_ASYNC_SENDING)
+    {
+        result = exoPal_socketSendAsync(&ctx->socket, ctx->asyncRequest, ctx->asyncRequestLength, &ctx->asyncSent);
+        if (result == EXOPAL_ASYNC_ERROR)
+        {
+            exosite_asyncComplete(ctx, 0);
+            return 0;
+        }
+        if (result == EXOPAL_ASYNC_PENDING)
+        {
+            return 1;
+        }
+        // the body, if any is wanted, is streamed into asyncBody
+        exoHttp_init(&ctx->asyncParser, ctx->asyncBody.size ? exosite_bufferBody : 0, 0,
+                     &ctx->asyncBody);
+        ctx->asyncState = EXO_ASYNC_RECEIVING;
+    }
+
+    // EXO_ASYNC_RECEIVING, take whatever has arrived
+    while (!exoHttp_isComplete(&ctx->asyncParser))
+    {
+        result = exoPal_socketReadAsync(&ctx->socket, ctx->rxBuffer, RX_BUFFER_SIZE, &chunkLength);
+        if (result == EXOPAL_ASYNC_PENDING)
+        {
+            return 1;
+        }
+        if (result == EXOPAL_ASYNC_ERROR)
+        {
+            // closed by the server
+            exoHttp_finish(&ctx->asyncParser);
+            break;
+        }
+        consumed = exoHttp_parse(&ctx->asyncParser, ctx->rxBuffer, chunkLength);
+        if (consumed < 0)
+        {
+            break;
+        }
+        if (consumed < chunkLength)
+        {
+            // unexpected data after the response
+            ctx->asyncParser.isClose = 1;
+        }
+    }
+
+    if (!exoHttp_isComplete(&ctx->asyncParser))
+    {
+        exoPal_tcpSocketRelease(&ctx->socket, 0);
+        exosite_asyncComplete(ctx, 0);
+        return 0;
+    }
+    exoPal_tcpSocketRelease(&ctx->socket, !ctx->asyncParser.isClose);
+    exosite_asyncComplete(ctx, ctx->asyncParser.statusCode);
+    return 0;
+}
+
+
+/*!
+ *  \brief  Checks if an async request is in flight
+ *
+ * \return 1 if an async request is in flight, else 0
+ *
+ */
+uint8_t exosite_isBusy(const exosite_ctx_t * ctx)
+{
+    return ctx->asyncState != EXO_ASYNC_IDLE;
+}
+
+
+
+/*!
+ *  \brief  Reads data from Exosite
+ *
+ * Allows the reading of for reading data from the Exosite platform.  The alias
+ * variable can include one, or multiple alias names.  For example, if you
+ * included they must be separated by a '&'.
+ *
+ * For example, if you want to read from a single alias, you would set the alias
+ * parameter to `"myAliasName"`.  If you wanted to read from multiple alias', you
+ * would set the alias parameter to `"myAliasName&myOtherAliasName"`.
+ *
+ * If the read is successful, the value returned in readResponse will be the
+ * body of the HTTP response, and will be in this format
+ * `"myAliasName=someValue&myOtherAliasName=23"`.
+ *
+   \code{.c}
+   exosite_result_t result = exosite_read(&ctx, "myAlias", readBuffer, sizeof(readBuffer));
+   if (result.status == 200)
+   {
+       // result.body is readBuffer, something like "myAlias=3", and
+       // result.bodyLength is 9.
+   }
+   \endcode
+ *
+ * \param[in] alias Name/s of data source/s alias to read from
+ * \param[out] readResponse buffer to place read response in
+ * \param[in] buflen length of buffer
+ *
+ * \return Result of the request.  \a status is 200 if the aliases were read,
+ *         with \a body pointing at readResponse and \a bodyLength the bytes
+ *         stored in it, truncated to fit and null terminated.  \a error says
+ *         why there was no response.
+ *
+ */
+exosite_result_t exosite_read(exosite_ctx_t * ctx, const char * alias, char * readResponse, uint16_t buflen)
+{
+    exosite_result_t result;
+    exosite_bodyBuffer_t body = {readResponse, buflen, 0};
+    exoHttp_parser_t parser;
+    EXO_ERROR error;
+    int32_t results = 0;
+
+    // check the CIK and connect to exosite
+    error = exosite_open(ctx);
+    if (error != EXO_ERROR_NONE)
+    {
+        return exosite_failed(error);
+    }
+
+    // send request
+    results |= exoPal_socketWrite(&ctx->socket, STR_READ_URL, sizeof(STR_READ_URL)-1);
+    results |= exoPal_socketWrite(&ctx->socket, alias, exoPal_strlen(alias));
+
+    // send rest of request line, Host, CIK and Accept headers
+    results |= exoPal_socketWrite(&ctx->socket, ctx->headerTemplate[EXO_REQUEST_READ],
+                                  ctx->headerTemplateLength[EXO_REQUEST_READ]);
+
+    results |= exoPal_sendingComplete(&ctx->socket);
+
+    if (results != 0)
+    {
+        exosite_disconnect(ctx);
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+
+    // get response, the body is streamed straight into readResponse
+    exoHttp_init(&parser, exosite_bufferBody, 0, &body);
+    exosite_receive(ctx, &parser, &result);
+    result.body = readResponse;
+    result.bodyLength = body.length;
+
+    return result;
+}
+
+
+
+/*!
+ *  \brief  Reads and decodes several aliases in one request
+ *
+ * Reads all of \a aliases with a single GET, then decodes the urlencoded
+ * response in place in readResponse.  values[i] is filled in with the value of
+ * aliases[i], pointing into readResponse, so readResponse must stay untouched
+ * while the values are used.
+ *
+   \code{.c}
+   const char * aliases[] = {"temp", "count"};
+   exosite_value_t values[2] = {{0, 0, 2}, {0, 0, 0}};
+   exosite_readMany(&ctx, aliases, 2, values, readBuffer, sizeof(readBuffer));
+   // With a response of "temp=23.5&count=7", values[0].number is 2350 and
+   // values[1].number is 7.
+   \endcode
+ *
+ * \param[in] aliases Names of the aliases to read
+ * \param[in] count Number of aliases
+ * \param[in,out] values Table of count entries, decimals set by the caller
+ * \param[out] readResponse Buffer the response is read and decoded in
+ * \param[in] buflen Length of readResponse
+ *
+ * \return Result of the request.  values is only filled in if \a status is
+ *         200; \a body and \a bodyLength are the raw response.
+ *
+ */
+exosite_result_t exosite_readMany(exosite_ctx_t * ctx, const char * aliases[], uint8_t count, exosite_value_t * values, char * readResponse, uint16_t buflen)
+{
+    exosite_result_t result;
+    exosite_bodyBuffer_t body = {readResponse, buflen, 0};
+    exoHttp_parser_t parser;
+    EXO_ERROR error;
+    int32_t results = 0;
+    uint8_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        values[i].value = 0;
+        values[i].length = 0;
+        values[i].isNumber = 0;
+        values[i].number = 0;
+    }
+
+    // check the CIK and connect to exosite
+    error = exosite_open(ctx);
+    if (error != EXO_ERROR_NONE)
+    {
+        return exosite_failed(error);
+    }
+
+    // send request, aliases separated by '&'
+    results |= exoPal_socketWrite(&ctx->socket, STR_READ_URL, sizeof(STR_READ_URL)-1);
+    for (i = 0; i < count; i++)
+    {
+        if (i > 0)
+        {
+            results |= exoPal_socketWrite(&ctx->socket, "&", 1);
+        }
+        results |= exoPal_socketWrite(&ctx->socket, aliases[i], exoPal_strlen(aliases[i]));
+    }
+
+    // send rest of request line, Host, CIK and Accept headers
+    results |= exoPal_socketWrite(&ctx->socket, ctx->headerTemplate[EXO_REQUEST_READ],
+                                  ctx->headerTemplateLength[EXO_REQUEST_READ]);
+
+    results |= exoPal_sendingComplete(&ctx->socket);
+
+    if (results != 0)
+    {
+        exosite_disconnect(ctx);
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+
+    // get response, the body is streamed straight into readResponse
+    exoHttp_init(&parser, exosite_bufferBody, 0, &body);
+    exosite_receive(ctx, &parser, &result);
+    result.body = readResponse;
+    result.bodyLength = body.length;
+
+    if (result.status == 200)
+    {
+        exosite_decodeValues(readResponse, body.length, aliases, count, values);
+    }
+
+    return result;
+}
+
+
+
+/*!
+ *  \brief  Waits for the value of an alias to change
+ *
+ * Sends a read of poll->alias that the server holds open for up to
+ * poll->timeoutMs, until the alias is written with a value newer than the last
+ * one this poll read.  Call it again with the same \a poll to wait for the next
+ * change.  The first call on a poll returns the current value at once.
+ *
+   \code{.c}
+   exosite_longPoll_t poll = {"myAlias", 30000, ""};
+   exosite_value_t value = {0};
+   while (1)
+   {
+       exosite_result_t result = exosite_readLongPoll(&ctx, &poll, readBuffer, sizeof(readBuffer));
+       if (result.status == 200)
+       {
+           // result.body holds "myAlias=<new value>", result.bodyLength long,
+           // and value.number the new value once decoded
+           exosite_decodeValues(readBuffer, result.bodyLength, &poll.alias, 1, &value);
+       }
+       else if (result.error != EXO_ERROR_NONE)
+       {
+           // no response, back off before polling again
+       }
+   }
+   \endcode
+ *
+ * \param[in,out] poll Alias, timeout and the time of the last value read
+ * \param[out] readResponse buffer to place read response in
+ * \param[in] buflen length of buffer
+ *
+ * \return Result of the request.  \a status is 200 with the new value in
+ *         \a body and \a bodyLength, or 304 if the alias didn't change before
+ *         the timeout.  \a error is EXO_ERROR_TIMEOUT if the server didn't
+ *         answer within the timeout and margin.
+ *
+ */
+exosite_result_t exosite_readLongPoll(exosite_ctx_t * ctx, exosite_longPoll_t * poll, char * readResponse, uint16_t buflen)
+{
+    exosite_result_t result;
+    exosite_longPollResponse_t response = {{readResponse, buflen, 0}, "", 0};
+    exoHttp_parser_t parser;
+    EXO_ERROR error;
+    int32_t results = 0;
+    char timeoutStr[11];
+    uint8_t len_of_timeoutStr;
+
+    // check the CIK and connect to exosite
+    error = exosite_open(ctx);
+    if (error != EXO_ERROR_NONE)
+    {
+        return exosite_failed(error);
+    }
+
+    len_of_timeoutStr = exoPal_itoa((int)poll->timeoutMs, timeoutStr, sizeof(timeoutStr));
+
+    // send request
+    results |= exoPal_socketWrite(&ctx->socket, STR_READ_URL, sizeof(STR_READ_URL)-1);
+    results |= exoPal_socketWrite(&ctx->socket, poll->alias, exoPal_strlen(poll->alias));
+
+    // send rest of request line, Host, CIK and Accept headers, leaving off
+    // the blank line that ends them
+    results |= exoPal_socketWrite(&ctx->socket, ctx->headerTemplate[EXO_REQUEST_READ],
+                                  ctx->headerTemplateLength[EXO_REQUEST_READ] - (sizeof(STR_CRLF)-1));
+
+    results |= exoPal_socketWrite(&ctx->socket, STR_REQUEST_TIMEOUT, sizeof(STR_REQUEST_TIMEOUT)-1);
+    results |= exoPal_socketWrite(&ctx->socket, timeoutStr, len_of_timeoutStr);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+    if (poll->modifiedSince[0] != '\0')
+    {
+        results |= exoPal_socketWrite(&ctx->socket, STR_IF_MODIFIED_SINCE, sizeof(STR_IF_MODIFIED_SINCE)-1);
+        results |= exoPal_socketWrite(&ctx->socket, poll->modifiedSince, exoPal_strlen(poll->modifiedSince));
+        results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+    }
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+
+    results |= exoPal_sendingComplete(&ctx->socket);
+
+    if (results != 0)
+    {
+        exosite_disconnect(ctx);
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+
+    // the server holds the response for up to timeoutMs
+    exoPal_setRecvTimeout(&ctx->socket, poll->timeoutMs + LONG_POLL_MARGIN_MS);
+    exoHttp_init(&parser, exosite_bufferBody, exosite_findModified, &response);
+    exosite_receive(ctx, &parser, &result);
+    exoPal_setRecvTimeout(&ctx->socket, EXOPAL_RECV_TIMEOUT_MS);
+
+    if (result.status == 200)
+    {
+        if (response.modified[0] != '\0')
+        {
+            exoPal_memcpy(poll->modifiedSince, response.modified, sizeof(response.modified));
+        }
+        result.body = readResponse;
+        result.bodyLength = response.body.length;
+    }
+
+    return result;
+}
+
+
+
+/*!
+ *  \brief  Reads data from Exosite
+ *
+ * Reads a single alias from the Exosite One Platform.  The alias
+ * variable can only include one alias name.
+ *
+ * For example, if you want to read from the `myAlias` alias, you would set the
+ * alias parameter to `"myAliasName"`.
+ *
+ * If the read is successful, the value returned in readResponse will be the
+ * value of your alias.  These will always be strings.  Even if your data source
+ * contains a numeric value, you must convert it to an integer before using it.
+ *
+   \code{.c}
+   exosite_result_t result = exosite_readSingle(&ctx, "myAlias", readBuffer, sizeof(readBuffer));
+   if (result.status == 200 && result.bodyLength > 0)
+   {
+       // readBuffer would look something like this: "3", and
+       // result.bodyLength is 1.
+   }
+   \endcode
+ *
+ * \param[in] alias Name/s of data source/s alias to read from
+ * \param[out] readResponse buffer to place read response in
+ * \param[in] buflen length of buffer
+ *
+ * \return Result of the request.  With a \a status of 200, \a body points at
+ *         readResponse and \a bodyLength is the length of the value, 0 if the
+ *         alias wasn't in the response.  \a error says why there was no
+ *         response.
+ *
+ */
+exosite_result_t exosite_readSingle(exosite_ctx_t * ctx, const char * alias, char * readResponse, uint16_t buflen)
+{
+    exosite_result_t result;
+    exosite_aliasValue_t value = {alias, 0, ALIAS_VALUE_KEY, readResponse, buflen, 0};
+    exoHttp_parser_t parser;
+    EXO_ERROR error;
+    int32_t results = 0;
+
+    // check the CIK and connect to exosite
+    error = exosite_open(ctx);
+    if (error != EXO_ERROR_NONE)
+    {
+        return exosite_failed(error);
+    }
+
+    // send request
+    results |= exoPal_socketWrite(&ctx->socket, STR_READ_URL, sizeof(STR_READ_URL)-1);
+    results |= exoPal_socketWrite(&ctx->socket, alias, exoPal_strlen(alias));
+
+    // send rest of request line, Host, CIK and Accept headers
+    results |= exoPal_socketWrite(&ctx->socket, ctx->headerTemplate[EXO_REQUEST_READ],
+                                  ctx->headerTemplateLength[EXO_REQUEST_READ]);
+
+    results |= exoPal_sendingComplete(&ctx->socket);
+    
+    if (results != 0)
+    {
+        exosite_disconnect(ctx);
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+    
+    // get response, only the value of alias is kept from the body
+    readResponse[0] = '\0';
+    exoHttp_init(&parser, exosite_findAliasValue, 0, &value);
+    exosite_receive(ctx, &parser, &result);
+    result.body = readResponse;
+    result.bodyLength = value.length;
+
+    return result;
+}
+
+/*!
+ * \brief  Retrieves the timestamp from m2.exosite.com/timestamp
+ *
+ * \param[out] timestamp Unix time from Exosite, set when \a status is 200
+ *
+ * \return Result of the request.  \a error is EXO_ERROR_MALFORMED if a 200
+ *         response had no time in its body.
+ */
+exosite_result_t exosite_getTimestamp(exosite_ctx_t * ctx, int32_t * timestamp)
+{
+    char timestampStr[12];
+    exosite_bodyBuffer_t body = {timestampStr, sizeof(timestampStr), 0};
+    exoHttp_parser_t parser;
+    exosite_result_t result;
+    uint8_t connectStatus;
+    int32_t results = 0;
+
+    // no CIK needed, only connect
+    connectStatus = exosite_connect(ctx);
+    if (connectStatus != 0)
+    {
+        return exosite_failed(connectStatus == 3 ? EXO_ERROR_BUSY : EXO_ERROR_CONNECT);
+    }
+
+    results |= exoPal_socketWrite(&ctx->socket, ctx->headerTemplate[EXO_REQUEST_TIMESTAMP],
+                                  ctx->headerTemplateLength[EXO_REQUEST_TIMESTAMP]);
+
+    results |= exoPal_sendingComplete(&ctx->socket);
+
+    if (results != 0)
+    {
+        exosite_disconnect(ctx);
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+
+    exoHttp_init(&parser, exosite_bufferBody, 0, &body);
+    exosite_receive(ctx, &parser, &result);
+    if (result.status == 200)
+    {
+        if (body.length == 0)
+        {
+            result.error = EXO_ERROR_MALFORMED;
+        }
+        else
+        {
+            *timestamp = exoPal_atoi(timestampStr);
+        }
+    }
+
+    return result;
+}
+
+
+/*!
+ * @brief  Makes a request to the Exosite RPC API
+ *
+ *
+ * @param requestBody Full json rpc request string
+ * @param requestLength Length of json request string
+ * @param responseBuffer Buffer the response body is placed in
+ * @param responseBufferLength Length of responseBuffer
+ * 
+ * @return Result of the request, status 200 with the JSON response in body
+ *         and bodyLength, else error or status says why
+ */
+exosite_result_t exosite_rawRpcRequest(exosite_ctx_t * ctx, const char * requestBody, uint16_t requestLength, char * responseBuffer, uint16_t responseBufferLength)
+{
+    char contentLengthStr[6];
+    exosite_result_t result;
+    exosite_bodyBuffer_t body = {responseBuffer, responseBufferLength, 0};
+    exoHttp_parser_t parser;
+    EXO_ERROR error;
+    uint8_t len_of_contentLengthStr;
+    int32_t results = 0;
+
+    // check the CIK and connect to exosite
+    error = exosite_open(ctx);
+    if (error != EXO_ERROR_NONE)
+    {
+        return exosite_failed(error);
+    }
+
+    // 5 digits is enough for a uint16_t length
+    len_of_contentLengthStr = exoPal_itoa((int)requestLength, contentLengthStr, sizeof(contentLengthStr));
+
+    // send request line, Host, Content-Type and Accept headers
+    results |= exoPal_socketWrite(&ctx->socket, ctx->headerTemplate[EXO_REQUEST_RPC],
+                                  ctx->headerTemplateLength[EXO_REQUEST_RPC]);
+
+    // send content length value
+    results |= exoPal_socketWrite(&ctx->socket, contentLengthStr, len_of_contentLengthStr);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+
+    // send body
+    results |= exoPal_socketWrite(&ctx->socket, requestBody, requestLength);
+
+    results |= exoPal_sendingComplete(&ctx->socket);
+
+    if (results != 0)
+    {
+        exosite_disconnect(ctx);
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+
+    
+    // get response
+    exoHttp_init(&parser, exosite_bufferBody, 0, &body);
+    exosite_receive(ctx, &parser, &result);
+    result.body = responseBuffer;
+    result.bodyLength = body.length;
+
+    return result;
+
+}
+
+
+/*!
+ * \brief  Makes a request to the Exosite RPC API, streaming the JSON body
+ *
+ * The {"auth":{"cik":...},"calls":[...]} body is written straight to the
+ * socket, \a writeCalls adding the calls, so it needs no buffer and has no
+ * size limit.  It is written twice: once to a counting writer for the
+ * Content-Length, then to the socket.
+ *
+ * The response isn't buffered either, \a onBody gets its JSON in pieces as
+ * it arrives, e.g. to feed an exoJson_reader_t.
+ *
+ * \param[in] writeCalls Writes the calls, the same ones on both passes
+ * \param[in] context Passed to writeCalls
+ * \param[in] onBody Called with each piece of the response body
+ * \param[in] bodyContext Passed to onBody
+ *
+ * \return Result of the request, without a body
+ */
+exosite_result_t exosite_rpcRequest(exosite_ctx_t * ctx, exosite_rpcCallsWriter writeCalls, void * context, exoHttp_bodyCallback onBody, void * bodyContext)
+{
+    char contentLengthStr[11];
+    exosite_result_t result;
+    exoHttp_parser_t parser;
+    exoJson_writer_t writer;
+    EXO_ERROR error;
+    uint32_t bodyLength;
+    uint8_t len_of_contentLengthStr;
+    int32_t results = 0;
+
+    // sizing pass
+    exoJson_initCount(&writer);
+    exosite_writeRpcBody(ctx, &writer, writeCalls, context);
+    if (exoJson_failed(&writer))
+    {
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+    bodyLength = writer.length;
+
+    // check the CIK and connect to exosite
+    error = exosite_open(ctx);
+    if (error != EXO_ERROR_NONE)
+    {
+        return exosite_failed(error);
+    }
+
+    len_of_contentLengthStr = exoPal_itoa((int)bodyLength, contentLengthStr, sizeof(contentLengthStr));
+    results |= exoPal_socketWrite(&ctx->socket, ctx->headerTemplate[EXO_REQUEST_RPC],
+                                  ctx->headerTemplateLength[EXO_REQUEST_RPC]);
+    results |= exoPal_socketWrite(&ctx->socket, contentLengthStr, len_of_contentLengthStr);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+    results |= exoPal_socketWrite(&ctx->socket, STR_CRLF, sizeof(STR_CRLF)-1);
+
+    // emit pass, a body that came out a different length would be cut
+    // short or run into the next request
+    exoJson_initSocket(&writer, &ctx->socket);
+    exosite_writeRpcBody(ctx, &writer, writeCalls, context);
+    if (exoJson_failed(&writer) || writer.length != bodyLength)
+    {
+        results = 1;
+    }
+
+    results |= exoPal_sendingComplete(&ctx->socket);
+
+    if (results != 0)
+    {
+        exosite_disconnect(ctx);
+        return exosite_failed(EXO_ERROR_SEND);
+    }
+
+    exoHttp_init(&parser, onBody, 0, bodyContext);
+    exosite_receive(ctx, &parser, &result);
+
+    return result;
+}
+
+
+/*!
+ * \brief  Writes an RPC body, authenticated with the CIK of \a ctx
+ */
+static void exosite_writeRpcBody(exosite_ctx_t * ctx, exoJson_writer_t * writer,
+                                 exosite_rpcCallsWriter writeCalls, void * context)
+{
+    exoJson_beginObject(writer);
+    exoJson_key(writer, "auth");
+    exoJson_beginObject(writer);
+    exoJson_key(writer, "cik");
+    exoJson_string(writer, ctx->cik, CIK_LENGTH);
+    exoJson_endObject(writer);
+    exoJson_key(writer, "calls");
+    exoJson_beginArray(writer);
+    writeCalls(writer, context);
+    exoJson_endArray(writer);
+    exoJson_endObject(writer);
+}
+
+
+
+/*!
+ * \brief Appends \a len bytes of \a src to a header template
+ *
+ * \param[in] request Template to append to
+ * \param[in] src String to append
+ * \param[in] len Length of src
+ */
+static void exosite_appendHeader(exosite_ctx_t * ctx, EXO_REQUEST request, const char * src, uint16_t len)
+{
+    uint16_t pos = ctx->headerTemplateLength[request];
+
+    if (pos + len > HEADER_TEMPLATE_SIZE)
+    {
+        len = HEADER_TEMPLATE_SIZE - pos;
+    }
+    exoPal_memcpy(&ctx->headerTemplate[request][pos], src, len);
+    ctx->headerTemplateLength[request] = pos + len;
+}
+
+/*!
+ * \brief Renders the constant headers of every request kind
+ *
+ * Must be called whenever ctx->cik changes.  Each template only carries the
+ * headers its request needs, e.g. the GET in exosite_read has no
+ * Content-Type.
+ */
+void exosite_buildHeaders(exosite_ctx_t * ctx)
+{
+    EXO_REQUEST request;
+
+    for (request = EXO_REQUEST_WRITE; request < EXO_REQUEST_END; request++)
+    {
+        ctx->headerTemplateLength[request] = 0;
+    }
+
+    // write: request line, Host, CIK, Content-Type, then Content-Length value
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_WRITE_URL, sizeof(STR_WRITE_URL)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_HTTP, sizeof(STR_HTTP)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_HOST, sizeof(STR_HOST)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_CIK_HEADER, sizeof(STR_CIK_HEADER)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, ctx->cik, sizeof(ctx->cik));
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_CONTENT, sizeof(STR_CONTENT)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_WRITE, STR_CONTENT_LENGTH, sizeof(STR_CONTENT_LENGTH)-1);
+
+    // read: alias query comes first, then the rest of the request line,
+    // Host, CIK and Accept.  There is no body so no Content-Type.
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, STR_READ_HTTP, sizeof(STR_READ_HTTP)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, STR_HOST, sizeof(STR_HOST)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, STR_CIK_HEADER, sizeof(STR_CIK_HEADER)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, ctx->cik, sizeof(ctx->cik));
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, STR_ACCEPT, sizeof(STR_ACCEPT)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_READ, STR_CRLF, sizeof(STR_CRLF)-1);
+
+    // rpc: the CIK travels in the JSON body
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_RPC_URL, sizeof(STR_RPC_URL)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_HTTP, sizeof(STR_HTTP)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_HOST, sizeof(STR_HOST)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_CONTENT_JSON, sizeof(STR_CONTENT_JSON)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_ACCEPT_JSON, sizeof(STR_ACCEPT_JSON)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_RPC, STR_CONTENT_LENGTH, sizeof(STR_CONTENT_LENGTH)-1);
+
+    // timestamp: request line and Host only
+    exosite_appendHeader(ctx, EXO_REQUEST_TIMESTAMP, STR_TIMESTAMP_URL, sizeof(STR_TIMESTAMP_URL)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_TIMESTAMP, STR_HTTP, sizeof(STR_HTTP)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_TIMESTAMP, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_TIMESTAMP, STR_HOST, sizeof(STR_HOST)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_TIMESTAMP, STR_CRLF, sizeof(STR_CRLF)-1);
+    exosite_appendHeader(ctx, EXO_REQUEST_TIMESTAMP, STR_CRLF, sizeof(STR_CRLF)-1);
+}
+
+
+/*!
+ * \brief Checks the CIK and connects for a blocking request
+ *
+ * \return EXO_ERROR_NONE if connected, else why the request can't be made
+ */
+EXO_ERROR exosite_open(exosite_ctx_t * ctx)
+{
+    uint8_t connectStatus;
+
+    if(!exosite_isCIKValid(ctx->cik))
+    {
+        // tried to make a request without a valid CIK
+        return EXO_ERROR_NO_CIK;
+    }
+
+    connectStatus = exosite_connect(ctx);
+    if (connectStatus == 3)
+    {
+        return EXO_ERROR_BUSY;
+    }
+    return connectStatus == 0 ? EXO_ERROR_NONE : EXO_ERROR_CONNECT;
+}
+
+
+/*!
+ * \brief Result of a request that failed before a response was read
+ *
+ * \param[in] error Why it failed
+ */
+exosite_result_t exosite_failed(EXO_ERROR error)
+{
+    exosite_result_t result = {error, 0, -1, 0, 0};
+
+    return result;
+}
+
+
+/*!
+ * \brief Connects to Exosite
+ *
+ * This would typically be a call to open a socket
+ *
+ * \return Returns a 0 if socket was successfully opened, else returns the
+ *          error code
+ * \sa
+ * \note
+ * \warning
+ */
+uint8_t exosite_connect(exosite_ctx_t * ctx)
+{
+    if (ctx->asyncState != EXO_ASYNC_IDLE)
+    {
+        // the socket is in use by an async request
+        return 3;
+    }
+
+    // open socket to exosite
+
+    return exoPal_tcpSocketOpen(&ctx->socket);
+}
+
+/*!
+ * \brief Connects to Exosite
+ *
+ * This would typically be a call to close a socket
+ *
+ * \return Returns a 0 if socket was successfully close, else returns the
+ *          error code
+ * \sa
+ * \note
+ * \warning
+ */
+uint8_t exosite_disconnect(exosite_ctx_t * ctx)
+{
+    // Close socket to exosite
+    return exoPal_tcpSocketClose(&ctx->socket);
+}
+
+
+/*!
+ * \brief Reads the response to the request just sent
+ *
+ * Feeds the response through \a parser as it arrives from the socket, one
+ * ctx->rxBuffer at a time, until it is complete.  The connection is then
+ * kept open for the next request unless the server asked to close it or the
+ * response couldn't be fully read.
+ *
+ * \param[in] parser Parser initialized with the body callback for the request
+ * \param[out] result Error, status and Content-Length of the response; the
+ *             body is left for the caller to fill in
+ */
+void exosite_receive(exosite_ctx_t * ctx, exoHttp_parser_t * parser, exosite_result_t * result)
+{
+    uint16_t chunkLength;
+    int32_t consumed;
+    uint8_t readStatus;
+    uint8_t received = 0;
+
+    result->error = EXO_ERROR_NONE;
+    result->body = 0;
+    result->bodyLength = 0;
+
+    while (!exoHttp_isComplete(parser))
+    {
+        readStatus = exoPal_socketRead(&ctx->socket, ctx->rxBuffer, RX_BUFFER_SIZE, &chunkLength);
+        if (readStatus != 0)
+        {
+            // a body without a length ends when the server closes
+            exoHttp_finish(parser);
+            if (exoHttp_isComplete(parser))
+            {
+                break;
+            }
+            if (readStatus == EXOPAL_READ_TIMEOUT)
+            {
+                result->error = EXO_ERROR_TIMEOUT;
+            }
+            else
+            {
+                result->error = received ? EXO_ERROR_MALFORMED : EXO_ERROR_NO_RESPONSE;
+            }
+            break;
+        }
+        received = 1;
+        consumed = exoHttp_parse(parser, ctx->rxBuffer, chunkLength);
+        if (consumed < 0)
+        {
+            result->error = EXO_ERROR_MALFORMED;
+            break;
+        }
+        if (consumed < chunkLength)
+        {
+            // unexpected data after the response
+            parser->isClose = 1;
+        }
+    }
+
+    if (result->error != EXO_ERROR_NONE)
+    {
+        exoPal_tcpSocketRelease(&ctx->socket, 0);
+        result->status = 0;
+        result->contentLength = -1;
+        return;
+    }
+    exoPal_tcpSocketRelease(&ctx->socket, !parser->isClose);
+    result->status = parser->statusCode;
+    result->contentLength = parser->contentLength;
+    exosite_trackStatus(ctx, result->status);
+}
+
+
+/*!
+ * \brief Updates the device status reported by Exosite_StatusCode, a 401
+ *        also has exosite_provision activate the device again
+ *
+ * \param[in] httpStatus HTTP status of a response
+ */
+void exosite_trackStatus(exosite_ctx_t * ctx, int16_t httpStatus)
+{
+    if (httpStatus == 401)
+    {
+        ctx->status = EXO_STATE_R_W_ERROR;
+
+        // vendor is only known once exosite_init ran, without it the device
+        // can't be activated
+        if (!ctx->isProvisionDue && ctx->vendor[0] != '\0')
+        {
+            exosite_startProvision(ctx);
+        }
+    }
+    else if ((httpStatus >= 200 && httpStatus < 300) || httpStatus == 304)
+    {
+        ctx->status = EXO_STATUS_OK;
+    }
+}
+
+
+/*!
+ * \brief Response body callback that copies the body into a buffer
+ *
+ * The body is truncated to fit and is always null terminated.
+ *
+ * \param[in] context exosite_bodyBuffer_t to copy into
+ */
+void exosite_bufferBody(void * context, const char * data, uint16_t length)
+{
+    exosite_bodyBuffer_t * body = (exosite_bodyBuffer_t *)context;
+
+    if (body->size == 0)
+    {
+        return;
+    }
+    if (length > body->size - 1 - body->length)
+    {
+        length = body->size - 1 - body->length;
+    }
+    exoPal_memcpy(&body->buffer[body->length], data, length);
+    body->length += length;
+    body->buffer[body->length] = '\0';
+}
+
+
+/*!
+ * \brief Response body callback that extracts the value of one alias
+ *
+ * Matches "alias=value" pairs of an urlencoded body as it streams in and
+ * copies only the value of the wanted alias, null terminated.
+ *
+ * \param[in] context exosite_aliasValue_t with the alias to look for
+ */
+void exosite_findAliasValue(void * context, const char * data, uint16_t length)
+{
+    exosite_aliasValue_t * value = (exosite_aliasValue_t *)context;
+    uint16_t i;
+    char c;
+
+    for (i = 0; (i < length) && (value->state != ALIAS_VALUE_DONE); i++)
+    {
+        c = data[i];
+        switch (value->state)
+        {
+        case ALIAS_VALUE_KEY:
+            if ((c == '=') && (value->alias[value->matched] == '\0'))
+            {
+                value->state = ALIAS_VALUE_COPY;
+            }
+            else if (c == '&')
+            {
+                value->matched = 0;
+            }
+            else if (c == value->alias[value->matched])
+            {
+                value->matched++;
+            }
+            else
+            {
+                value->state = ALIAS_VALUE_SKIP;
+            }
+            break;
+
+        case ALIAS_VALUE_SKIP:
+            if (c == '&')
+            {
+                value->matched = 0;
+                value->state = ALIAS_VALUE_KEY;
+            }
+            break;
+
+        case ALIAS_VALUE_COPY:
+            if (c == '&')
+            {
+                value->state = ALIAS_VALUE_DONE;
+            }
+            else if (value->length + 1 < value->size)
+            {
+                value->value[value->length++] = c;
+                value->value[value->length] = '\0';
+            }
+            break;
+        }
+    }
+}
+
+
+/*!
+ * \brief  Appends to the request being queued for exosite_poll
+ *
+ * \return 0 if it fits in ASYNC_REQUEST_SIZE, else 1 and nothing is added
+ */
+uint8_t exosite_asyncAppend(exosite_ctx_t * ctx, const char * data, uint16_t length)
+{
+    if (length > ASYNC_REQUEST_SIZE - ctx->asyncRequestLength)
+    {
+        return 1;
+    }
+    exoPal_memcpy(&ctx->asyncRequest[ctx->asyncRequestLength], data, length);
+    ctx->asyncRequestLength += length;
+    return 0;
+}
+
+
+/*!
+ * \brief  Hands the request in asyncRequest to exosite_poll
+ *
+ * \param[in] body Buffer for the response body, 0 if none is wanted
+ * \param[in] bodySize Size of body, including the null terminator
+ */
+void exosite_asyncStart(exosite_ctx_t * ctx, char * body, uint16_t bodySize,
+                        exosite_asyncCallback callback, void * context)
+{
+    ctx->asyncBody.buffer = body;
+    ctx->asyncBody.size = body ? bodySize : 0;
+    ctx->asyncBody.length = 0;
+    ctx->isAsyncActivation = 0;
+    ctx->asyncSent = 0;
+    ctx->asyncCallback = callback;
+    ctx->asyncContext = context;
+    ctx->asyncStartMs = exoPal_getTimeMs();
+    ctx->asyncState = EXO_ASYNC_CONNECTING;
+}
+
+
+/*!
+ * \brief  Ends the async request and reports it to its callback
+ *
+ * The CIK of a successful exosite_activateAsync is stored first, so the
+ * callback can go on to write with it.
+ *
+ * \param[in] httpStatus HTTP status of the response, 0 if there wasn't one
+ */
+void exosite_asyncComplete(exosite_ctx_t * ctx, int16_t httpStatus)
+{
+    exosite_asyncCallback callback = ctx->asyncCallback;
+
+    if (ctx->isAsyncActivation)
+    {
+        ctx->isAsyncActivation = 0;
+        if (httpStatus == 200 && ctx->asyncBody.length == CIK_LENGTH &&
+            exosite_isCIKValid(ctx->asyncBody.buffer))
+        {
+            exosite_setCIK(ctx, ctx->asyncBody.buffer);
+        }
+    }
+    exosite_trackStatus(ctx, httpStatus);
+
+    // idle before the callback, so it can queue the next request
+    ctx->asyncState = EXO_ASYNC_IDLE;
+    if (callback)
+    {
+        callback(ctx->asyncContext, httpStatus, exoPal_getTimeMs() - ctx->asyncStartMs);
+    }
+}
+
+
+/*!
+ * \brief  Checks if a header line starts with \a name, ignoring case
+ *
+ * \param[in] name Lower case header name including the ':'
+ *
+ * \return Pointer to the value after any spaces, 0 if the name doesn't match
+ */
+static const char * exosite_matchHeader(const char * line, uint16_t length, const char * name)
+{
+    uint16_t i;
+
+    for (i = 0; name[i] != '\0'; i++)
+    {
+        if (i >= length || (line[i] | 0x20) != name[i])
+        {
+            return 0;
+        }
+    }
+    while (i < length && line[i] == ' ')
+    {
+        i++;
+    }
+    return &line[i];
+}
+
+
+/*!
+ * \brief  Header callback that keeps the time the value was last modified
+ *
+ * Prefers Last-Modified, and falls back on the response Date so a server
+ * that doesn't send Last-Modified still won't return the same value again.
+ *
+ * \param[in] context exosite_longPollResponse_t to fill
+ * \param[in] line Header line, without the CRLF
+ * \param[in] length Length of line
+ */
+void exosite_findModified(void * context, const char * line, uint16_t length)
+{
+    exosite_longPollResponse_t * response = (exosite_longPollResponse_t *)context;
+    const char * value;
+    uint16_t valueLength;
+
+    if ((value = exosite_matchHeader(line, length, STR_LAST_MODIFIED)) != 0)
+    {
+        response->hasLastModified = 1;
+    }
+    else if (response->hasLastModified ||
+             (value = exosite_matchHeader(line, length, STR_DATE)) == 0)
+    {
+        return;
+    }
+
+    valueLength = length - (value - line);
+    if (valueLength > MAX_MODIFIED_SINCE_LENGTH)
+    {
+        // not a date we can send back
+        return;
+    }
+    exoPal_memcpy(response->modified, value, valueLength);
+    response->modified[valueLength] = '\0';
+}
+
+
+/*!
+ * \brief  Converts a hex digit to its value
+ */
+static uint8_t exosite_hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    return (c | 0x20) - 'a' + 10;
+}
+
+
+/*!
+ * \brief  Appends one decimal digit to a value being parsed
+ *
+ * Values that would pass INT32_MAX are marked as not a number instead of
+ * wrapping.
+ */
+static void exosite_shiftDigit(exosite_value_t * value, uint8_t digit)
+{
+    if (value->number > (INT32_MAX - digit) / 10)
+    {
+        value->isNumber = 0;
+        return;
+    }
+    value->number = value->number * 10 + digit;
+}
+
+
+/*!
+ * \brief  Decodes an urlencoded "a=1&b=2" body into a value table
+ *
+ * Walks data once, percent-decoding each pair in place.  When a key matches one
+ * of \a aliases the matching entry of \a values is pointed at its value, and
+ * the value is parsed as a decimal number while it is decoded.  Used by
+ * exosite_readMany, and for the body of an exosite_readLongPoll.  Entries
+ * whose alias isn't in the body are left as they are.
+ *
+ * \param[in,out] data Body to decode, overwritten with the decoded pairs
+ * \param[in] length Length of data
+ * \param[in] aliases Names to look for
+ * \param[in] count Number of aliases
+ * \param[in,out] values Table of count entries to fill
+ */
+void exosite_decodeValues(char * data, uint16_t length, const char * aliases[],
+                          uint8_t count, exosite_value_t * values)
+{
+    exosite_value_t * entry = 0;
+    uint16_t in;
+    uint16_t out = 0;
+    uint16_t keyStart = 0;
+    uint16_t valueStart = 0;
+    uint8_t inValue = 0;
+    uint8_t isNegative = 0;
+    uint8_t inFraction = 0;
+    uint8_t fraction = 0;
+    uint8_t hasDigits = 0;
+    uint8_t i;
+    uint16_t j;
+    char c;
+
+    for (in = 0; in <= length; in++)
+    {
+        c = (in < length) ? data[in] : '&';
+
+        if (c == '&')
+        {
+            if (entry)
+            {
+                entry->value = &data[valueStart];
+                entry->length = out - valueStart;
+                if (entry->isNumber && hasDigits)
+                {
+                    // pad missing fractional digits
+                    while (entry->isNumber && fraction < entry->decimals)
+                    {
+                        exosite_shiftDigit(entry, 0);
+                        fraction++;
+                    }
+                    if (isNegative)
+                    {
+                        entry->number = -entry->number;
+                    }
+                }
+                if (!entry->isNumber || !hasDigits)
+                {
+                    entry->isNumber = 0;
+                    entry->number = 0;
+                }
+            }
+            entry = 0;
+            inValue = 0;
+            keyStart = out;
+            continue;
+        }
+
+        if (c == '=' && !inValue)
+        {
+            // key complete, look it up
+            for (i = 0; i < count && !entry; i++)
+            {
+                for (j = 0; keyStart + j < out && aliases[i][j] == data[keyStart + j]; j++);
+                if (keyStart + j == out && aliases[i][j] == '\0')
+                {
+                    entry = &values[i];
+                }
+            }
+            if (entry)
+            {
+                entry->isNumber = 1;
+                entry->number = 0;
+            }
+            inValue = 1;
+            isNegative = 0;
+            inFraction = 0;
+            fraction = 0;
+            hasDigits = 0;
+            valueStart = out;
+            continue;
+        }
+
+        if (c == '+')
+        {
+            c = ' ';
+        }
+        else if (c == '%' && in + 2 < length)
+        {
+            c = (exosite_hexValue(data[in + 1]) << 4) | exosite_hexValue(data[in + 2]);
+            in += 2;
+        }
+        data[out++] = c;
+
+        if (!entry || !entry->isNumber)
+        {
+            continue;
+        }
+        if (c >= '0' && c <= '9')
+        {
+            hasDigits = 1;
+            if (!inFraction)
+            {
+                exosite_shiftDigit(entry, c - '0');
+            }
+            else if (fraction < entry->decimals)
+            {
+                exosite_shiftDigit(entry, c - '0');
+                fraction++;
+            }
+            // further fractional digits are truncated
+        }
+        else if (c == '-' && out - 1 == valueStart)
+        {
+            isNegative = 1;
+        }
+        else if (c == '.' && !inFraction)
+        {
+            inFraction = 1;
+        }
+        else
+        {
+            entry->isNumber = 0;
+        }
+    }
+}
@@ -37,6 +37,9 @@
 #define EXOSITE_H
 
 #include <stdint.h>
+#include "exosite_pal.h"
+#include "exosite_http.h"
+#include "exosite_json.h"
 
 
 // DEFINES
@@ -45,6 +48,29 @@
 #define MAX_VENDOR_LENGTH                       20
 #define MAX_MODEL_LENGTH                        20
 
+/*!< Longest Last-Modified date kept between long-poll reads*/
+#define MAX_MODIFIED_SINCE_LENGTH               31
+
+/*!< Largest request an async call can queue, headers included*/
+#define ASYNC_REQUEST_SIZE                      600
+
+/*!< Time, in ms, an async request may take from connect to response*/
+#define ASYNC_TIMEOUT_MS                        5000
+
+/*!< Size of each pre-rendered request header, see exosite_buildHeaders */
+#define HEADER_TEMPLATE_SIZE                    200
+
+/*!< Extra time, in ms, a long-poll read waits for the response past its
+   Request-Timeout before giving up on the connection*/
+#define LONG_POLL_MARGIN_MS                     3000
+
+/*!< Wait, in ms, before retrying a failed activation, doubled with each
+   retry up to PROVISION_RETRY_MAX_MS, see exosite_provision*/
+#define PROVISION_RETRY_MIN_MS                  2000
+
+/*!< Longest wait, in ms, between activation retries*/
+#define PROVISION_RETRY_MAX_MS                  300000
+
 /*!< This defines the maximum size that a string can be for sending data
    to Exosite.  It is used to prevent exosite_strlen from overrunning.
    If you are have a need to increase string length, you can freely adjust
@@ -72,22 +98,179 @@ typedef enum EXOSITE_DEVICE_STATE_tag
 	EXO_STATUS_END                    /*!< No status */
 }EXO_STATE;
 
+/*!
+ * Why a request got no complete HTTP response, see exosite_result_t.
+ */
+typedef enum EXO_ERROR_tag
+{
+    EXO_ERROR_NONE,         /*!< A complete response was received */
+    EXO_ERROR_NO_CIK,       /*!< No valid CIK to make the request with */
+    EXO_ERROR_BUSY,         /*!< An async request has the connection */
+    EXO_ERROR_CONNECT,      /*!< Couldn't connect to Exosite */
+    EXO_ERROR_SEND,         /*!< The request couldn't be sent */
+    EXO_ERROR_NO_RESPONSE,  /*!< Connection closed before any response */
+    EXO_ERROR_TIMEOUT,      /*!< The response didn't arrive in time */
+    EXO_ERROR_MALFORMED     /*!< Malformed or truncated response */
+}EXO_ERROR;
+
+/*!
+ * Request kinds with a pre-rendered header.
+ */
+typedef enum EXOSITE_REQUEST_tag
+{
+    EXO_REQUEST_WRITE,      /*!< POST /onep:v1/stack/alias, up to "Content-Length: " */
+    EXO_REQUEST_READ,       /*!< GET /onep:v1/stack/alias, from after the alias query */
+    EXO_REQUEST_RPC,        /*!< POST /onep:v1/rpc/process, up to "Content-Length: " */
+    EXO_REQUEST_TIMESTAMP,  /*!< GET /timestamp, complete */
+    EXO_REQUEST_END
+}EXO_REQUEST;
+
+/*!
+ * Steps of an async request, see exosite_poll.
+ */
+typedef enum EXOSITE_ASYNC_STATE_tag
+{
+    EXO_ASYNC_IDLE,         /*!< no request in flight */
+    EXO_ASYNC_CONNECTING,   /*!< waiting for the socket */
+    EXO_ASYNC_SENDING,      /*!< sending asyncRequest */
+    EXO_ASYNC_RECEIVING     /*!< feeding the response to asyncParser */
+}EXOSITE_ASYNC_STATE;
+
+
+// TYPES
+/*!
+ * Outcome of a request, parsed once from the response.  \a status is only
+ * meaningful if \a error is EXO_ERROR_NONE.
+ */
+typedef struct exosite_result_tag
+{
+    EXO_ERROR error;        /*!< transport error */
+    int16_t status;         /*!< HTTP status, 0 if no response */
+    int32_t contentLength;  /*!< Content-Length, -1 if not given */
+    const char * body;      /*!< body in the caller's buffer, 0 if none */
+    uint16_t bodyLength;    /*!< bytes of body stored, may be truncated to the buffer */
+}exosite_result_t;
+
+/*!
+ * One alias of an exosite_readMany.  \a decimals is set by the caller, the
+ * rest is filled in from the response.
+ */
+typedef struct exosite_value_tag
+{
+    const char * value;     /*!< value in the caller's buffer, not null terminated, 0 if not returned */
+    uint16_t length;        /*!< length of value */
+    uint8_t decimals;       /*!< fractional digits kept in number, 0 for integers */
+    uint8_t isNumber;       /*!< 1 if value is a decimal number */
+    int32_t number;         /*!< value scaled by 10^decimals, valid if isNumber */
+}exosite_value_t;
+
+/*!
+ * State of a long-poll read of one alias, see exosite_readLongPoll.  Set
+ * alias and timeoutMs and zero modifiedSince before the first read.
+ */
+typedef struct exosite_longPoll_tag
+{
+    const char * alias;     /*!< alias to wait on */
+    uint32_t timeoutMs;     /*!< longest time the server holds the request */
+    char modifiedSince[MAX_MODIFIED_SINCE_LENGTH + 1]; /*!< Last-Modified of the last value read, "" for none */
+}exosite_longPoll_t;
+
+/*!
+ * Collects a response body into a caller buffer, see exosite_bufferBody.
+ */
+typedef struct exosite_bodyBuffer_tag
+{
+    char * buffer;
+    uint16_t size;      /*!< size of buffer, including the null terminator */
+    uint16_t length;    /*!< body bytes stored so far */
+}exosite_bodyBuffer_t;
+
+/*!
+ * Called by exosite_poll when an async request completes.  \a httpStatus is
+ * the HTTP status of the response, or 0 if no response was received, and
+ * \a latencyMs the time from the async call to completion.
+ */
+typedef void (*exosite_asyncCallback)(void * context, int16_t httpStatus, uint32_t latencyMs);
+
+/*!
+ * Writes the calls of an RPC request, the elements of its "calls" array,
+ * see exosite_rpcRequest.  Called twice per request and must write the same
+ * calls both times.
+ */
+typedef void (*exosite_rpcCallsWriter)(exoJson_writer_t * writer, void * context);
+
+/*!
+ * One device identity and its connection to Exosite.  Every API call takes
+ * one, so several can be used at once, e.g. one for a long-poll reader and
+ * one for a writer, or one per device a gateway relays for.  All memory is
+ * in the struct, about 3.7 KB with the default sizes, so it can be static or
+ * on a task stack.  Initialize with exosite_ctxInit, the members are private.
+ */
+typedef struct exosite_ctx_tag
+{
+    char cik[CIK_LENGTH];
+    char vendor[MAX_VENDOR_LENGTH + 1];
+    char model[MAX_MODEL_LENGTH + 1];
+    char uuid[MAX_UUID_LENGTH + 1];
+    uint8_t cikSlot;                /*!< NVM slot the CIK is kept in, see exoPal_setCik */
+    EXO_STATE initState;
+    EXO_STATE status;               /*!< see Exosite_StatusCode */
+
+    /*!< The constant part of each request's headers, rendered once for the
+       current CIK so only the variable parts are added per request.*/
+    char headerTemplate[EXO_REQUEST_END][HEADER_TEMPLATE_SIZE];
+    uint16_t headerTemplateLength[EXO_REQUEST_END];
+
+    exoPal_socket_t socket;
+    char rxBuffer[RX_BUFFER_SIZE];  /*!< response chunks are read into this */
+
+    // request queued by exosite_writeAsync, exosite_readAsync or
+    // exosite_activateAsync, see exosite_poll
+    EXOSITE_ASYNC_STATE asyncState;
+    char asyncRequest[ASYNC_REQUEST_SIZE];
+    uint16_t asyncRequestLength;
+    uint16_t asyncSent;
+    exoHttp_parser_t asyncParser;
+    exosite_bodyBuffer_t asyncBody; /*!< where the response body goes, size 0 to drop it */
+    uint8_t isAsyncActivation;      /*!< the body is a CIK to take on a 200 */
+    uint32_t asyncStartMs;
+    exosite_asyncCallback asyncCallback;
+    void * asyncContext;
+
+    // activation retried by exosite_provision
+    uint8_t isProvisionDue;
+    uint8_t provisionRetries;
+    uint32_t provisionFromMs;
+    uint32_t provisionDelayMs;      /*!< wait from provisionFromMs, backoff and jitter */
+    uint32_t jitterSeed;
+}exosite_ctx_t;
 
 
 // PUBLIC FUNCTIONS
-EXO_STATE exosite_activate();
-EXO_STATE exosite_init(const char *vendor, const char *model);
-int32_t exosite_write(const char * writeData, uint16_t length);
-int32_t exosite_read(const char * alias, char * readResponse, uint16_t buflen, uint16_t * responseSize);
-int32_t exosite_readSingle(const char * alias, char * readResponse, uint16_t buflen, uint16_t * length);
-int32_t exosite_rawRpcRequest(const char * requestBody, uint16_t requestLength, char * responseBuffer, int32_t responseBufferLength);
-int8_t exosite_getTimestamp(int32_t * timestamp);
-int32_t exosite_getBody(char *response, char **bodyStart, uint16_t *bodyLength);
-uint8_t exosite_isCIKValid(char cik[CIK_LENGTH]);
-void exosite_setCIK(char * pCIK);
-uint8_t exosite_resetCik();
-void exosite_getCIK(char * pCIK);
-int Exosite_StatusCode(void);
+void exosite_ctxInit(exosite_ctx_t * ctx, const char * uuid, uint8_t cikSlot);
+EXO_STATE exosite_activate(exosite_ctx_t * ctx);
+EXO_STATE exosite_init(exosite_ctx_t * ctx, const char *vendor, const char *model);
+EXO_STATE exosite_provision(exosite_ctx_t * ctx);
+exosite_result_t exosite_write(exosite_ctx_t * ctx, const char * writeData, uint16_t length);
+int32_t exosite_writeAsync(exosite_ctx_t * ctx, const char * writeData, uint16_t length, exosite_asyncCallback callback, void * context);
+int32_t exosite_readAsync(exosite_ctx_t * ctx, const char * alias, char * readResponse, uint16_t buflen, exosite_asyncCallback callback, void * context);
+int32_t exosite_activateAsync(exosite_ctx_t * ctx, const char * vendor, const char * model, exosite_asyncCallback callback, void * context);
+uint8_t exosite_poll(exosite_ctx_t * ctx);
+uint8_t exosite_isBusy(const exosite_ctx_t * ctx);
+exosite_result_t exosite_read(exosite_ctx_t * ctx, const char * alias, char * readResponse, uint16_t buflen);
+exosite_result_t exosite_readMany(exosite_ctx_t * ctx, const char * aliases[], uint8_t count, exosite_value_t * values, char * readResponse, uint16_t buflen);
+exosite_result_t exosite_readLongPoll(exosite_ctx_t * ctx, exosite_longPoll_t * poll, char * readResponse, uint16_t buflen);
+void exosite_decodeValues(char * data, uint16_t length, const char * aliases[], uint8_t count, exosite_value_t * values);
+exosite_result_t exosite_readSingle(exosite_ctx_t * ctx, const char * alias, char * readResponse, uint16_t buflen);
+exosite_result_t exosite_rawRpcRequest(exosite_ctx_t * ctx, const char * requestBody, uint16_t requestLength, char * responseBuffer, uint16_t responseBufferLength);
+exosite_result_t exosite_rpcRequest(exosite_ctx_t * ctx, exosite_rpcCallsWriter writeCalls, void * context, exoHttp_bodyCallback onBody, void * bodyContext);
+exosite_result_t exosite_getTimestamp(exosite_ctx_t * ctx, int32_t * timestamp);
+uint8_t exosite_isCIKValid(const char cik[CIK_LENGTH]);
+void exosite_setCIK(exosite_ctx_t * ctx, const char * pCIK);
+uint8_t exosite_resetCik(exosite_ctx_t * ctx);
+void exosite_getCIK(const exosite_ctx_t * ctx, char * pCIK);
+const char * exosite_currentCIK(const exosite_ctx_t * ctx);
+int Exosite_StatusCode(const exosite_ctx_t * ctx);
 
 #endif
 
@@ -0,0 +1,224 @@
+/*****************************************************************************
+*
+*  exosite_clock.c - Drift-corrected wall clock
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+#include "exosite_pal.h"
+#include "exosite.h"
+#include "exosite_clock.h"
+
+/*!< Longest span, in ms, the drift is measured over before the reference
+   sync is moved up, so PAL time differences don't wrap.*/
+#define EXOCLOCK_MAX_SPAN_MS    0x7FFFFFFFUL
+
+// Unix time, in ms, and PAL time of the last sync
+static uint8_t isSynced = 0;
+static int64_t syncUnixMs;
+static uint32_t syncLocalMs;
+
+// the sync the drift is measured from
+static int64_t anchorUnixMs;
+static uint32_t anchorLocalMs;
+
+// measured drift of the PAL time base and how far off that could be
+static int32_t driftPpm = 0;
+static uint32_t driftErrorPpm = EXOCLOCK_DRIFT_PPM_UNKNOWN;
+
+// PAL time of the last failed sync, see exoClock_service
+static uint8_t hasFailed = 0;
+static uint32_t failedMs;
+
+
+/*!
+ * \brief  Converts a PAL time span to real time using the measured drift
+ */
+static int64_t exoClock_correct(int32_t elapsedMs)
+{
+    return (int64_t)elapsedMs + ((int64_t)elapsedMs * driftPpm) / 1000000;
+}
+
+
+/*!
+ * \brief  Sets the clock from a server timestamp
+ *
+ * Each sync after the first also refines the drift estimate, measured over
+ * the whole span since the first sync so the server's 1 s resolution matters
+ * less the longer the clock runs.
+ *
+ * \param[in] unixTime Unix time from the server, in seconds
+ * \param[in] localMs PAL time the server's timestamp corresponds to
+ */
+void exoClock_sync(int32_t unixTime, uint32_t localMs)
+{
+    // the server truncates, so the real time is somewhere in that second
+    int64_t unixMs = (int64_t)unixTime * 1000 + 500;
+    uint32_t spanMs;
+    uint32_t errorPpm;
+
+    hasFailed = 0;
+    if (!isSynced)
+    {
+        anchorUnixMs = unixMs;
+        anchorLocalMs = localMs;
+    }
+    else
+    {
+        spanMs = localMs - anchorLocalMs;
+        if (spanMs > 0)
+        {
+            // error of the estimate: both ends are only known to a second
+            errorPpm = (uint32_t)(((int64_t)2 * EXOCLOCK_SYNC_ERROR_MS * 1000000) / spanMs);
+            if (errorPpm < driftErrorPpm)
+            {
+                driftPpm = (int32_t)(((unixMs - anchorUnixMs - spanMs) * 1000000) / spanMs);
+                driftErrorPpm = errorPpm;
+            }
+        }
+        if (spanMs >= EXOCLOCK_MAX_SPAN_MS / 2)
+        {
+            // measure from here on, keeping the estimate so far
+            anchorUnixMs = unixMs;
+            anchorLocalMs = localMs;
+        }
+    }
+
+    syncUnixMs = unixMs;
+    syncLocalMs = localMs;
+    isSynced = 1;
+}
+
+
+/*!
+ * \brief  Resyncs with the server if the clock may be off by more than
+ *         \a maxErrorMs
+ *
+ * Call it regularly while connected.  It only makes a request when the
+ * estimated error has grown past the bound, and backs off for
+ * EXOCLOCK_RETRY_MS after a failed sync.
+ *
+ * \param[in] ctx Context to make the request on
+ * \param[in] maxErrorMs Largest acceptable error, in ms
+ *
+ * \return 0 if the clock is within the bound, else -1
+ */
+int8_t exoClock_service(exosite_ctx_t * ctx, uint32_t maxErrorMs)
+{
+    exosite_result_t result;
+    int32_t unixTime;
+    uint32_t beforeMs;
+    uint32_t afterMs;
+
+    if (isSynced && exoClock_errorMs() <= maxErrorMs)
+    {
+        return 0;
+    }
+    if (hasFailed && exoPal_getTimeMs() - failedMs < EXOCLOCK_RETRY_MS)
+    {
+        return -1;
+    }
+
+    beforeMs = exoPal_getTimeMs();
+    result = exosite_getTimestamp(ctx, &unixTime);
+    if (result.error != EXO_ERROR_NONE || result.status != 200)
+    {
+        hasFailed = 1;
+        failedMs = exoPal_getTimeMs();
+        return -1;
+    }
+    afterMs = exoPal_getTimeMs();
+
+    // the server read its clock about half way through the request
+    exoClock_sync(unixTime, beforeMs + (afterMs - beforeMs) / 2);
+    return 0;
+}
+
+
+/*!
+ * \brief  Checks if the clock has been set
+ */
+uint8_t exoClock_isSynced()
+{
+    return isSynced;
+}
+
+
+/*!
+ * \brief  Returns the current Unix time, in seconds
+ */
+int32_t exoClock_now()
+{
+    return exoClock_toUnix(exoPal_getTimeMs());
+}
+
+
+/*!
+ * \brief  Converts a PAL time, e.g. when a sample was taken, to Unix time
+ *
+ * \param[in] localMs PAL time, before or after the last sync
+ *
+ * \return Unix time, in seconds, 0 if the clock hasn't been set
+ */
+int32_t exoClock_toUnix(uint32_t localMs)
+{
+    if (!isSynced)
+    {
+        return 0;
+    }
+    return (int32_t)((syncUnixMs + exoClock_correct((int32_t)(localMs - syncLocalMs))) / 1000);
+}
+
+
+/*!
+ * \brief  Returns how far off the clock could be by now, in ms
+ */
+uint32_t exoClock_errorMs()
+{
+    uint32_t elapsedMs;
+
+    if (!isSynced)
+    {
+        return UINT32_MAX;
+    }
+    elapsedMs = exoPal_getTimeMs() - syncLocalMs;
+    return EXOCLOCK_SYNC_ERROR_MS + (uint32_t)(((uint64_t)elapsedMs * driftErrorPpm) / 1000000);
+}
+
+
+/*!
+ * \brief  Returns the measured drift of the PAL time base, in ppm
+ *
+ * Positive if the PAL time base runs slow.
+ */
+int32_t exoClock_driftPpm()
+{
+    return driftPpm;
+}
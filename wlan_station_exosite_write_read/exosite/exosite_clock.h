@@ -0,0 +1,66 @@
+/*****************************************************************************
+*
+*  exosite_clock.h - Drift-corrected wall clock
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+#ifndef EXOSITE_CLOCK_H
+#define EXOSITE_CLOCK_H
+
+#include <stdint.h>
+#include "exosite.h"
+
+
+// DEFINES
+
+/*!< Error, in ms, of the clock right after a sync.  The server's timestamp
+   only has 1 s resolution.*/
+#define EXOCLOCK_SYNC_ERROR_MS                  1000
+
+/*!< Drift, in ppm, assumed for the PAL time base until it has been measured.*/
+#define EXOCLOCK_DRIFT_PPM_UNKNOWN              100
+
+/*!< Time, in ms, exoClock_service waits after a failed sync before trying
+   again.*/
+#define EXOCLOCK_RETRY_MS                       30000
+
+
+// PUBLIC FUNCTIONS
+void exoClock_sync(int32_t unixTime, uint32_t localMs);
+int8_t exoClock_service(exosite_ctx_t * ctx, uint32_t maxErrorMs);
+uint8_t exoClock_isSynced();
+int32_t exoClock_now();
+int32_t exoClock_toUnix(uint32_t localMs);
+uint32_t exoClock_errorMs();
+int32_t exoClock_driftPpm();
+
+#endif
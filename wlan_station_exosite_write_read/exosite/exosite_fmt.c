@@ -0,0 +1,150 @@
+/*****************************************************************************
+*
+*  exosite_fmt.c - Integer-only value formatting
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+#include <string.h>
+#include "exosite_fmt.h"
+
+/*!
+ * \brief  Writes a fixed-point number as decimal text
+ *
+ * \a value is the number scaled by 10^\a decimals, so 2345 with 2 decimals
+ * is written as "23.45" and -5 as "-0.05".  Only integer arithmetic is used,
+ * so it doesn't pull in printf or the float library, and it writes straight
+ * into a payload buffer.
+ *
+ * \param[in] value Number, scaled by 10^decimals
+ * \param[in] decimals Digits after the point, up to EXOFMT_MAX_DECIMALS
+ * \param[out] buf Buffer to write to; NUL terminated if there is room
+ * \param[in] bufSize Size of buf
+ *
+ * \return Length written, without the NUL, 0 if it doesn't fit
+ */
+uint16_t exoFmt_fixed(int32_t value, uint8_t decimals, char * buf, uint16_t bufSize)
+{
+    char digits[EXOFMT_MAX_LENGTH];
+    uint32_t magnitude;
+    uint8_t count = 0;
+    uint16_t length = 0;
+
+    if (decimals > EXOFMT_MAX_DECIMALS)
+    {
+        return 0;
+    }
+
+    // negate as unsigned so INT32_MIN works too
+    magnitude = value < 0 ? 0U - (uint32_t)value : (uint32_t)value;
+
+    // least significant first, padded so there is a digit before the point
+    do
+    {
+        if (count == decimals && decimals > 0)
+        {
+            digits[count++] = '.';
+        }
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    }
+    while (magnitude > 0 || count <= decimals);
+
+    if (value < 0)
+    {
+        digits[count++] = '-';
+    }
+
+    if (count > bufSize)
+    {
+        return 0;
+    }
+    while (count > 0)
+    {
+        buf[length++] = digits[--count];
+    }
+    if (length < bufSize)
+    {
+        buf[length] = '\0';
+    }
+    return length;
+}
+
+
+/*!
+ * \brief  Appends alias=value to a urlencoded form, e.g. a write payload
+ *
+ * Fields are separated by '&', so the form can be built in one pass with no
+ * rescans.  The buffer is NUL terminated if there is room.
+ *
+ * \param[in,out] buf Form being built
+ * \param[in] bufSize Size of buf
+ * \param[in,out] length Length of the form so far, advanced past the field
+ * \param[in] alias Alias, already urlencoded
+ * \param[in] value Number, scaled by 10^decimals
+ * \param[in] decimals Digits after the point
+ *
+ * \return 0 on success, -1 if the field doesn't fit; the form is left as it
+ *         was
+ */
+int8_t exoFmt_appendField(char * buf, uint16_t bufSize, uint16_t * length,
+        const char * alias, int32_t value, uint8_t decimals)
+{
+    uint16_t pos = *length;
+    uint16_t aliasLength = (uint16_t)strlen(alias);
+    uint16_t valueLength;
+
+    // separator, alias, '=' and at least one digit
+    if (pos > bufSize || bufSize - pos < (pos > 0) + aliasLength + 2)
+    {
+        return -1;
+    }
+
+    if (pos > 0)
+    {
+        buf[pos++] = '&';
+    }
+    memcpy(&buf[pos], alias, aliasLength);
+    pos += aliasLength;
+    buf[pos++] = '=';
+
+    valueLength = exoFmt_fixed(value, decimals, &buf[pos], bufSize - pos);
+    if (valueLength == 0)
+    {
+        if (*length < bufSize)
+        {
+            buf[*length] = '\0';
+        }
+        return -1;
+    }
+
+    *length = pos + valueLength;
+    return 0;
+}
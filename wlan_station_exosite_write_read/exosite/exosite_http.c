@@ -0,0 +1,389 @@
+/*****************************************************************************
+*
+*  exosite_http.c - Incremental HTTP response parser
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+#include "exosite_http.h"
+
+static const char STR_CONTENT_LENGTH[] = "content-length:";
+static const char STR_TRANSFER_ENCODING[] = "transfer-encoding:";
+static const char STR_CONNECTION[] = "connection:";
+static const char STR_CHUNKED[] = "chunked";
+static const char STR_CLOSE[] = "close";
+
+// local functions
+static void exoHttp_parseLine(exoHttp_parser_t * parser);
+static void exoHttp_parseHeader(exoHttp_parser_t * parser);
+static void exoHttp_endHeaders(exoHttp_parser_t * parser);
+
+
+/*!
+ * \brief  Prepares a parser for a new response
+ *
+ * \param[out] parser Parser to initialize
+ * \param[in] onBody Called with the body as it arrives, may be 0
+ * \param[in] onHeader Called with every header line, may be 0
+ * \param[in] context Passed to the callbacks
+ */
+void exoHttp_init(exoHttp_parser_t * parser, exoHttp_bodyCallback onBody,
+                  exoHttp_headerCallback onHeader, void * context)
+{
+    parser->state = EXOHTTP_STATE_STATUS_LINE;
+    parser->statusCode = 0;
+    parser->contentLength = -1;
+    parser->remaining = 0;
+    parser->isChunked = 0;
+    parser->isClose = 0;
+    parser->lineLength = 0;
+    parser->onBody = onBody;
+    parser->onHeader = onHeader;
+    parser->context = context;
+}
+
+
+/*!
+ * \brief  Feeds the next piece of the response to the parser
+ *
+ * Can be called with whatever sl_Recv returned, pieces may split lines or
+ * the body anywhere.  Body bytes are passed to the onBody callback without
+ * being buffered.
+ *
+ * \param[in] parser Parser state
+ * \param[in] data Received bytes
+ * \param[in] length Number of bytes in data
+ *
+ * \return Number of bytes consumed, less than length if the response ended
+ *         before the end of data, or -1 if the response is malformed
+ */
+int32_t exoHttp_parse(exoHttp_parser_t * parser, const char * data, uint16_t length)
+{
+    uint16_t i = 0;
+    uint16_t n;
+    char c;
+
+    while ((i < length) && (parser->state < EXOHTTP_STATE_DONE))
+    {
+        switch (parser->state)
+        {
+        case EXOHTTP_STATE_BODY:
+        case EXOHTTP_STATE_CHUNK_DATA:
+            n = length - i;
+            if (n > parser->remaining)
+            {
+                n = parser->remaining;
+            }
+            if (parser->onBody)
+            {
+                parser->onBody(parser->context, &data[i], n);
+            }
+            parser->remaining -= n;
+            i += n;
+            if (parser->remaining == 0)
+            {
+                parser->state = (parser->state == EXOHTTP_STATE_BODY) ?
+                                EXOHTTP_STATE_DONE : EXOHTTP_STATE_CHUNK_END;
+            }
+            break;
+
+        case EXOHTTP_STATE_BODY_UNTIL_CLOSE:
+            if (parser->onBody)
+            {
+                parser->onBody(parser->context, &data[i], length - i);
+            }
+            i = length;
+            break;
+
+        default:
+            // line oriented states
+            c = data[i++];
+            if (c == '\n')
+            {
+                parser->line[parser->lineLength] = '\0';
+                exoHttp_parseLine(parser);
+                parser->lineLength = 0;
+            }
+            else if ((c != '\r') && (parser->lineLength < EXOHTTP_LINE_SIZE - 1))
+            {
+                parser->line[parser->lineLength++] = c;
+            }
+            break;
+        }
+    }
+
+    if (parser->state == EXOHTTP_STATE_ERROR)
+    {
+        return -1;
+    }
+    return i;
+}
+
+
+/*!
+ * \brief  Tells the parser the connection was closed
+ *
+ * Completes a response whose body is delimited by the connection closing.
+ */
+void exoHttp_finish(exoHttp_parser_t * parser)
+{
+    if (parser->state == EXOHTTP_STATE_BODY_UNTIL_CLOSE)
+    {
+        parser->state = EXOHTTP_STATE_DONE;
+    }
+    parser->isClose = 1;
+}
+
+
+/*!
+ * \brief  Checks if the whole response has been parsed
+ *
+ * \return 1 if complete, else 0
+ */
+uint8_t exoHttp_isComplete(const exoHttp_parser_t * parser)
+{
+    return parser->state == EXOHTTP_STATE_DONE;
+}
+
+
+/*!
+ * \brief  Case insensitive check that \a line starts with \a prefix
+ *
+ * \param[in] prefix Lowercase prefix
+ *
+ * \return Pointer to the character after the prefix, 0 if no match
+ */
+static const char * exoHttp_matchPrefix(const char * line, const char * prefix)
+{
+    while (*prefix)
+    {
+        char c = *line++;
+        if (c >= 'A' && c <= 'Z')
+        {
+            c += 'a' - 'A';
+        }
+        if (c != *prefix++)
+        {
+            return 0;
+        }
+    }
+    return line;
+}
+
+
+/*!
+ * \brief  Case insensitive search for \a token in \a value
+ *
+ * \return 1 if found, else 0
+ */
+static uint8_t exoHttp_hasToken(const char * value, const char * token)
+{
+    for (; *value; value++)
+    {
+        if (exoHttp_matchPrefix(value, token))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*!
+ * \brief  Handles a complete line in one of the line oriented states
+ */
+static void exoHttp_parseLine(exoHttp_parser_t * parser)
+{
+    const char * p;
+    uint32_t size;
+    int8_t digit;
+    uint8_t i;
+
+    switch (parser->state)
+    {
+    case EXOHTTP_STATE_STATUS_LINE:
+        p = exoHttp_matchPrefix(parser->line, "http/");
+        while (p && *p && *p != ' ')
+        {
+            p++;
+        }
+        if (!p || *p != ' ')
+        {
+            parser->state = EXOHTTP_STATE_ERROR;
+            return;
+        }
+        p++;
+        parser->statusCode = 0;
+        for (i = 0; i < 3; i++)
+        {
+            if (p[i] < '0' || p[i] > '9')
+            {
+                parser->state = EXOHTTP_STATE_ERROR;
+                return;
+            }
+            parser->statusCode = parser->statusCode * 10 + (p[i] - '0');
+        }
+        parser->state = EXOHTTP_STATE_HEADER;
+        break;
+
+    case EXOHTTP_STATE_HEADER:
+        if (parser->lineLength == 0)
+        {
+            exoHttp_endHeaders(parser);
+        }
+        else
+        {
+            exoHttp_parseHeader(parser);
+        }
+        break;
+
+    case EXOHTTP_STATE_CHUNK_SIZE:
+        size = 0;
+        for (p = parser->line; *p && *p != ';'; p++)
+        {
+            if (*p >= '0' && *p <= '9')
+            {
+                digit = *p - '0';
+            }
+            else if (*p >= 'a' && *p <= 'f')
+            {
+                digit = *p - 'a' + 10;
+            }
+            else if (*p >= 'A' && *p <= 'F')
+            {
+                digit = *p - 'A' + 10;
+            }
+            else if (*p == ' ')
+            {
+                continue;
+            }
+            else
+            {
+                parser->state = EXOHTTP_STATE_ERROR;
+                return;
+            }
+            size = (size << 4) | digit;
+        }
+        if (p == parser->line)
+        {
+            parser->state = EXOHTTP_STATE_ERROR;
+            return;
+        }
+        parser->remaining = size;
+        parser->state = (size == 0) ? EXOHTTP_STATE_TRAILER : EXOHTTP_STATE_CHUNK_DATA;
+        break;
+
+    case EXOHTTP_STATE_CHUNK_END:
+        parser->state = (parser->lineLength == 0) ?
+                        EXOHTTP_STATE_CHUNK_SIZE : EXOHTTP_STATE_ERROR;
+        break;
+
+    case EXOHTTP_STATE_TRAILER:
+        if (parser->lineLength == 0)
+        {
+            parser->state = EXOHTTP_STATE_DONE;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/*!
+ * \brief  Picks out the headers that decide how the body is framed
+ */
+static void exoHttp_parseHeader(exoHttp_parser_t * parser)
+{
+    const char * value;
+
+    if (parser->onHeader)
+    {
+        parser->onHeader(parser->context, parser->line, parser->lineLength);
+    }
+
+    if ((value = exoHttp_matchPrefix(parser->line, STR_CONTENT_LENGTH)) != 0)
+    {
+        while (*value == ' ')
+        {
+            value++;
+        }
+        parser->contentLength = 0;
+        while (*value >= '0' && *value <= '9')
+        {
+            parser->contentLength = parser->contentLength * 10 + (*value++ - '0');
+        }
+    }
+    else if ((value = exoHttp_matchPrefix(parser->line, STR_TRANSFER_ENCODING)) != 0)
+    {
+        parser->isChunked = exoHttp_hasToken(value, STR_CHUNKED);
+    }
+    else if ((value = exoHttp_matchPrefix(parser->line, STR_CONNECTION)) != 0)
+    {
+        if (exoHttp_hasToken(value, STR_CLOSE))
+        {
+            parser->isClose = 1;
+        }
+    }
+}
+
+
+/*!
+ * \brief  Works out how the body is delimited once all headers are read
+ */
+static void exoHttp_endHeaders(exoHttp_parser_t * parser)
+{
+    if (parser->statusCode >= 100 && parser->statusCode < 200)
+    {
+        // interim response, the real one follows
+        exoHttp_init(parser, parser->onBody, parser->onHeader, parser->context);
+    }
+    else if (parser->statusCode == 204 || parser->statusCode == 304)
+    {
+        // never have a body
+        parser->state = EXOHTTP_STATE_DONE;
+    }
+    else if (parser->isChunked)
+    {
+        parser->state = EXOHTTP_STATE_CHUNK_SIZE;
+    }
+    else if (parser->contentLength >= 0)
+    {
+        parser->remaining = parser->contentLength;
+        parser->state = (parser->remaining == 0) ?
+                        EXOHTTP_STATE_DONE : EXOHTTP_STATE_BODY;
+    }
+    else
+    {
+        parser->isClose = 1;
+        parser->state = EXOHTTP_STATE_BODY_UNTIL_CLOSE;
+    }
+}
@@ -0,0 +1,106 @@
+/*****************************************************************************
+*
+*  exosite_http.h - Incremental HTTP response parser interface
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+#ifndef EXOSITE_HTTP_H
+#define EXOSITE_HTTP_H
+
+#include <stdint.h>
+
+
+// DEFINES
+
+/*!< Longest status or header line kept by the parser.  Longer lines are
+   truncated, which is fine since only the start of the headers we care
+   about is needed.*/
+#define EXOHTTP_LINE_SIZE                       96
+
+
+// ENUMS
+/*!
+ * Parser states, in the order a response is parsed.
+ */
+typedef enum EXOHTTP_STATE_tag
+{
+    EXOHTTP_STATE_STATUS_LINE,      /*!< Waiting for "HTTP/1.1 200 OK" */
+    EXOHTTP_STATE_HEADER,           /*!< Reading header lines */
+    EXOHTTP_STATE_BODY,             /*!< Reading Content-Length body bytes */
+    EXOHTTP_STATE_BODY_UNTIL_CLOSE, /*!< No length given, body ends at close */
+    EXOHTTP_STATE_CHUNK_SIZE,       /*!< Reading a chunk size line */
+    EXOHTTP_STATE_CHUNK_DATA,       /*!< Reading chunk bytes */
+    EXOHTTP_STATE_CHUNK_END,        /*!< Reading the CRLF after a chunk */
+    EXOHTTP_STATE_TRAILER,          /*!< Reading trailers after the last chunk */
+    EXOHTTP_STATE_DONE,             /*!< Response complete */
+    EXOHTTP_STATE_ERROR             /*!< Malformed response */
+}EXOHTTP_STATE;
+
+
+// TYPES
+/*!
+ * Called with each piece of the response body as it is parsed.
+ */
+typedef void (*exoHttp_bodyCallback)(void * context, const char * data, uint16_t length);
+
+/*!
+ * Called with each null terminated header line, e.g. "Last-Modified: 5".
+ */
+typedef void (*exoHttp_headerCallback)(void * context, const char * line, uint16_t length);
+
+/*!
+ * State of one response being parsed.  Initialize with exoHttp_init.
+ */
+typedef struct exoHttp_parser_tag
+{
+    EXOHTTP_STATE state;
+    int16_t statusCode;         /*!< HTTP status, 0 until the status line is parsed */
+    int32_t contentLength;      /*!< Content-Length, -1 if not given */
+    uint32_t remaining;         /*!< bytes left in the body or current chunk */
+    uint8_t isChunked;          /*!< Transfer-Encoding: chunked */
+    uint8_t isClose;            /*!< connection can't be reused after this response */
+    uint16_t lineLength;
+    char line[EXOHTTP_LINE_SIZE];
+    exoHttp_bodyCallback onBody;
+    exoHttp_headerCallback onHeader;
+    void * context;
+}exoHttp_parser_t;
+
+
+// PUBLIC FUNCTIONS
+void exoHttp_init(exoHttp_parser_t * parser, exoHttp_bodyCallback onBody,
+                  exoHttp_headerCallback onHeader, void * context);
+int32_t exoHttp_parse(exoHttp_parser_t * parser, const char * data, uint16_t length);
+void exoHttp_finish(exoHttp_parser_t * parser);
+uint8_t exoHttp_isComplete(const exoHttp_parser_t * parser);
+
+#endif
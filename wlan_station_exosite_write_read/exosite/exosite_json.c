@@ -0,0 +1,745 @@
+/*****************************************************************************
+*
+*  exosite_json.c - Streaming JSON writer
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+#include "exosite_json.h"
+
+/*!
+ * What a reader expects next, exoJson_reader_t.state.
+ */
+#define EXOJSON_READ_VALUE          0   /* a value */
+#define EXOJSON_READ_FIRST_VALUE    1   /* a value, or ] of an empty array */
+#define EXOJSON_READ_KEY            2   /* a member name */
+#define EXOJSON_READ_FIRST_KEY      3   /* a member name, or } of an empty object */
+#define EXOJSON_READ_COLON          4
+#define EXOJSON_READ_NEXT           5   /* a comma, or the end of the object or array */
+#define EXOJSON_READ_STRING         6
+#define EXOJSON_READ_ESCAPE         7
+#define EXOJSON_READ_UNICODE        8
+#define EXOJSON_READ_BARE           9   /* a number or literal */
+#define EXOJSON_READ_DONE           10
+#define EXOJSON_READ_ERROR          11
+
+// local functions
+static void exoJson_write(exoJson_writer_t * writer, const char * data, uint16_t length);
+static void exoJson_beginValue(exoJson_writer_t * writer);
+static void exoJson_addChar(exoJson_reader_t * reader, char c);
+static void exoJson_emit(exoJson_reader_t * reader, EXOJSON_EVENT event);
+static int8_t exoJson_readValue(exoJson_reader_t * reader, char c);
+static int8_t exoJson_readEscape(exoJson_reader_t * reader, char c);
+static int8_t exoJson_readBare(exoJson_reader_t * reader);
+static int8_t exoJson_beginContainer(exoJson_reader_t * reader, uint8_t isArray);
+static int8_t exoJson_endContainer(exoJson_reader_t * reader, uint8_t isArray);
+
+
+/*!
+ * \brief  Starts a writer that only counts the bytes it would write
+ *
+ * Run the same calls through a counting writer and then a socket writer to
+ * send a body whose Content-Length has to come first.
+ */
+void exoJson_initCount(exoJson_writer_t * writer)
+{
+    exoJson_initBuffer(writer, 0, 0);
+}
+
+
+/*!
+ * \brief  Starts a writer that sends to \a sock with exoPal_socketWrite
+ */
+void exoJson_initSocket(exoJson_writer_t * writer, exoPal_socket_t * sock)
+{
+    exoJson_initBuffer(writer, 0, 0);
+    writer->sock = sock;
+}
+
+
+/*!
+ * \brief  Starts a writer that fills \a buffer
+ *
+ * Nothing is null terminated.  Writing past \a bufferSize fails the writer.
+ */
+void exoJson_initBuffer(exoJson_writer_t * writer, char * buffer, uint32_t bufferSize)
+{
+    writer->sock = 0;
+    writer->buffer = buffer;
+    writer->bufferSize = bufferSize;
+    writer->length = 0;
+    writer->hasMembers = 0;
+    writer->depth = 0;
+    writer->isAfterKey = 0;
+    writer->isError = 0;
+}
+
+
+/*!
+ * \brief  Starts an object as the next value
+ */
+void exoJson_beginObject(exoJson_writer_t * writer)
+{
+    exoJson_beginValue(writer);
+    exoJson_write(writer, "{", 1);
+    if (writer->depth >= EXOJSON_MAX_DEPTH)
+    {
+        writer->isError = 1;
+        return;
+    }
+    writer->depth++;
+    writer->hasMembers &= ~(1UL << writer->depth);
+}
+
+
+/*!
+ * \brief  Ends the object begun by exoJson_beginObject
+ */
+void exoJson_endObject(exoJson_writer_t * writer)
+{
+    exoJson_write(writer, "}", 1);
+    if (writer->depth == 0)
+    {
+        writer->isError = 1;
+        return;
+    }
+    writer->depth--;
+}
+
+
+/*!
+ * \brief  Starts an array as the next value
+ */
+void exoJson_beginArray(exoJson_writer_t * writer)
+{
+    exoJson_beginValue(writer);
+    exoJson_write(writer, "[", 1);
+    if (writer->depth >= EXOJSON_MAX_DEPTH)
+    {
+        writer->isError = 1;
+        return;
+    }
+    writer->depth++;
+    writer->hasMembers &= ~(1UL << writer->depth);
+}
+
+
+/*!
+ * \brief  Ends the array begun by exoJson_beginArray
+ */
+void exoJson_endArray(exoJson_writer_t * writer)
+{
+    exoJson_write(writer, "]", 1);
+    if (writer->depth == 0)
+    {
+        writer->isError = 1;
+        return;
+    }
+    writer->depth--;
+}
+
+
+/*!
+ * \brief  Writes the name of the next member of an object
+ *
+ * \param[in] key Member name, null terminated
+ */
+void exoJson_key(exoJson_writer_t * writer, const char * key)
+{
+    exoJson_string(writer, key, exoPal_strlen(key));
+    exoJson_write(writer, ":", 1);
+    writer->isAfterKey = 1;
+}
+
+
+/*!
+ * \brief  Writes a string value, escaped
+ */
+void exoJson_string(exoJson_writer_t * writer, const char * str, uint16_t length)
+{
+    exoJson_beginValue(writer);
+    exoJson_write(writer, "\"", 1);
+    exoJson_chars(writer, str, length, 0);
+    exoJson_write(writer, "\"", 1);
+}
+
+
+/*!
+ * \brief  Writes an urlencoded value, e.g. from exosite_write data, as a string
+ */
+void exoJson_formString(exoJson_writer_t * writer, const char * str, uint16_t length)
+{
+    exoJson_beginValue(writer);
+    exoJson_write(writer, "\"", 1);
+    exoJson_chars(writer, str, length, 1);
+    exoJson_write(writer, "\"", 1);
+}
+
+
+/*!
+ * \brief  Writes a number value
+ */
+void exoJson_int(exoJson_writer_t * writer, int32_t value)
+{
+    char numberStr[12];
+    uint8_t numberLength;
+
+    numberLength = exoPal_itoa(value, numberStr, sizeof(numberStr));
+    exoJson_beginValue(writer);
+    exoJson_write(writer, numberStr, numberLength);
+}
+
+
+/*!
+ * \brief  Writes JSON that is already rendered as the next value
+ *
+ * \a json may also be several comma separated values, e.g. array elements.
+ */
+void exoJson_raw(exoJson_writer_t * writer, const char * json, uint16_t length)
+{
+    exoJson_beginValue(writer);
+    exoJson_write(writer, json, length);
+}
+
+
+/*!
+ * \brief  Writes the inside of a JSON string, escaping what has to be
+ *
+ * For strings that are put together from several pieces; exoJson_string
+ * writes a whole one.  Runs of characters that need no escaping are written
+ * in one go.
+ *
+ * \param[in] urlDecode Decode %XX and '+' first
+ */
+void exoJson_chars(exoJson_writer_t * writer, const char * str, uint16_t length, uint8_t urlDecode)
+{
+    static const char hex[] = "0123456789abcdef";
+    char escaped[6];
+    uint8_t escapedLength;
+    uint16_t runStart = 0;
+    uint16_t i;
+    char c;
+
+    for (i = 0; i < length; i++)
+    {
+        c = str[i];
+        if (c != '"' && c != '\\' && (unsigned char)c >= 0x20 &&
+            !(urlDecode && (c == '+' || c == '%')))
+        {
+            continue;
+        }
+        exoJson_write(writer, &str[runStart], i - runStart);
+
+        if (urlDecode && c == '+')
+        {
+            c = ' ';
+        }
+        else if (urlDecode && c == '%' && i + 2 < length)
+        {
+            char hi = str[i + 1] | 0x20;
+            char lo = str[i + 2] | 0x20;
+            hi = (hi <= '9') ? hi - '0' : hi - 'a' + 10;
+            lo = (lo <= '9') ? lo - '0' : lo - 'a' + 10;
+            c = (hi << 4) | (lo & 0x0f);
+            i += 2;
+        }
+
+        escapedLength = 0;
+        if (c == '"' || c == '\\')
+        {
+            escaped[escapedLength++] = '\\';
+            escaped[escapedLength++] = c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            escaped[escapedLength++] = '\\';
+            escaped[escapedLength++] = 'u';
+            escaped[escapedLength++] = '0';
+            escaped[escapedLength++] = '0';
+            escaped[escapedLength++] = hex[(c >> 4) & 0x0f];
+            escaped[escapedLength++] = hex[c & 0x0f];
+        }
+        else
+        {
+            escaped[escapedLength++] = c;
+        }
+        exoJson_write(writer, escaped, escapedLength);
+        runStart = i + 1;
+    }
+    exoJson_write(writer, &str[runStart], length - runStart);
+}
+
+
+/*!
+ * \brief  Checks whether anything went wrong since the writer was started
+ *
+ * \return 1 if a write failed, the buffer filled up or the nesting doesn't
+ *         match, else 0
+ */
+uint8_t exoJson_failed(const exoJson_writer_t * writer)
+{
+    return writer->isError || writer->depth != 0;
+}
+
+
+/*!
+ * \brief  Starts a reader at the beginning of a JSON value
+ *
+ * \param[in] onEvent Called with each part of the JSON as it is read
+ * \param[in] context Kept in reader->context for onEvent
+ */
+void exoJson_initReader(exoJson_reader_t * reader, exoJson_eventCallback onEvent, void * context)
+{
+    reader->onEvent = onEvent;
+    reader->context = context;
+    reader->isArray = 0;
+    reader->depth = 0;
+    reader->state = EXOJSON_READ_VALUE;
+    reader->isKey = 0;
+    reader->isTruncated = 0;
+    reader->unicodeDigits = 0;
+    reader->unicode = 0;
+    reader->tokenLength = 0;
+}
+
+
+/*!
+ * \brief  Reads the next piece of the JSON
+ *
+ * Can be fed an exoHttp body as it arrives, the pieces may split tokens
+ * anywhere.  The events of everything complete so far are passed to the
+ * reader's callback before this returns.
+ *
+ * \param[in] data Next bytes of the JSON
+ * \param[in] length Length of data
+ *
+ * \return 0 if successful, -1 if the JSON is malformed, which the reader
+ *         keeps returning
+ */
+int8_t exoJson_feed(exoJson_reader_t * reader, const char * data, uint16_t length)
+{
+    uint16_t i = 0;
+    int8_t result = 0;
+    char c;
+
+    while (i < length && result == 0)
+    {
+        c = data[i];
+        switch (reader->state)
+        {
+        case EXOJSON_READ_STRING:
+            if (c == '"')
+            {
+                exoJson_emit(reader, reader->isKey ? EXOJSON_EVENT_KEY : EXOJSON_EVENT_STRING);
+                if (reader->isKey)
+                {
+                    reader->state = EXOJSON_READ_COLON;
+                }
+                else
+                {
+                    reader->state = reader->depth ? EXOJSON_READ_NEXT : EXOJSON_READ_DONE;
+                }
+            }
+            else if (c == '\\')
+            {
+                reader->state = EXOJSON_READ_ESCAPE;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                result = -1;
+            }
+            else
+            {
+                exoJson_addChar(reader, c);
+            }
+            break;
+        case EXOJSON_READ_ESCAPE:
+        case EXOJSON_READ_UNICODE:
+            result = exoJson_readEscape(reader, c);
+            break;
+        case EXOJSON_READ_BARE:
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                c == '-' || c == '+' || c == '.' || c == 'E')
+            {
+                exoJson_addChar(reader, c);
+                break;
+            }
+            // the character after the token is read again in the new state
+            result = exoJson_readBare(reader);
+            continue;
+        case EXOJSON_READ_ERROR:
+            result = -1;
+            continue;
+        default:
+            if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+            {
+                result = exoJson_readValue(reader, c);
+            }
+            break;
+        }
+        i++;
+    }
+    if (result != 0)
+    {
+        reader->state = EXOJSON_READ_ERROR;
+    }
+    return result;
+}
+
+
+/*!
+ * \brief  Checks whether the reader has read a whole JSON value
+ *
+ * A number on its own can't be told complete until something follows it.
+ *
+ * \return 1 once the outermost value is complete, else 0
+ */
+uint8_t exoJson_isComplete(const exoJson_reader_t * reader)
+{
+    return reader->state == EXOJSON_READ_DONE;
+}
+
+
+/*!
+ * \brief  Sends \a data to the writer's socket or buffer, or just counts it
+ */
+static void exoJson_write(exoJson_writer_t * writer, const char * data, uint16_t length)
+{
+    if (writer->isError || length == 0)
+    {
+        return;
+    }
+    if (writer->sock)
+    {
+        if (exoPal_socketWrite(writer->sock, data, length) != 0)
+        {
+            writer->isError = 1;
+            return;
+        }
+    }
+    else if (writer->buffer)
+    {
+        if (writer->length + length > writer->bufferSize)
+        {
+            writer->isError = 1;
+            return;
+        }
+        exoPal_memcpy(&writer->buffer[writer->length], data, length);
+    }
+    writer->length += length;
+}
+
+
+/*!
+ * \brief  Puts in the comma before a value, unless it's the first one
+ */
+static void exoJson_beginValue(exoJson_writer_t * writer)
+{
+    uint32_t bit = 1UL << writer->depth;
+
+    if (writer->isAfterKey)
+    {
+        writer->isAfterKey = 0;
+        return;
+    }
+    if (writer->depth > 0 && (writer->hasMembers & bit))
+    {
+        exoJson_write(writer, ",", 1);
+    }
+    writer->hasMembers |= bit;
+}
+
+
+/*!
+ * \brief  Adds a character to the token being read, if there is room
+ */
+static void exoJson_addChar(exoJson_reader_t * reader, char c)
+{
+    if (reader->tokenLength < EXOJSON_TOKEN_SIZE)
+    {
+        reader->token[reader->tokenLength++] = c;
+    }
+    else
+    {
+        reader->isTruncated = 1;
+    }
+}
+
+
+/*!
+ * \brief  Passes an event with the token read so far to the callback
+ */
+static void exoJson_emit(exoJson_reader_t * reader, EXOJSON_EVENT event)
+{
+    reader->token[reader->tokenLength] = '\0';
+    reader->onEvent(reader, event, reader->token, reader->tokenLength);
+    reader->tokenLength = 0;
+    reader->isTruncated = 0;
+}
+
+
+/*!
+ * \brief  Handles a character outside of strings, numbers and literals
+ *
+ * \return 0 if successful, -1 if it isn't valid where it is
+ */
+static int8_t exoJson_readValue(exoJson_reader_t * reader, char c)
+{
+    switch (reader->state)
+    {
+    case EXOJSON_READ_FIRST_VALUE:
+        if (c == ']')
+        {
+            return exoJson_endContainer(reader, 1);
+        }
+        // fall through
+    case EXOJSON_READ_VALUE:
+        if (c == '{' || c == '[')
+        {
+            return exoJson_beginContainer(reader, c == '[');
+        }
+        reader->tokenLength = 0;
+        reader->isTruncated = 0;
+        if (c == '"')
+        {
+            reader->isKey = 0;
+            reader->state = EXOJSON_READ_STRING;
+            return 0;
+        }
+        if ((c >= '0' && c <= '9') || c == '-' || (c >= 'a' && c <= 'z'))
+        {
+            exoJson_addChar(reader, c);
+            reader->state = EXOJSON_READ_BARE;
+            return 0;
+        }
+        return -1;
+    case EXOJSON_READ_FIRST_KEY:
+        if (c == '}')
+        {
+            return exoJson_endContainer(reader, 0);
+        }
+        // fall through
+    case EXOJSON_READ_KEY:
+        if (c != '"')
+        {
+            return -1;
+        }
+        reader->tokenLength = 0;
+        reader->isTruncated = 0;
+        reader->isKey = 1;
+        reader->state = EXOJSON_READ_STRING;
+        return 0;
+    case EXOJSON_READ_COLON:
+        if (c != ':')
+        {
+            return -1;
+        }
+        reader->state = EXOJSON_READ_VALUE;
+        return 0;
+    case EXOJSON_READ_NEXT:
+        if (c == ',')
+        {
+            reader->state = (reader->isArray & (1UL << reader->depth)) ?
+                            EXOJSON_READ_VALUE : EXOJSON_READ_KEY;
+            return 0;
+        }
+        if (c == ']' || c == '}')
+        {
+            return exoJson_endContainer(reader, c == ']');
+        }
+        return -1;
+    default:
+        // anything but whitespace after the value
+        return -1;
+    }
+}
+
+
+/*!
+ * \brief  Handles the character after a backslash in a string
+ *
+ * Unicode escapes are written out as UTF-8.  Surrogate pairs aren't combined,
+ * each half is written on its own.
+ *
+ * \return 0 if successful, -1 if it isn't a valid escape
+ */
+static int8_t exoJson_readEscape(exoJson_reader_t * reader, char c)
+{
+    uint16_t unicode;
+
+    if (reader->state == EXOJSON_READ_UNICODE)
+    {
+        if (c >= '0' && c <= '9')
+        {
+            reader->unicode = (reader->unicode << 4) | (c - '0');
+        }
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+        {
+            reader->unicode = (reader->unicode << 4) | ((c | 0x20) - 'a' + 10);
+        }
+        else
+        {
+            return -1;
+        }
+        if (--reader->unicodeDigits > 0)
+        {
+            return 0;
+        }
+        unicode = reader->unicode;
+        if (unicode < 0x80)
+        {
+            exoJson_addChar(reader, (char)unicode);
+        }
+        else if (unicode < 0x800)
+        {
+            exoJson_addChar(reader, (char)(0xc0 | (unicode >> 6)));
+            exoJson_addChar(reader, (char)(0x80 | (unicode & 0x3f)));
+        }
+        else
+        {
+            exoJson_addChar(reader, (char)(0xe0 | (unicode >> 12)));
+            exoJson_addChar(reader, (char)(0x80 | ((unicode >> 6) & 0x3f)));
+            exoJson_addChar(reader, (char)(0x80 | (unicode & 0x3f)));
+        }
+        reader->state = EXOJSON_READ_STRING;
+        return 0;
+    }
+
+    switch (c)
+    {
+    case '"':
+    case '\\':
+    case '/':
+        break;
+    case 'b':
+        c = '\b';
+        break;
+    case 'f':
+        c = '\f';
+        break;
+    case 'n':
+        c = '\n';
+        break;
+    case 'r':
+        c = '\r';
+        break;
+    case 't':
+        c = '\t';
+        break;
+    case 'u':
+        reader->unicode = 0;
+        reader->unicodeDigits = 4;
+        reader->state = EXOJSON_READ_UNICODE;
+        return 0;
+    default:
+        return -1;
+    }
+    exoJson_addChar(reader, c);
+    reader->state = EXOJSON_READ_STRING;
+    return 0;
+}
+
+
+/*!
+ * \brief  Ends a number or literal
+ *
+ * \return 0 if successful, -1 if it is neither
+ */
+static int8_t exoJson_readBare(exoJson_reader_t * reader)
+{
+    const char * token = reader->token;
+    uint16_t length = reader->tokenLength;
+    EXOJSON_EVENT event;
+
+    if ((length == 4 && token[0] == 't' && token[1] == 'r' && token[2] == 'u' && token[3] == 'e') ||
+        (length == 5 && token[0] == 'f' && token[1] == 'a' && token[2] == 'l' && token[3] == 's' &&
+         token[4] == 'e') ||
+        (length == 4 && token[0] == 'n' && token[1] == 'u' && token[2] == 'l' && token[3] == 'l'))
+    {
+        event = EXOJSON_EVENT_LITERAL;
+    }
+    else if ((token[0] == '-' || (token[0] >= '0' && token[0] <= '9')) && !reader->isTruncated)
+    {
+        event = EXOJSON_EVENT_NUMBER;
+    }
+    else
+    {
+        return -1;
+    }
+    exoJson_emit(reader, event);
+    reader->state = reader->depth ? EXOJSON_READ_NEXT : EXOJSON_READ_DONE;
+    return 0;
+}
+
+
+/*!
+ * \brief  Starts an object or array
+ *
+ * \return 0 if successful, -1 if it is nested too deep
+ */
+static int8_t exoJson_beginContainer(exoJson_reader_t * reader, uint8_t isArray)
+{
+    if (reader->depth >= EXOJSON_MAX_DEPTH)
+    {
+        return -1;
+    }
+    reader->depth++;
+    if (isArray)
+    {
+        reader->isArray |= 1UL << reader->depth;
+    }
+    else
+    {
+        reader->isArray &= ~(1UL << reader->depth);
+    }
+    reader->tokenLength = 0;
+    exoJson_emit(reader, isArray ? EXOJSON_EVENT_BEGIN_ARRAY : EXOJSON_EVENT_BEGIN_OBJECT);
+    reader->state = isArray ? EXOJSON_READ_FIRST_VALUE : EXOJSON_READ_FIRST_KEY;
+    return 0;
+}
+
+
+/*!
+ * \brief  Ends the innermost object or array
+ *
+ * \return 0 if successful, -1 if it is the other kind or there is none
+ */
+static int8_t exoJson_endContainer(exoJson_reader_t * reader, uint8_t isArray)
+{
+    if (reader->depth == 0 || !(reader->isArray & (1UL << reader->depth)) != !isArray)
+    {
+        return -1;
+    }
+    reader->tokenLength = 0;
+    exoJson_emit(reader, isArray ? EXOJSON_EVENT_END_ARRAY : EXOJSON_EVENT_END_OBJECT);
+    reader->depth--;
+    reader->state = reader->depth ? EXOJSON_READ_NEXT : EXOJSON_READ_DONE;
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*****************************************************************************
+*
+*  exosite_json.h - Streaming JSON writer interface
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+#ifndef EXOSITE_JSON_H
+#define EXOSITE_JSON_H
+
+#include <stdint.h>
+#include "exosite_pal.h"
+
+
+// DEFINES
+
+/*!< Deepest nesting of objects and arrays a writer or reader keeps track
+   of.*/
+#define EXOJSON_MAX_DEPTH                       31
+
+/*!< Longest key, string or number a reader passes to its handler.  Longer
+   strings are cut short and flagged with isTruncated.*/
+#define EXOJSON_TOKEN_SIZE                      64
+
+
+// ENUMS
+/*!
+ * What a reader found, passed to its exoJson_eventCallback.
+ */
+typedef enum EXOJSON_EVENT_tag
+{
+    EXOJSON_EVENT_BEGIN_OBJECT,
+    EXOJSON_EVENT_END_OBJECT,
+    EXOJSON_EVENT_BEGIN_ARRAY,
+    EXOJSON_EVENT_END_ARRAY,
+    EXOJSON_EVENT_KEY,          /*!< member name, unescaped */
+    EXOJSON_EVENT_STRING,       /*!< string value, unescaped */
+    EXOJSON_EVENT_NUMBER,       /*!< number, as it was written */
+    EXOJSON_EVENT_LITERAL       /*!< true, false or null */
+}EXOJSON_EVENT;
+
+
+// TYPES
+/*!
+ * Writes JSON straight to a socket or a buffer, or only counts it, with no
+ * intermediate copy.  Commas are put in as values are added.  Initialize
+ * with one of the exoJson_init functions; errors are sticky, check
+ * exoJson_failed once the value is complete.
+ */
+typedef struct exoJson_writer_tag
+{
+    exoPal_socket_t * sock;     /*!< socket written to, or 0 */
+    char * buffer;              /*!< buffer written to, or 0 */
+    uint32_t bufferSize;
+    uint32_t length;            /*!< bytes written, or counted, so far */
+    uint32_t hasMembers;        /*!< bit per nesting level, set once it has a member */
+    uint8_t depth;
+    uint8_t isAfterKey;         /*!< next value is a member's, no comma */
+    uint8_t isError;
+}exoJson_writer_t;
+
+
+struct exoJson_reader_tag;
+
+/*!
+ * Called by exoJson_feed for each part of the JSON as it is read.  \a token
+ * is set for keys, strings, numbers and literals, null terminated, and only
+ * valid during the call.  reader->depth is the number of objects and arrays
+ * the event is in, counting the one it begins or ends.
+ */
+typedef void (*exoJson_eventCallback)(struct exoJson_reader_tag * reader, EXOJSON_EVENT event,
+                                      const char * token, uint16_t length);
+
+/*!
+ * Reads JSON fed to it in pieces of any size, e.g. as they arrive from the
+ * socket, and reports what it finds to a callback.  Only the innermost
+ * token is buffered, so the JSON can be any size.  Initialize with
+ * exoJson_initReader.
+ */
+typedef struct exoJson_reader_tag
+{
+    exoJson_eventCallback onEvent;
+    void * context;             /*!< for onEvent */
+    uint32_t isArray;           /*!< bit per nesting level, set for arrays */
+    uint8_t depth;
+    uint8_t state;              /*!< what is expected next */
+    uint8_t isKey;              /*!< the string being read is a member name */
+    uint8_t isTruncated;        /*!< the token didn't fit in EXOJSON_TOKEN_SIZE */
+    uint8_t unicodeDigits;      /*!< hex digits of a unicode escape still to come */
+    uint16_t unicode;
+    uint16_t tokenLength;
+    char token[EXOJSON_TOKEN_SIZE + 1];
+}exoJson_reader_t;
+
+
+// PUBLIC FUNCTIONS
+void exoJson_initCount(exoJson_writer_t * writer);
+void exoJson_initSocket(exoJson_writer_t * writer, exoPal_socket_t * sock);
+void exoJson_initBuffer(exoJson_writer_t * writer, char * buffer, uint32_t bufferSize);
+void exoJson_beginObject(exoJson_writer_t * writer);
+void exoJson_endObject(exoJson_writer_t * writer);
+void exoJson_beginArray(exoJson_writer_t * writer);
+void exoJson_endArray(exoJson_writer_t * writer);
+void exoJson_key(exoJson_writer_t * writer, const char * key);
+void exoJson_string(exoJson_writer_t * writer, const char * str, uint16_t length);
+void exoJson_formString(exoJson_writer_t * writer, const char * str, uint16_t length);
+void exoJson_int(exoJson_writer_t * writer, int32_t value);
+void exoJson_raw(exoJson_writer_t * writer, const char * json, uint16_t length);
+void exoJson_chars(exoJson_writer_t * writer, const char * str, uint16_t length, uint8_t urlDecode);
+uint8_t exoJson_failed(const exoJson_writer_t * writer);
+void exoJson_initReader(exoJson_reader_t * reader, exoJson_eventCallback onEvent, void * context);
+int8_t exoJson_feed(exoJson_reader_t * reader, const char * data, uint16_t length);
+uint8_t exoJson_isComplete(const exoJson_reader_t * reader);
+
+#endif
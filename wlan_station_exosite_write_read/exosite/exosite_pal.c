@@ -44,13 +44,48 @@
 
 #define CIK_LENGTH 40
 #define CIK_FILENAME "exosite_cik.txt"
+#define CIK_FILENAME_SLOT "exosite_cikN.txt"
+#define CIK_FILENAME_SLOT_DIGIT 11
+#define SPILL_FILENAME "exosite_spillN.bin"
+#define SPILL_FILENAME_DIGIT 13
+
+#define SPILL_FREE      0   /* no file */
+#define SPILL_WRITING   1   /* open for appending */
+#define SPILL_CLOSED    2   /* written, no longer appended to */
+#define SPILL_READING   3   /* open for reading */
 
 #define EXOSITE_URL "m2.exosite.com"
+#if EXOPAL_TLS
+#define EXOSITE_PORT 443
+#else
+#define EXOSITE_PORT 80
+#endif
 #define MAC_LENGTH 6
-// holds ID of current socket.  val is negative if no socket is open
-static int curSocketID = -1;
+/*
+ * The spill is kept in two files so it can be appended to while it's being
+ * drained.  A file can't be read while it's open for writing, and opening it
+ * for writing again erases it, so appends go to spillFiles[spillCurrent]
+ * until a read reaches it.  It's then closed and the next append starts the
+ * other file, which by then has been released.  Offsets are those of the
+ * spill as a whole, each file holds the bytes from its base up to its end.
+ */
+typedef struct exoPal_spillFile_tag
+{
+    long handle;        /* open in mode unless SPILL_FREE or SPILL_CLOSED */
+    uint8_t mode;
+    uint32_t base;
+    uint32_t end;
+}exoPal_spillFile_t;
 
-char exoPal_rxBuffer[RX_BUFFER_SIZE];
+static exoPal_spillFile_t spillFiles[2];
+static uint8_t spillCurrent = 0;
+
+// PAL time base, advanced by exoPal_tick
+static volatile uint32_t timeMs = 0;
+static uint32_t tickRemainder = 0;
+
+static void exoPal_applyRecvTimeout(exoPal_socket_t * sock);
+static void exoPal_setNonBlocking(exoPal_socket_t * sock, uint8_t nonBlocking);
 
 //SlSockAddrIn_t Addr = {0};
 
@@ -59,10 +94,25 @@ char exoPal_rxBuffer[RX_BUFFER_SIZE];
 
 //#define ADDR_SIZE sizeof(SlSockAddrIn_t)
 
+// address of EXOSITE_URL, see exoPal_getServerIp.  Starts out as the last
+// address known to work, which is used until a lookup succeeds.
 static unsigned long ip = 0xADFFD11c; //1p
 //static uint32_t ip = 0xC0A80339; // netbook
 //static uint32_t ip = 0xADE692d2; // http 1.0 proxy
 
+// set while ip came from a lookup that hasn't expired or been invalidated
+static uint8_t isIpResolved = 0;
+static uint32_t ipResolvedMs;
+
+// set after a failed lookup, holds off the next one for EXOPAL_DNS_RETRY_MS
+static uint8_t hasLookupFailed = 0;
+static uint32_t lookupFailedMs;
+
+// connects in a row that failed, see exoPal_connectResult
+static uint8_t connectFailures = 0;
+
+static exoPal_dnsStats_t dnsStats;
+
 
 //*****************************************************************************
 //
@@ -70,6 +120,9 @@ static unsigned long ip = 0xADFFD11c; //1p
 //!
 //! @brief  This function obtains the server IP address
 //!
+//! On failure the previous address is kept, so connects fall back on the
+//! last one that was known.
+//!
 //! @param  void
 //!
 //! @return Success or Failure.
@@ -79,23 +132,134 @@ static unsigned long ip = 0xADFFD11c; //1p
 unsigned long exoPal_GetHostIP()
 {
 	int iStatus = 0;
+	unsigned long resolvedIp;
 
-    /* Check for Internet connection */
-    /* Querying for ti.com IP address */
+    dnsStats.lookups++;
     iStatus = sl_NetAppDnsGetHostByName((signed char *)EXOSITE_URL,
-                                           strlen(EXOSITE_URL), &ip, SL_AF_INET);
+                                           strlen(EXOSITE_URL), &resolvedIp, SL_AF_INET);
     if (iStatus < 0)
     {
         // LAN connection is successful
         // Problem with Internet connection
+        dnsStats.failures++;
+        hasLookupFailed = 1;
+        lookupFailedMs = exoPal_getTimeMs();
         return 0;
     }
     else
     {
+        ip = resolvedIp;
+        isIpResolved = 1;
+        ipResolvedMs = exoPal_getTimeMs();
+        hasLookupFailed = 0;
     	return 1;
     }
 }
 
+/*!
+ * \brief Checks if the cached server address is older than \a maxAgeMs
+ *
+ * \return 1 if it should be looked up again, 0 if it is recent enough or a
+ *         lookup failed less than EXOPAL_DNS_RETRY_MS ago
+ */
+static uint8_t exoPal_isLookupDue(uint32_t maxAgeMs)
+{
+    uint32_t now = exoPal_getTimeMs();
+
+    if (hasLookupFailed && (now - lookupFailedMs < EXOPAL_DNS_RETRY_MS))
+    {
+        return 0;
+    }
+    return !isIpResolved || (now - ipResolvedMs >= maxAgeMs);
+}
+
+/*!
+ * \brief Returns the address to connect to
+ *
+ * Normally the cached address, which exoPal_dnsService keeps fresh.  It is
+ * only looked up here if it has expired, and if that fails the last known
+ * address is returned.
+ */
+static unsigned long exoPal_getServerIp()
+{
+    if (exoPal_isLookupDue(EXOPAL_DNS_TTL_MS))
+    {
+        exoPal_GetHostIP();
+    }
+    if (!isIpResolved || (exoPal_getTimeMs() - ipResolvedMs >= EXOPAL_DNS_TTL_MS))
+    {
+        dnsStats.stale++;
+    }
+    return ip;
+}
+
+/*!
+ * \brief Records the outcome of a connect to the cached address
+ *
+ * After EXOPAL_DNS_MAX_CONNECT_FAILURES failures in a row the address is
+ * invalidated, so the next connect looks it up again.  It is still kept as
+ * the fallback in case that lookup fails.
+ *
+ * \param[in] failed 1 if the connect failed
+ */
+static void exoPal_connectResult(uint8_t failed)
+{
+    if (!failed)
+    {
+        connectFailures = 0;
+        return;
+    }
+    connectFailures++;
+    if (connectFailures >= EXOPAL_DNS_MAX_CONNECT_FAILURES)
+    {
+        connectFailures = 0;
+        isIpResolved = 0;
+        hasLookupFailed = 0;
+        dnsStats.invalidated++;
+    }
+}
+
+/*!
+ * \brief Refreshes the server address before it expires
+ *
+ * Should be called periodically from the application's main loop, between
+ * requests.  The lookup blocks, so doing it here keeps it out of the
+ * connects.
+ */
+void exoPal_dnsService()
+{
+    if (exoPal_isLookupDue(EXOPAL_DNS_TTL_MS - EXOPAL_DNS_REFRESH_MS))
+    {
+        exoPal_GetHostIP();
+    }
+}
+
+/*!
+ * \brief Retrieves the server address cache counters
+ *
+ * \param[out] stats Filled with the current counters
+ */
+void exoPal_getDnsStats(exoPal_dnsStats_t * stats)
+{
+    *stats = dnsStats;
+}
+
+/*!
+ * \brief Initializes a connection handle
+ *
+ * Must be called once before \a sock is passed to any other exoPal socket
+ * function.  No socket is opened until exoPal_tcpSocketOpen.
+ *
+ * \param[out] sock Connection to initialize
+ */
+void exoPal_socketInit(exoPal_socket_t * sock)
+{
+    memset(sock, 0, sizeof(exoPal_socket_t));
+    sock->id = -1;
+    sock->keepAliveTimeoutMs = EXOPAL_KEEPALIVE_TIMEOUT_MS;
+    sock->recvTimeoutMs = EXOPAL_RECV_TIMEOUT_MS;
+}
+
 /*!
  * \brief Closes a tcp socket
  *
@@ -105,12 +269,177 @@ unsigned long exoPal_GetHostIP()
  * \return 0 if successful, else error code
  * \sa exoPal_tcpSocketOpen
  */
-uint8_t exoPal_tcpSocketClose()
+uint8_t exoPal_tcpSocketClose(exoPal_socket_t * sock)
+{
+    if (sock->id >= 0)
+    {
+        close(sock->id);
+    }
+    sock->id = -1;
+    sock->txLength = 0;
+    sock->isNonBlocking = 0;
+    sock->isConnectPending = 0;
+    return 0;
+}
+
+/*!
+ * \brief Releases the socket at the end of a request
+ *
+ * If \a keepAlive is set the socket is left open so the next call to
+ * exoPal_tcpSocketOpen can reuse it, otherwise it is closed.
+ *
+ * \param[in] keepAlive 1 if the connection can be reused, else 0
+ *
+ * \return 0 if successful, else error code
+ * \sa exoPal_tcpSocketOpen
+ */
+uint8_t exoPal_tcpSocketRelease(exoPal_socket_t * sock, uint8_t keepAlive)
 {
-    close(curSocketID);
+    if (!keepAlive)
+    {
+        return exoPal_tcpSocketClose(sock);
+    }
+    sock->lastActivityMs = exoPal_getTimeMs();
     return 0;
 }
 
+/*!
+ * \brief Closes the kept-alive socket once it has been idle too long
+ *
+ * Should be called periodically from the application's main loop.
+ */
+void exoPal_socketService(exoPal_socket_t * sock)
+{
+    if ((sock->id >= 0) &&
+        (exoPal_getTimeMs() - sock->lastActivityMs >= sock->keepAliveTimeoutMs))
+    {
+        exoPal_tcpSocketClose(sock);
+        sock->stats.idleClosed++;
+    }
+}
+
+/*!
+ * \brief Sets how long an idle connection is kept open for reuse
+ *
+ * \param[in] timeoutMs Idle timeout in ms, 0 closes after every request
+ */
+void exoPal_setKeepAliveTimeout(exoPal_socket_t * sock, uint32_t timeoutMs)
+{
+    sock->keepAliveTimeoutMs = timeoutMs;
+}
+
+/*!
+ * \brief Sets how long exoPal_socketRead waits for data
+ *
+ * Applies to the open socket, if any, and to sockets opened later.
+ *
+ * \param[in] timeoutMs Receive timeout in ms
+ */
+void exoPal_setRecvTimeout(exoPal_socket_t * sock, uint32_t timeoutMs)
+{
+    if (timeoutMs == sock->recvTimeoutMs)
+    {
+        return;
+    }
+    sock->recvTimeoutMs = timeoutMs;
+    if (sock->id >= 0)
+    {
+        exoPal_applyRecvTimeout(sock);
+    }
+}
+
+/*!
+ * \brief Retrieves the connection reuse counters
+ *
+ * \param[out] stats Filled with the current counters
+ */
+void exoPal_getConnStats(const exoPal_socket_t * sock, exoPal_connStats_t * stats)
+{
+    *stats = sock->stats;
+}
+
+/*!
+ * \brief Advances the PAL time base
+ *
+ * Must be called EXOPAL_TICK_HZ times per second, typically from a timer
+ * interrupt.
+ */
+void exoPal_tick()
+{
+    tickRemainder += 1000;
+    timeMs += tickRemainder / EXOPAL_TICK_HZ;
+    tickRemainder %= EXOPAL_TICK_HZ;
+}
+
+/*!
+ * \brief Returns the ms elapsed since boot, as counted by exoPal_tick
+ */
+uint32_t exoPal_getTimeMs()
+{
+    return timeMs;
+}
+
+/*!
+ * \brief Sets the receive timeout of the open socket to sock->recvTimeoutMs
+ */
+static void exoPal_applyRecvTimeout(exoPal_socket_t * sock)
+{
+    struct SlTimeval_t timeVal;
+
+    timeVal.tv_sec = sock->recvTimeoutMs / 1000;               // Seconds
+    timeVal.tv_usec = (sock->recvTimeoutMs % 1000) * 1000;     // Microseconds. 10000 microseconds resolution
+    sl_SetSockOpt(sock->id,                           // Enable receive timeout
+                  SL_SOL_SOCKET,
+                  SL_SO_RCVTIMEO,
+                  (_u8 *)&timeVal,
+                  sizeof(timeVal));
+}
+
+/*!
+ * \brief Switches the open socket between blocking and non-blocking mode
+ */
+static void exoPal_setNonBlocking(exoPal_socket_t * sock, uint8_t nonBlocking)
+{
+    SlSockNonblocking_t enableOption;
+
+    if (nonBlocking == sock->isNonBlocking)
+    {
+        return;
+    }
+    enableOption.NonblockingEnabled = nonBlocking;
+    sl_SetSockOpt(sock->id,
+                  SL_SOL_SOCKET,
+                  SL_SO_NONBLOCKING,
+                  (_u8 *)&enableOption,
+                  sizeof(enableOption));
+    sock->isNonBlocking = nonBlocking;
+}
+
+/*!
+ * \brief Checks if the server closed the kept-alive socket
+ *
+ * An idle HTTP connection should never be readable, so any pending data
+ * means the server either closed it or sent something we can't use.
+ *
+ * \return 1 if the socket is still usable, else 0
+ */
+static uint8_t exoPal_isSocketAlive(exoPal_socket_t * sock)
+{
+    SlFdSet_t readSet;
+    struct SlTimeval_t timeVal;
+
+    timeVal.tv_sec = 0;
+    timeVal.tv_usec = 0;
+    SL_FD_ZERO(&readSet);
+    SL_FD_SET(sock->id, &readSet);
+
+    if (sl_Select(sock->id + 1, &readSet, 0, 0, &timeVal) != 0)
+    {
+        return 0;
+    }
+    return 1;
+}
+
 /*!
  * \brief
  *
@@ -128,16 +457,45 @@ void exoPal_init()
 }
 
 /*!
- * \brief Opens a tcp socket
+ * \brief Creates the socket for a connection to Exosite
  *
- * Opens the currently open socket.  This can be done either through
- * an OS, or direct calls to the modem.
+ * With EXOPAL_TLS it is a secure socket, sl_Connect then also runs the TLS
+ * handshake.
  *
- * \return 0 if successful, else error code
+ * \return the socket id, negative on error
+ */
+static int exoPal_createSocket()
+{
+#if EXOPAL_TLS
+    SlSockSecureMethod method;
+    int SockIDorError;
+
+    SockIDorError = sl_Socket(SL_AF_INET, SL_SOCK_STREAM, SL_SEC_SOCKET);
+    if (SockIDorError < 0)
+    {
+        return SockIDorError;
+    }
+    method.secureMethod = SL_SO_SEC_METHOD_TLSV1_2;
+    if (sl_SetSockOpt(SockIDorError, SL_SOL_SOCKET, SL_SO_SECMETHOD,
+                      &method, sizeof(method)) < 0 ||
+        sl_SetSockOpt(SockIDorError, SL_SOL_SOCKET, SL_SO_SECURE_FILES_CA_FILE_NAME,
+                      EXOPAL_TLS_CA_FILE, sizeof(EXOPAL_TLS_CA_FILE) - 1) < 0)
+    {
+        close(SockIDorError);
+        return -1;
+    }
+    return SockIDorError;
+#else
+    return sl_Socket(SL_AF_INET,SL_SOCK_STREAM, 0);
+#endif
+}
+
+/*!
+ * \brief Opens a new tcp socket to Exosite
  *
- * \sa exoPal_tcpSocketClose
+ * \return 0 if successful, else error code
  */
-uint8_t exoPal_tcpSocketOpen()
+static uint8_t exoPal_tcpSocketConnect(exoPal_socket_t * sock)
 {
     int SockIDorError = 0;
     int LenorError = 0;
@@ -146,14 +504,14 @@ uint8_t exoPal_tcpSocketOpen()
     int AddrSize;
 
     Addr.sin_family = SL_AF_INET;
-    Addr.sin_port = sl_Htons(80);
+    Addr.sin_port = sl_Htons(EXOSITE_PORT);
 
     //Change the DestinationIP endianity , to big endian
-    Addr.sin_addr.s_addr = sl_Htonl(ip);
+    Addr.sin_addr.s_addr = sl_Htonl(exoPal_getServerIp());
 
     AddrSize = sizeof(SlSockAddrIn_t);
 
-    SockIDorError = sl_Socket(SL_AF_INET,SL_SOCK_STREAM, 0);
+    SockIDorError = exoPal_createSocket();
     if( SockIDorError < 0 )
     {
         //CLI_Write((unsigned char *)"Error creating socket\n\r\n\r");
@@ -163,68 +521,179 @@ uint8_t exoPal_tcpSocketOpen()
 
 
     LenorError = sl_Connect(SockIDorError, ( SlSockAddr_t *)&Addr, AddrSize);
+    if (LenorError == SL_ESECSNOVERIFY)
+    {
+        // the socket is connected, but the server couldn't be verified
+        // against EXOPAL_TLS_CA_FILE, most likely because the file is
+        // missing.  Drop it so the CIK isn't sent to an unverified server
+        close(SockIDorError);
+        exoPal_connectResult(1);
+        return 2;
+    }
     if( LenorError < 0 )
     {
         // error
         //CLI_Write((unsigned char *)"Error connecting to socket\n\r\n\r");
 		//UARTprintf("Error connecting to socket\n\r\n\r");
+        close(SockIDorError);
+        exoPal_connectResult(1);
         return 2;
     }
-    curSocketID = SockIDorError;
+    exoPal_connectResult(0);
+    sock->id = SockIDorError;
+    sock->stats.opened++;
 
     //
     // Set Timeout on Socket
     //
-    struct SlTimeval_t timeVal;
-    timeVal.tv_sec =  2;             // Seconds
-    timeVal.tv_usec = 0;             // Microseconds. 10000 microseconds resolution
-    sl_SetSockOpt(SockIDorError,     // Enable receive timeout
-    		      SL_SOL_SOCKET,
-    		      SL_SO_RCVTIMEO,
-    		      (_u8 *)&timeVal,
-    		      sizeof(timeVal));
+    exoPal_applyRecvTimeout(sock);
 
     return 0; //success, connection created
 }
 
+/*!
+ * \brief Opens a tcp socket
+ *
+ * Reuses the kept-alive socket if there is one that hasn't timed out and
+ * hasn't been closed by the server, otherwise opens a new one.
+ *
+ * \return 0 if successful, else error code
+ *
+ * \sa exoPal_tcpSocketClose, exoPal_tcpSocketRelease
+ */
+uint8_t exoPal_tcpSocketOpen(exoPal_socket_t * sock)
+{
+    sock->requestBytesSent = 0;
+    sock->isReused = 0;
+    sock->txLength = 0;
+
+    exoPal_socketService(sock);
+    if (sock->id >= 0)
+    {
+        if (!sock->isConnectPending && exoPal_isSocketAlive(sock))
+        {
+            sock->isReused = 1;
+            sock->stats.reused++;
+            exoPal_setNonBlocking(sock, 0);
+            return 0;
+        }
+        // server closed the connection while it was idle
+        exoPal_tcpSocketClose(sock);
+        sock->stats.reopened++;
+    }
+
+    return exoPal_tcpSocketConnect(sock);
+}
+
+
+
+
+/*!
+ * \brief Sends the staged request bytes to the open tcp socket
+ *
+ * If the first bytes of a request can't be sent on a reused socket, the
+ * connection is reopened and the buffer sent again.
+ *
+ * \param[in] buffer Data to send
+ * \param[in] len Length of data to send
+ *
+ * \return 0 if successful, else error code
+ */
+static uint8_t exoPal_socketSend(exoPal_socket_t * sock, const char * buffer, uint16_t len)
+{
+    int32_t writeStatus;
+    uint16_t sent = 0;
+
+    while (sent < len)
+    {
+        writeStatus = sl_Send(sock->id, &buffer[sent], len - sent, 0);
+        if ((writeStatus <= 0) && sock->isReused && (sock->requestBytesSent == 0))
+        {
+            // stale keep-alive connection, reconnect and try again
+            exoPal_tcpSocketClose(sock);
+            sock->isReused = 0;
+            sock->stats.reopened++;
+            if (exoPal_tcpSocketConnect(sock) != 0)
+            {
+                return 1;
+            }
+            continue;
+        }
+        if (writeStatus <= 0)
+        {
+            // error
+            exoPal_tcpSocketClose(sock);
+            return 1;
+        }
+        sent += writeStatus;
+        sock->requestBytesSent += writeStatus;
+    }
 
+    return 0;
+}
 
 
 /*!
  * \brief Sends data to the open tcp socket
  *
- * Write data out to the currently open socket
+ * Appends data to the request being assembled for the currently open socket.
+ * The data is staged in an MSS sized buffer that is only sent when it fills
+ * up or when exoPal_sendingComplete is called, so the pieces of a request
+ * go out in as few sl_Send calls as possible.
  *
  * \param[in] buffer Data to write to socket
  * \param[in] len Length of data to write to socket
  *
- * \sa exoPal_socketRead
+ * \sa exoPal_socketRead, exoPal_sendingComplete
  *
  * \return 0 if successful, else error code
  */
-uint8_t exoPal_socketWrite( const char * buffer, uint16_t len)
+uint8_t exoPal_socketWrite(exoPal_socket_t * sock, const char * buffer, uint16_t len)
 {
-    int32_t writeStatus;
+#if EXOPAL_TX_STAGING
+    uint16_t chunk;
+#endif
+
     // check if socket is open
-    if (curSocketID < 0)
+    if (sock->id < 0)
     {
         return 1;
     }
-    writeStatus = sl_Send(curSocketID,buffer,len,0);
-    if( writeStatus <= 0 )
+#if EXOPAL_TX_STAGING
+    while (len > 0)
     {
-        // error
-        return 1;
+        chunk = EXOPAL_TX_BUFFER_SIZE - sock->txLength;
+        if (chunk > len)
+        {
+            chunk = len;
+        }
+        memcpy(&sock->txBuffer[sock->txLength], buffer, chunk);
+        sock->txLength += chunk;
+        buffer += chunk;
+        len -= chunk;
+
+        if (sock->txLength == EXOPAL_TX_BUFFER_SIZE)
+        {
+            chunk = sock->txLength;
+            sock->txLength = 0;
+            if (exoPal_socketSend(sock, sock->txBuffer, chunk) != 0)
+            {
+                return 1;
+            }
+        }
     }
-
     return 0;
+#else
+    return exoPal_socketSend(sock, buffer, len);
+#endif
 }
 
 
 /*!
  * \brief
  *
- * Reads data from a socket, into \a buffer
+ * Reads data from a socket, into \a buffer.  The data is null terminated so
+ * at most bufferSize - 1 bytes are read.
  *
  * \param[in] bufferSize Size of buffer
  * \param[out] buffer Buffer received data will be written to
@@ -235,55 +704,259 @@ uint8_t exoPal_socketWrite( const char * buffer, uint16_t len)
  *
  * \note len must be greater than sizeof(buffer)
  *
- * \return 0 if successful, else error code
+ * \return 0 if successful, else EXOPAL_READ_ERROR, EXOPAL_READ_TIMEOUT or
+ *         EXOPAL_READ_CLOSED; the socket is closed on any of them
  */
-uint8_t exoPal_socketRead( char * buffer, uint16_t bufferSize, uint16_t * responseLength)
+uint8_t exoPal_socketRead(exoPal_socket_t * sock, char * buffer, uint16_t bufferSize, uint16_t * responseLength)
 {
-    if (curSocketID < 0)
+    int32_t readStatus;
+
+    *responseLength = 0;
+    buffer[0] = '\0';
+    if (sock->id < 0)
     {
-        return 1;
+        return EXOPAL_READ_ERROR;
     }
 
-    *responseLength = recv(curSocketID, buffer, bufferSize,0);
     // read from socket
+    readStatus = recv(sock->id, buffer, bufferSize - 1, 0);
+    if (readStatus <= 0)
+    {
+        exoPal_tcpSocketClose(sock);
+        if (readStatus == 0)
+        {
+            return EXOPAL_READ_CLOSED;
+        }
+        // SL_SO_RCVTIMEO expired
+        return readStatus == SL_EAGAIN ? EXOPAL_READ_TIMEOUT : EXOPAL_READ_ERROR;
+    }
+    buffer[readStatus] = '\0';
+    *responseLength = readStatus;
     return 0;
 
 }
 
 
+/*!
+ * \brief Opens a tcp socket without blocking
+ *
+ * Non-blocking version of exoPal_tcpSocketOpen.  Call it again while it
+ * returns EXOPAL_ASYNC_PENDING.  The socket is left in non-blocking mode for
+ * exoPal_socketSendAsync and exoPal_socketReadAsync, exoPal_tcpSocketOpen
+ * switches it back.
+ *
+ * \return EXOPAL_ASYNC_DONE once connected
+ *
+ * \sa exoPal_tcpSocketOpen
+ */
+EXOPAL_ASYNC exoPal_tcpSocketOpenAsync(exoPal_socket_t * sock)
+{
+    SlSockAddrIn_t Addr;
+    int SockIDorError;
+    int LenorError;
+
+    if (!sock->isConnectPending)
+    {
+        sock->requestBytesSent = 0;
+        sock->isReused = 0;
+        sock->txLength = 0;
+
+        exoPal_socketService(sock);
+        if (sock->id >= 0)
+        {
+            if (exoPal_isSocketAlive(sock))
+            {
+                sock->isReused = 1;
+                sock->stats.reused++;
+                exoPal_setNonBlocking(sock, 1);
+                return EXOPAL_ASYNC_DONE;
+            }
+            // server closed the connection while it was idle
+            exoPal_tcpSocketClose(sock);
+            sock->stats.reopened++;
+        }
+
+        SockIDorError = exoPal_createSocket();
+        if (SockIDorError < 0)
+        {
+            return EXOPAL_ASYNC_ERROR;
+        }
+        sock->id = SockIDorError;
+        exoPal_setNonBlocking(sock, 1);
+        sock->isConnectPending = 1;
+        sock->connectIp = exoPal_getServerIp();
+    }
+
+    Addr.sin_family = SL_AF_INET;
+    Addr.sin_port = sl_Htons(EXOSITE_PORT);
+    Addr.sin_addr.s_addr = sl_Htonl(sock->connectIp);
+
+    // keeps returning SL_EALREADY until the tcp, and with EXOPAL_TLS the
+    // TLS, handshake completes
+    LenorError = sl_Connect(sock->id, (SlSockAddr_t *)&Addr, sizeof(SlSockAddrIn_t));
+    if (LenorError == SL_EALREADY)
+    {
+        return EXOPAL_ASYNC_PENDING;
+    }
+    // includes SL_ESECSNOVERIFY, see exoPal_tcpSocketConnect
+    if (LenorError < 0)
+    {
+        exoPal_tcpSocketClose(sock);
+        exoPal_connectResult(1);
+        return EXOPAL_ASYNC_ERROR;
+    }
+    exoPal_connectResult(0);
+    sock->isConnectPending = 0;
+    sock->stats.opened++;
+    return EXOPAL_ASYNC_DONE;
+}
+
+/*!
+ * \brief Sends data without blocking
+ *
+ * Sends as much of buffer, from \a sent on, as the socket takes right now.
+ *
+ * \param[in] buffer Data to send
+ * \param[in] len Length of data to send
+ * \param[in,out] sent Bytes of buffer already sent, updated
+ *
+ * \return EXOPAL_ASYNC_DONE once all of buffer is sent
+ */
+EXOPAL_ASYNC exoPal_socketSendAsync(exoPal_socket_t * sock, const char * buffer, uint16_t len, uint16_t * sent)
+{
+    int32_t writeStatus;
+
+    while (*sent < len)
+    {
+        writeStatus = sl_Send(sock->id, &buffer[*sent], len - *sent, 0);
+        if (writeStatus == SL_EAGAIN)
+        {
+            return EXOPAL_ASYNC_PENDING;
+        }
+        if (writeStatus <= 0)
+        {
+            exoPal_tcpSocketClose(sock);
+            return EXOPAL_ASYNC_ERROR;
+        }
+        *sent += writeStatus;
+        sock->requestBytesSent += writeStatus;
+    }
+    return EXOPAL_ASYNC_DONE;
+}
+
+/*!
+ * \brief Reads whatever data has arrived without blocking
+ *
+ * Like exoPal_socketRead, \a buffer is null terminated.
+ *
+ * \param[out] buffer Buffer received data will be placed in
+ * \param[in] bufSize Size of buffer
+ * \param[out] responseLength Number of bytes read
+ *
+ * \return EXOPAL_ASYNC_DONE if data was read, EXOPAL_ASYNC_PENDING if none
+ *         has arrived, EXOPAL_ASYNC_ERROR if the socket was closed
+ */
+EXOPAL_ASYNC exoPal_socketReadAsync(exoPal_socket_t * sock, char * buffer, uint16_t bufSize, uint16_t * responseLength)
+{
+    int32_t readStatus;
+
+    *responseLength = 0;
+    buffer[0] = '\0';
+    if (sock->id < 0)
+    {
+        return EXOPAL_ASYNC_ERROR;
+    }
+
+    readStatus = sl_Recv(sock->id, buffer, bufSize - 1, 0);
+    if (readStatus == SL_EAGAIN)
+    {
+        return EXOPAL_ASYNC_PENDING;
+    }
+    if (readStatus <= 0)
+    {
+        // error or closed by the server
+        exoPal_tcpSocketClose(sock);
+        return EXOPAL_ASYNC_ERROR;
+    }
+    buffer[readStatus] = '\0';
+    *responseLength = readStatus;
+    return EXOPAL_ASYNC_DONE;
+}
+
+
 /*!
 * @brief Used to do any operations before
 *
-* @note unused on this platform
+* Sends whatever is left of the request staged by exoPal_socketWrite.
 *
 *
 * @return 0 if successful
 */
-int32_t exoPal_sendingComplete()
+int32_t exoPal_sendingComplete(exoPal_socket_t * sock)
 {
-	return 0;
+    uint16_t len = sock->txLength;
+
+    if (len == 0)
+    {
+        return 0;
+    }
+    sock->txLength = 0;
+    if (sock->id < 0)
+    {
+        return 1;
+    }
+	return exoPal_socketSend(sock, sock->txBuffer, len);
 }
 
 
+/*!
+ * \brief Builds the NVM file name of a CIK slot
+ *
+ * Slot 0 keeps the original file name so devices provisioned before slots
+ * existed keep their CIK.
+ *
+ * \param[in] slot CIK slot
+ * \param[out] fileName At least sizeof(CIK_FILENAME_SLOT) chars
+ */
+static void exoPal_cikFileName(uint8_t slot, char * fileName)
+{
+    if (slot == 0)
+    {
+        memcpy(fileName, CIK_FILENAME, sizeof(CIK_FILENAME));
+        return;
+    }
+    memcpy(fileName, CIK_FILENAME_SLOT, sizeof(CIK_FILENAME_SLOT));
+    fileName[CIK_FILENAME_SLOT_DIGIT] = '0' + slot;
+}
+
 /*!
  * \brief Sets the cik
  *
- * Writes the 40 chars starting at cik* to nvm.
+ * Writes the 40 chars starting at cik* to nvm.  Each slot is a separate
+ * file, so a gateway can keep one CIK per device identity it relays for.
  *
+ * \param[in] slot CIK slot, 0 to EXOPAL_CIK_SLOTS - 1
  * \param[in] cik cik to write to nvm
  *
  * \return 0 if successful, else error code
  */
-uint8_t exoPal_setCik(const char * cik)
+uint8_t exoPal_setCik(uint8_t slot, const char * cik)
 {
 	int iRetVal;
 	long lFileHandle;
 	unsigned long ulToken;
+	char fileName[sizeof(CIK_FILENAME_SLOT)];
+
+	if (slot >= EXOPAL_CIK_SLOTS)
+	{
+		return 3;
+	}
+	exoPal_cikFileName(slot, fileName);
 
 	//
 	// open the cik file for writing
 	//
-	iRetVal = sl_FsOpen((unsigned char *) CIK_FILENAME,
+	iRetVal = sl_FsOpen((unsigned char *) fileName,
 			            FS_MODE_OPEN_CREATE(CIK_LENGTH, _FS_FILE_OPEN_FLAG_COMMIT|_FS_FILE_PUBLIC_WRITE|_FS_FILE_PUBLIC_READ),
 	                    &ulToken,
 	                    &lFileHandle);
@@ -320,20 +993,28 @@ uint8_t exoPal_setCik(const char * cik)
  * The CIK must persist through power cycles and therefore must be in some
  * sort of NVM
  *
+ * \param[in] slot CIK slot, 0 to EXOPAL_CIK_SLOTS - 1
  * \param[out] read_buffer Buffer to write data to, must be at least 40 chars wide
  *
  * \return 0 if successful, else error code
  */
-uint8_t exoPal_getCik(char * read_buffer)
+uint8_t exoPal_getCik(uint8_t slot, char * read_buffer)
 {
     unsigned long ulToken;
     long lFileHandle;
     long lRetVal = -1;
+    char fileName[sizeof(CIK_FILENAME_SLOT)];
+
+    if (slot >= EXOPAL_CIK_SLOTS)
+    {
+        return 4;
+    }
+    exoPal_cikFileName(slot, fileName);
 
     //
     // open a the cik file for reading
     //
-    lRetVal = sl_FsOpen((unsigned char *) CIK_FILENAME,
+    lRetVal = sl_FsOpen((unsigned char *) fileName,
                         FS_MODE_OPEN_READ,
                         &ulToken,
                         &lFileHandle);
@@ -435,6 +1116,193 @@ uint8_t exoPal_getUuid(char * read_buffer)
     return 0;
 }
 
+/*!
+ * \brief Builds the file name of spill file \a index
+ */
+static void exoPal_spillFileName(uint8_t index, char * fileName)
+{
+    memcpy(fileName, SPILL_FILENAME, sizeof(SPILL_FILENAME));
+    fileName[SPILL_FILENAME_DIGIT] = '0' + index;
+}
+
+/*!
+ * \brief Closes spill file \a index, if open, and optionally deletes it
+ */
+static void exoPal_spillClose(uint8_t index, uint8_t isDelete)
+{
+    exoPal_spillFile_t * file = &spillFiles[index];
+    char fileName[sizeof(SPILL_FILENAME)];
+
+    if (file->mode == SPILL_WRITING || file->mode == SPILL_READING)
+    {
+        sl_FsClose(file->handle, 0, 0, 0);
+    }
+    file->mode = SPILL_CLOSED;
+    if (isDelete)
+    {
+        exoPal_spillFileName(index, fileName);
+        sl_FsDel((unsigned char *) fileName, 0);
+        file->mode = SPILL_FREE;
+    }
+}
+
+/*!
+ * \brief Appends to the spill on the serial flash
+ *
+ * Appends must keep working while a drain is pending, i.e. after
+ * exoPal_spillRead but before the data read has been released, or a server
+ * that is down would lose every sample that overflows RAM.  So once a read
+ * reaches the file being appended to, appends continue in a second file.
+ *
+ * \param[in] offset Where to write, the current end of the spill
+ * \param[in] data Data to write
+ * \param[in] length Length of data
+ *
+ * \return 0 if successful, else error code
+ */
+uint8_t exoPal_spillWrite(uint32_t offset, const char * data, uint16_t length)
+{
+    exoPal_spillFile_t * file = &spillFiles[spillCurrent];
+    char fileName[sizeof(SPILL_FILENAME)];
+    unsigned long ulToken;
+    long lRetVal;
+
+    if (file->mode == SPILL_CLOSED || file->mode == SPILL_READING)
+    {
+        // being drained, start the other file
+        if (spillFiles[!spillCurrent].mode != SPILL_FREE)
+        {
+            return 3;
+        }
+        spillCurrent = !spillCurrent;
+        file = &spillFiles[spillCurrent];
+    }
+    if (file->mode == SPILL_FREE)
+    {
+        exoPal_spillFileName(spillCurrent, fileName);
+        sl_FsDel((unsigned char *) fileName, 0);
+        lRetVal = sl_FsOpen((unsigned char *) fileName,
+                            FS_MODE_OPEN_CREATE(EXOPAL_SPILL_FILE_SIZE, _FS_FILE_PUBLIC_WRITE|_FS_FILE_PUBLIC_READ),
+                            &ulToken,
+                            &file->handle);
+        if (lRetVal < 0)
+        {
+            return 2;
+        }
+        file->mode = SPILL_WRITING;
+        file->base = offset;
+        file->end = offset;
+    }
+    if (offset != file->end || offset - file->base + length > EXOPAL_SPILL_FILE_SIZE)
+    {
+        return 1;
+    }
+
+    lRetVal = sl_FsWrite(file->handle,
+                         (unsigned int)(offset - file->base),
+                         (unsigned char *)data,
+                         length);
+    if (lRetVal != length)
+    {
+        return 4;
+    }
+    file->end += length;
+    return 0;
+}
+
+/*!
+ * \brief Reads back from the spill on the serial flash
+ *
+ * Reading from the file still being appended to closes it for writing, which
+ * is only possible once the other file has been released.
+ *
+ * \param[in] offset Where to read from
+ * \param[out] data Buffer to read into
+ * \param[in] length Number of bytes to read
+ *
+ * \return 0 if successful, 3 if it can't be read until the data before it
+ *         has been released, else error code
+ */
+uint8_t exoPal_spillRead(uint32_t offset, char * data, uint16_t length)
+{
+    uint8_t index = !spillCurrent;
+    exoPal_spillFile_t * file = &spillFiles[index];
+    char fileName[sizeof(SPILL_FILENAME)];
+    unsigned long ulToken;
+    long lRetVal;
+
+    if (file->mode == SPILL_FREE || offset < file->base || offset >= file->end)
+    {
+        index = spillCurrent;
+        file = &spillFiles[index];
+    }
+    if (file->mode == SPILL_FREE || offset < file->base || offset + length > file->end)
+    {
+        return 1;
+    }
+
+    if (file->mode == SPILL_WRITING)
+    {
+        if (spillFiles[!index].mode != SPILL_FREE)
+        {
+            return 3;
+        }
+        exoPal_spillClose(index, 0);
+    }
+    if (file->mode == SPILL_CLOSED)
+    {
+        exoPal_spillFileName(index, fileName);
+        lRetVal = sl_FsOpen((unsigned char *) fileName,
+                            FS_MODE_OPEN_READ,
+                            &ulToken,
+                            &file->handle);
+        if (lRetVal < 0)
+        {
+            return 1;
+        }
+        file->mode = SPILL_READING;
+    }
+
+    lRetVal = sl_FsRead(file->handle,
+                        (unsigned int)(offset - file->base),
+                        (unsigned char *)data,
+                        length);
+    if (lRetVal != length)
+    {
+        return 2;
+    }
+    return 0;
+}
+
+/*!
+ * \brief Deletes the spill files that only hold data before \a offset
+ *
+ * \param[in] offset Everything before it has been drained and won't be read
+ */
+void exoPal_spillRelease(uint32_t offset)
+{
+    uint8_t index;
+
+    for (index = 0; index < 2; index++)
+    {
+        if (spillFiles[index].mode != SPILL_FREE && spillFiles[index].mode != SPILL_WRITING &&
+            spillFiles[index].end <= offset)
+        {
+            exoPal_spillClose(index, 1);
+        }
+    }
+}
+
+/*!
+ * \brief Closes and deletes the spill files
+ */
+void exoPal_spillReset()
+{
+    exoPal_spillClose(0, 1);
+    exoPal_spillClose(1, 1);
+    spillCurrent = 0;
+}
+
 /*!
  * \brief memcpy implementation
  */
@@ -38,28 +38,161 @@
 #include <stdint.h>
 
 
-/*!< This defines the size of the rx buffer in the PAL.  This buffer is used
-   to place incoming data from the modem in.*/
+/*!< This defines the size of the rx buffer of each exosite_ctx_t.  This
+   buffer is used to place incoming data from the modem in.*/
 #define RX_BUFFER_SIZE                         512
 
-extern char exoPal_rxBuffer[RX_BUFFER_SIZE];
-
 // defines
 
+/*!< Rate, in Hz, at which the application calls exoPal_tick.  This is the
+   time base for the keep-alive idle timeout.*/
+#define EXOPAL_TICK_HZ                         300
+
+/*!< Default time, in ms, an idle connection to Exosite is kept open for
+   reuse.  Can be changed at run time with exoPal_setKeepAliveTimeout.*/
+#define EXOPAL_KEEPALIVE_TIMEOUT_MS            30000
+
+/*!< Default time, in ms, exoPal_socketRead waits for data.  Can be changed
+   at run time with exoPal_setRecvTimeout, e.g. for long-poll requests.*/
+#define EXOPAL_RECV_TIMEOUT_MS                 2000
+
+/*!< Size of the staging buffer exoPal_socketWrite assembles requests in,
+   one per exoPal_socket_t.  One TCP MSS, so a typical request goes out in a
+   single sl_Send.*/
+#define EXOPAL_TX_BUFFER_SIZE                  1460
+
+/*!< Set to 0 to send every exoPal_socketWrite straight to the socket
+   instead of staging it.  Only useful to compare the SPI cost of the two.*/
+#ifndef EXOPAL_TX_STAGING
+#define EXOPAL_TX_STAGING                      1
+#endif
+
+/*!< Number of CIKs that can be kept in NVM, one per device identity, see
+   exoPal_setCik.*/
+#define EXOPAL_CIK_SLOTS                       4
+
+/*!< How long, in ms, a looked up server address is used before it is looked
+   up again.  SimpleLink doesn't report the record's TTL, so this stands in
+   for it.*/
+#define EXOPAL_DNS_TTL_MS                      300000
+
+/*!< exoPal_dnsService refreshes the server address this long, in ms, before
+   it expires, so connects don't have to wait for the lookup.*/
+#define EXOPAL_DNS_REFRESH_MS                  60000
+
+/*!< Time, in ms, to wait after a failed lookup before trying again.  The last
+   address that was looked up keeps being used meanwhile.*/
+#define EXOPAL_DNS_RETRY_MS                    10000
+
+/*!< Connects in a row that may fail before the server address is looked up
+   again, in case the server moved.*/
+#define EXOPAL_DNS_MAX_CONNECT_FAILURES        3
+
+/*!< Set to 1 to connect to Exosite with TLS 1.2 on port 443 instead of
+   plain HTTP on port 80.  The NWP runs the handshake, so a kept-alive
+   connection is what saves repeating it.*/
+#ifndef EXOPAL_TLS
+#define EXOPAL_TLS                             0
+#endif
+
+/*!< CA certificate, DER, in the serial flash that the server is verified
+   against when EXOPAL_TLS is set.*/
+#define EXOPAL_TLS_CA_FILE                     "/cert/exosite_ca.der"
+
+/*!< Largest size, in bytes, of each of the two spill files on the serial
+   flash that exoPal_spillWrite appends to.*/
+#define EXOPAL_SPILL_FILE_SIZE                 16384
+
+/*!< exoPal_socketRead errors*/
+#define EXOPAL_READ_ERROR                      1   /*!< not connected, or a socket error */
+#define EXOPAL_READ_TIMEOUT                    2   /*!< nothing arrived within the receive timeout */
+#define EXOPAL_READ_CLOSED                     3   /*!< closed by the server */
+
+/*!
+ * Result of a non-blocking socket call.
+ */
+typedef enum EXOPAL_ASYNC_tag
+{
+    EXOPAL_ASYNC_DONE,      /*!< finished, or data was read */
+    EXOPAL_ASYNC_PENDING,   /*!< would block, call again later */
+    EXOPAL_ASYNC_ERROR      /*!< failed, the socket has been closed */
+}EXOPAL_ASYNC;
+
+/*!
+ * Connection reuse counters, see exoPal_getConnStats.
+ */
+typedef struct exoPal_connStats_tag
+{
+    uint32_t opened;      /*!< sockets opened, one TCP handshake each */
+    uint32_t reused;      /*!< requests sent on an already open socket */
+    uint32_t reopened;    /*!< reconnects after a server close or send error */
+    uint32_t idleClosed;  /*!< sockets closed by the idle timeout */
+}exoPal_connStats_t;
+
+/*!
+ * Server address cache counters, see exoPal_getDnsStats.
+ */
+typedef struct exoPal_dnsStats_tag
+{
+    uint32_t lookups;     /*!< DNS lookups made */
+    uint32_t failures;    /*!< lookups that failed */
+    uint32_t stale;       /*!< connects made with an expired or invalidated address */
+    uint32_t invalidated; /*!< times the address was dropped after failed connects */
+}exoPal_dnsStats_t;
+
+/*!
+ * One connection to Exosite and its keep-alive state.  Each exosite_ctx_t
+ * has its own, so several can be open at once.  Initialize with
+ * exoPal_socketInit.
+ */
+typedef struct exoPal_socket_tag
+{
+    int32_t id;                     /*!< socket, negative if none is open */
+    uint8_t isReused;               /*!< kept alive from a previous request */
+    uint8_t isNonBlocking;          /*!< see exoPal_tcpSocketOpenAsync */
+    uint8_t isConnectPending;       /*!< a non-blocking connect is in progress */
+    uint32_t connectIp;             /*!< address the pending connect goes to */
+    void * tls;                     /*!< TLS connection of PALs that run TLS themselves */
+    uint32_t requestBytesSent;      /*!< bytes sent for the current request */
+    uint32_t lastActivityMs;        /*!< time the socket was last released */
+    uint32_t keepAliveTimeoutMs;    /*!< see exoPal_setKeepAliveTimeout */
+    uint32_t recvTimeoutMs;         /*!< see exoPal_setRecvTimeout */
+    exoPal_connStats_t stats;
+    uint16_t txLength;
+    char txBuffer[EXOPAL_TX_BUFFER_SIZE]; /*!< request staged by exoPal_socketWrite */
+}exoPal_socket_t;
+
 
 // functions for export
 void exoPal_init();
-uint8_t exoPal_setCik(const char * read_buffer);
-uint8_t exoPal_getCik(char * read_buffer);
+uint8_t exoPal_setCik(uint8_t slot, const char * read_buffer);
+uint8_t exoPal_getCik(uint8_t slot, char * read_buffer);
 uint8_t exoPal_getModel(char * read_buffer);
 uint8_t exoPal_getVendor(char * read_buffer);
 uint8_t exoPal_getUuid(char * read_buffer);
+uint8_t exoPal_spillWrite(uint32_t offset, const char * data, uint16_t length);
+uint8_t exoPal_spillRead(uint32_t offset, char * data, uint16_t length);
+void exoPal_spillRelease(uint32_t offset);
+void exoPal_spillReset();
 
-uint8_t exoPal_tcpSocketClose();
-uint8_t exoPal_tcpSocketOpen();
-uint8_t exoPal_socketRead( char * buffer, uint16_t bufSize, uint16_t * responseLength);
-uint8_t exoPal_socketWrite( const char * buffer, uint16_t len);
-int32_t exoPal_sendingComplete( );
+void exoPal_socketInit(exoPal_socket_t * sock);
+uint8_t exoPal_tcpSocketClose(exoPal_socket_t * sock);
+uint8_t exoPal_tcpSocketOpen(exoPal_socket_t * sock);
+uint8_t exoPal_tcpSocketRelease(exoPal_socket_t * sock, uint8_t keepAlive);
+void exoPal_socketService(exoPal_socket_t * sock);
+void exoPal_setKeepAliveTimeout(exoPal_socket_t * sock, uint32_t timeoutMs);
+void exoPal_setRecvTimeout(exoPal_socket_t * sock, uint32_t timeoutMs);
+void exoPal_getConnStats(const exoPal_socket_t * sock, exoPal_connStats_t * stats);
+void exoPal_dnsService();
+void exoPal_getDnsStats(exoPal_dnsStats_t * stats);
+void exoPal_tick();
+uint32_t exoPal_getTimeMs();
+uint8_t exoPal_socketRead(exoPal_socket_t * sock, char * buffer, uint16_t bufSize, uint16_t * responseLength);
+EXOPAL_ASYNC exoPal_tcpSocketOpenAsync(exoPal_socket_t * sock);
+EXOPAL_ASYNC exoPal_socketSendAsync(exoPal_socket_t * sock, const char * buffer, uint16_t len, uint16_t * sent);
+EXOPAL_ASYNC exoPal_socketReadAsync(exoPal_socket_t * sock, char * buffer, uint16_t bufSize, uint16_t * responseLength);
+uint8_t exoPal_socketWrite(exoPal_socket_t * sock, const char * buffer, uint16_t len);
+int32_t exoPal_sendingComplete(exoPal_socket_t * sock);
 
 uint8_t exoPal_itoa(int value, char* str, uint8_t radix);
 int32_t exoPal_atoi(char* val);
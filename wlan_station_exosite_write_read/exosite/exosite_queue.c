@@ -0,0 +1,679 @@
+/*****************************************************************************
+*
+*  exosite_queue.c - Store-and-forward queue of Exosite samples
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+#include "exosite_pal.h"
+#include "exosite_rpc.h"
+#include "exosite_clock.h"
+#include "exosite_queue.h"
+
+/*!
+ * A queued sample, as held in RAM and in the spill file.
+ */
+typedef struct exoQueue_sample_tag
+{
+    uint32_t timeMs;    /*!< when it was pushed, see exoPal_getTimeMs */
+    uint16_t length;
+    char data[EXOQUEUE_SAMPLE_SIZE];
+}exoQueue_sample_t;
+
+// RAM ring, oldest sample at ramHead
+static exoQueue_sample_t ring[EXOQUEUE_RAM_SAMPLES];
+static uint8_t ramHead = 0;
+static uint8_t ramCount = 0;
+
+// the spill file holds the samples older than any in RAM, from
+// spillReadOffset up to spillWriteOffset
+static uint32_t spillReadOffset = 0;
+static uint32_t spillWriteOffset = 0;
+
+// a sample read back from the spill file, kept while the batch it's in is
+// written out so it's only read once per pass
+static exoQueue_sample_t spillSample;
+static uint32_t spillSampleOffset = 0;
+static uint8_t hasSpillSample = 0;
+
+// the batch being drained: the RAM samples grouped into it, the time their
+// timestamps are worked out from, and whether a spilled sample couldn't be
+// read back while the request was written
+static uint16_t groupCount = 0;
+static uint32_t batchNowMs = 0;
+static uint8_t batchUnreadable = 0;
+
+static exoQueue_stats_t stats;
+
+// local functions
+static uint16_t exoQueue_spillDepth();
+static exoQueue_sample_t * exoQueue_peek(uint16_t index);
+static int32_t exoQueue_timestamp(const exoQueue_sample_t * sample, uint32_t nowMs);
+static uint16_t exoQueue_queueGrouped(uint16_t count, uint32_t nowMs, uint8_t * failed);
+static uint16_t exoQueue_queueEach(uint32_t nowMs, uint8_t * failed);
+static void exoQueue_pop(uint16_t count);
+static void exoQueue_writeGroup(exoJson_writer_t * writer, const char * alias, void * context);
+static void exoQueue_writeSpilled(exoJson_writer_t * writer, const char * alias, void * context);
+static void exoQueue_recordDone(void * context, const char * alias,
+                                EXORPC_STATUS status, const char * value, uint16_t length);
+
+
+/*!
+ * \brief  Empties the queue
+ *
+ * Samples are timestamped with exoPal_getTimeMs, which restarts at boot, so
+ * any spill file left from before is deleted.
+ */
+void exoQueue_init()
+{
+    ramHead = 0;
+    ramCount = 0;
+    spillReadOffset = 0;
+    spillWriteOffset = 0;
+    hasSpillSample = 0;
+    exoPal_spillReset();
+}
+
+
+/*!
+ * \brief  Queues a sample, stamped with the current time
+ *
+ * If RAM is full the oldest sample is moved to the spill file.  If that fails
+ * too, it's dropped.
+ *
+ * \param[in] data Sample in urlencoded "alias=value&..." form
+ * \param[in] length Length of data
+ *
+ * \return 0 if queued, -1 if it's longer than EXOQUEUE_SAMPLE_SIZE
+ */
+int8_t exoQueue_push(const char * data, uint16_t length)
+{
+    exoQueue_sample_t * sample;
+
+    if (length > EXOQUEUE_SAMPLE_SIZE)
+    {
+        stats.dropped++;
+        return -1;
+    }
+
+    if (ramCount == EXOQUEUE_RAM_SAMPLES)
+    {
+        if (exoPal_spillWrite(spillWriteOffset, (const char *)&ring[ramHead],
+                              sizeof(exoQueue_sample_t)) == 0)
+        {
+            spillWriteOffset += sizeof(exoQueue_sample_t);
+            stats.spillBytes += sizeof(exoQueue_sample_t);
+        }
+        else
+        {
+            // flash full
+            stats.dropped++;
+        }
+        ramHead = (ramHead + 1) % EXOQUEUE_RAM_SAMPLES;
+        ramCount--;
+    }
+
+    sample = &ring[(ramHead + ramCount) % EXOQUEUE_RAM_SAMPLES];
+    sample->timeMs = exoPal_getTimeMs();
+    sample->length = length;
+    exoPal_memcpy(sample->data, data, length);
+    ramCount++;
+
+    return 0;
+}
+
+
+/*!
+ * \brief  Returns the number of samples waiting, in RAM and on the flash
+ */
+uint16_t exoQueue_depth()
+{
+    return ramCount + exoQueue_spillDepth();
+}
+
+
+/*!
+ * \brief  Checks if enough samples are queued to be worth uploading
+ *
+ * \param[in] batchSize Number of samples that make a batch
+ * \param[in] maxLatencyMs Longest a sample should wait
+ *
+ * \return 1 if there are batchSize samples, or the oldest has waited
+ *         maxLatencyMs, else 0
+ */
+uint8_t exoQueue_isDue(uint16_t batchSize, uint32_t maxLatencyMs)
+{
+    exoQueue_sample_t * oldest;
+
+    if (exoQueue_depth() == 0)
+    {
+        return 0;
+    }
+    if (exoQueue_depth() >= batchSize)
+    {
+        return 1;
+    }
+    oldest = exoQueue_peek(0);
+    return (!oldest || exoPal_getTimeMs() - oldest->timeMs >= maxLatencyMs);
+}
+
+
+/*!
+ * \brief  Uploads queued samples, oldest first
+ *
+ * Each request records as many samples as fit in one RPC batch, every value at
+ * the time its sample was pushed, see exoClock_toUnix.  Samples in RAM are grouped into one record
+ * call per alias, samples spilled to the flash take a call per alias each.
+ * Stops at the first request that fails, the samples in it stay queued.
+ *
+ * \param[in] ctx Context to upload on
+ * \param[in] maxRequests Most requests to make
+ *
+ * \return Number of samples uploaded
+ */
+uint16_t exoQueue_drain(exosite_ctx_t * ctx, uint8_t maxRequests)
+{
+    uint16_t drained = 0;
+    uint16_t batchCount;
+    uint32_t startMs;
+    uint8_t failed;
+    uint8_t request;
+
+    for (request = 0; request < maxRequests && exoQueue_depth() > 0; request++)
+    {
+        failed = 0;
+        batchUnreadable = 0;
+        startMs = exoPal_getTimeMs();
+
+        if (exoQueue_spillDepth() > 0)
+        {
+            batchCount = exoQueue_queueEach(startMs, &failed);
+        }
+        else
+        {
+            batchCount = exoQueue_queueGrouped(ramCount, startMs, &failed);
+        }
+
+        if (batchCount == 0)
+        {
+            continue;
+        }
+
+        if (exoRpc_flush(ctx) != 0 || batchUnreadable)
+        {
+            failed = 1;
+        }
+        stats.drainRequests++;
+        stats.drainMs += exoPal_getTimeMs() - startMs;
+        if (failed)
+        {
+            break;
+        }
+
+        exoQueue_pop(batchCount);
+        stats.drained += batchCount;
+        drained += batchCount;
+    }
+
+    return drained;
+}
+
+
+/*!
+ * \brief  Retrieves the queue counters
+ *
+ * \param[out] queueStats Filled with the current counters
+ */
+void exoQueue_getStats(exoQueue_stats_t * queueStats)
+{
+    stats.ramDepth = ramCount;
+    stats.spillDepth = exoQueue_spillDepth();
+    *queueStats = stats;
+}
+
+
+/*!
+ * \brief  Returns the number of samples waiting in the spill file
+ */
+static uint16_t exoQueue_spillDepth()
+{
+    return (spillWriteOffset - spillReadOffset) / sizeof(exoQueue_sample_t);
+}
+
+
+/*!
+ * \brief  Gets a queued sample without removing it
+ *
+ * \param[in] index 0 for the oldest sample
+ *
+ * \return The sample, only valid until the next call, 0 if it can't be read
+ */
+static exoQueue_sample_t * exoQueue_peek(uint16_t index)
+{
+    uint16_t spillDepth = exoQueue_spillDepth();
+    uint32_t offset;
+
+    if (index >= spillDepth)
+    {
+        return &ring[(ramHead + index - spillDepth) % EXOQUEUE_RAM_SAMPLES];
+    }
+
+    offset = spillReadOffset + index * sizeof(exoQueue_sample_t);
+    if (hasSpillSample && spillSampleOffset == offset)
+    {
+        return &spillSample;
+    }
+
+    hasSpillSample = 0;
+    if (exoPal_spillRead(offset, (char *)&spillSample, sizeof(exoQueue_sample_t)) != 0 ||
+        spillSample.length > EXOQUEUE_SAMPLE_SIZE)
+    {
+        return 0;
+    }
+    spillSampleOffset = offset;
+    hasSpillSample = 1;
+    return &spillSample;
+}
+
+
+/*!
+ * \brief  Works out the timestamp to record a sample at
+ *
+ * \return Unix time once the clock is synced, else negative seconds before
+ *         nowMs, at least 1 s
+ */
+static int32_t exoQueue_timestamp(const exoQueue_sample_t * sample, uint32_t nowMs)
+{
+    uint32_t ageSeconds;
+
+    if (exoClock_isSynced())
+    {
+        return exoClock_toUnix(sample->timeMs);
+    }
+
+    ageSeconds = (nowMs - sample->timeMs) / 1000;
+    if (ageSeconds == 0)
+    {
+        ageSeconds = 1;
+    }
+    return -(int32_t)ageSeconds;
+}
+
+
+/*!
+ * \brief  Finds the value of \a alias in a sample
+ *
+ * \param[out] value Start of the urlencoded value
+ * \param[out] valueLength Length of value
+ *
+ * \return 1 if found, else 0
+ */
+static uint8_t exoQueue_findValue(const exoQueue_sample_t * sample,
+                                  const char * alias, uint16_t aliasLength,
+                                  const char ** value, uint16_t * valueLength)
+{
+    uint16_t keyStart = 0;
+    uint16_t i;
+
+    for (i = 0; i <= sample->length; i++)
+    {
+        if (i < sample->length && sample->data[i] != '&')
+        {
+            continue;
+        }
+        if (i - keyStart > aliasLength && sample->data[keyStart + aliasLength] == '=')
+        {
+            uint16_t j;
+            for (j = 0; j < aliasLength && sample->data[keyStart + j] == alias[j]; j++);
+            if (j == aliasLength)
+            {
+                *value = &sample->data[keyStart + aliasLength + 1];
+                *valueLength = i - keyStart - aliasLength - 1;
+                return 1;
+            }
+        }
+        keyStart = i + 1;
+    }
+    return 0;
+}
+
+
+/*!
+ * \brief  Gets the next alias of a sample that has a value
+ *
+ * \param[in,out] offset Where to start looking, moved past the pair found
+ * \param[out] alias Start of the alias
+ * \param[out] aliasLength Length of alias
+ *
+ * \return 1 if found, 0 at the end of the sample
+ */
+static uint8_t exoQueue_nextAlias(const exoQueue_sample_t * sample, uint16_t * offset,
+                                  const char ** alias, uint16_t * aliasLength)
+{
+    uint16_t i = *offset;
+    uint8_t hasValue;
+
+    while (i < sample->length)
+    {
+        *alias = &sample->data[i];
+        while (i < sample->length && sample->data[i] != '=' && sample->data[i] != '&')
+        {
+            i++;
+        }
+        *aliasLength = &sample->data[i] - *alias;
+        hasValue = (i < sample->length && sample->data[i] == '=');
+        while (i < sample->length && sample->data[i] != '&')
+        {
+            i++;
+        }
+        i++;
+        if (hasValue && *aliasLength > 0)
+        {
+            *offset = i;
+            return 1;
+        }
+    }
+    *offset = i;
+    return 0;
+}
+
+
+/*!
+ * \brief  Checks if \a alias, found in \a sample, needs a record call of its
+ *         own
+ *
+ * \param[in] grouped Also look in the RAM samples before \a index
+ *
+ * \return 1 if it's the first time the alias appears, else 0
+ */
+static uint8_t exoQueue_isNewAlias(const exoQueue_sample_t * sample, uint16_t index,
+                                   uint8_t grouped, const char * alias, uint16_t aliasLength)
+{
+    const char * value;
+    uint16_t valueLength;
+    uint16_t o;
+
+    // only the first value of an alias repeated in one sample is recorded
+    if (!exoQueue_findValue(sample, alias, aliasLength, &value, &valueLength) ||
+        value != alias + aliasLength + 1)
+    {
+        return 0;
+    }
+    for (o = 0; grouped && o < index; o++)
+    {
+        if (exoQueue_findValue(&ring[(ramHead + o) % EXOQUEUE_RAM_SAMPLES],
+                               alias, aliasLength, &value, &valueLength))
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*!
+ * \brief  Checks if the record calls a sample adds to the batch fit
+ *
+ * \return 1 if they fit, 0 if the batch is too full or an alias too long
+ */
+static uint8_t exoQueue_fits(const exoQueue_sample_t * sample, uint16_t index, uint8_t grouped)
+{
+    const char * alias;
+    uint16_t aliasLength;
+    uint16_t offset = 0;
+    uint16_t newAliases = 0;
+
+    while (exoQueue_nextAlias(sample, &offset, &alias, &aliasLength))
+    {
+        if (!exoQueue_isNewAlias(sample, index, grouped, alias, aliasLength))
+        {
+            continue;
+        }
+        if (aliasLength > EXORPC_MAX_ALIAS_LENGTH)
+        {
+            return 0;
+        }
+        newAliases++;
+    }
+    return (exoRpc_pendingCalls() + newAliases <= EXORPC_MAX_CALLS);
+}
+
+
+/*!
+ * \brief  Queues the oldest RAM samples as one record call per alias
+ *
+ * Takes samples up to \a count for as long as their aliases fit in the batch.
+ * The calls only hold the alias, exoQueue_writeGroup writes the values of the
+ * samples as the request goes out.
+ *
+ * \return Number of samples queued
+ */
+static uint16_t exoQueue_queueGrouped(uint16_t count, uint32_t nowMs, uint8_t * failed)
+{
+    exoQueue_sample_t * sample;
+    const char * alias;
+    uint16_t aliasLength;
+    uint16_t offset;
+    uint16_t s;
+
+    exoRpc_begin();
+    groupCount = 0;
+    batchNowMs = nowMs;
+
+    for (s = 0; s < count; s++)
+    {
+        sample = &ring[(ramHead + s) % EXOQUEUE_RAM_SAMPLES];
+        if (!exoQueue_fits(sample, s, 1))
+        {
+            break;
+        }
+
+        // one call for each alias, at the first sample it appears in
+        offset = 0;
+        while (exoQueue_nextAlias(sample, &offset, &alias, &aliasLength))
+        {
+            if (exoQueue_isNewAlias(sample, s, 1, alias, aliasLength))
+            {
+                exoRpc_queueRecord(alias, aliasLength, exoQueue_writeGroup, 0,
+                                   exoQueue_recordDone, failed);
+            }
+        }
+        groupCount = s + 1;
+    }
+
+    if (groupCount == 0 && count > 0)
+    {
+        // a single sample doesn't fit
+        stats.dropped++;
+        exoQueue_pop(1);
+    }
+    return groupCount;
+}
+
+
+/*!
+ * \brief  Queues the oldest samples, spilled ones first, one record call per
+ *         alias of each
+ *
+ * Spilled samples are read back from the flash again by exoQueue_writeSpilled
+ * as the request goes out, the calls only hold their index.
+ *
+ * \return Number of samples queued
+ */
+static uint16_t exoQueue_queueEach(uint32_t nowMs, uint8_t * failed)
+{
+    exoQueue_sample_t * sample;
+    const char * alias;
+    uint16_t aliasLength;
+    uint16_t offset;
+    uint16_t batchCount = 0;
+
+    exoRpc_begin();
+    batchNowMs = nowMs;
+    while (batchCount < exoQueue_depth())
+    {
+        sample = exoQueue_peek(batchCount);
+        if (!sample && batchCount > 0)
+        {
+            // send what could be read first
+            break;
+        }
+        if (!sample)
+        {
+            // unreadable spill file, give up on it
+            stats.dropped += exoQueue_spillDepth();
+            spillReadOffset = spillWriteOffset;
+            exoQueue_pop(0);
+            break;
+        }
+
+        if (!exoQueue_fits(sample, batchCount, 0))
+        {
+            if (batchCount == 0)
+            {
+                // doesn't fit in a batch on its own
+                stats.dropped++;
+                exoQueue_pop(1);
+                continue;
+            }
+            break;
+        }
+
+        offset = 0;
+        while (exoQueue_nextAlias(sample, &offset, &alias, &aliasLength))
+        {
+            if (exoQueue_isNewAlias(sample, batchCount, 0, alias, aliasLength))
+            {
+                exoRpc_queueRecord(alias, aliasLength, exoQueue_writeSpilled,
+                                   (void *)(uintptr_t)batchCount,
+                                   exoQueue_recordDone, failed);
+            }
+        }
+        batchCount++;
+    }
+    return batchCount;
+}
+
+
+/*!
+ * \brief  Removes the oldest \a count samples
+ *
+ * Releases the spill files as they are emptied and deletes them once all of
+ * the spill has been removed.
+ */
+static void exoQueue_pop(uint16_t count)
+{
+    while (count > 0 && exoQueue_spillDepth() > 0)
+    {
+        spillReadOffset += sizeof(exoQueue_sample_t);
+        count--;
+    }
+    if (spillWriteOffset > 0 && spillReadOffset == spillWriteOffset)
+    {
+        exoPal_spillReset();
+        spillReadOffset = 0;
+        spillWriteOffset = 0;
+        hasSpillSample = 0;
+    }
+    else if (spillReadOffset > 0)
+    {
+        exoPal_spillRelease(spillReadOffset);
+    }
+
+    while (count > 0 && ramCount > 0)
+    {
+        ramHead = (ramHead + 1) % EXOQUEUE_RAM_SAMPLES;
+        ramCount--;
+        count--;
+    }
+}
+
+
+/*!
+ * \brief  RPC callback that flags a record the server didn't answer
+ *
+ * A record the server refused, e.g. for an unknown alias, won't succeed on a
+ * retry either, so only missing results count as a failure.
+ */
+static void exoQueue_recordDone(void * context, const char * alias,
+                                EXORPC_STATUS status, const char * value, uint16_t length)
+{
+    if (status == EXORPC_STATUS_REQUEST_ERROR || status == EXORPC_STATUS_NO_RESULT)
+    {
+        *(uint8_t *)context = 1;
+    }
+}
+
+
+/*!
+ * \brief  Writes the values of \a alias in the grouped RAM samples
+ */
+static void exoQueue_writeGroup(exoJson_writer_t * writer, const char * alias, void * context)
+{
+    exoQueue_sample_t * sample;
+    const char * value;
+    uint16_t valueLength;
+    uint16_t aliasLength = exoPal_strlen(alias);
+    uint16_t s;
+
+    for (s = 0; s < groupCount; s++)
+    {
+        sample = &ring[(ramHead + s) % EXOQUEUE_RAM_SAMPLES];
+        if (exoQueue_findValue(sample, alias, aliasLength, &value, &valueLength))
+        {
+            exoRpc_writeEntry(writer, exoQueue_timestamp(sample, batchNowMs),
+                              value, valueLength);
+        }
+    }
+}
+
+
+/*!
+ * \brief  Writes the value of \a alias in the sample at index \a context
+ */
+static void exoQueue_writeSpilled(exoJson_writer_t * writer, const char * alias, void * context)
+{
+    exoQueue_sample_t * sample;
+    const char * value;
+    uint16_t valueLength;
+
+    sample = exoQueue_peek((uint16_t)(uintptr_t)context);
+    if (!sample)
+    {
+        // the samples of the batch stay queued
+        batchUnreadable = 1;
+        return;
+    }
+    if (exoQueue_findValue(sample, alias, exoPal_strlen(alias), &value, &valueLength))
+    {
+        exoRpc_writeEntry(writer, exoQueue_timestamp(sample, batchNowMs),
+                          value, valueLength);
+    }
+}
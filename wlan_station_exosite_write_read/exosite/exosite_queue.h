@@ -0,0 +1,80 @@
+/*****************************************************************************
+*
+*  exosite_queue.h - Store-and-forward queue of Exosite samples
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+#ifndef EXOSITE_QUEUE_H
+#define EXOSITE_QUEUE_H
+
+#include <stdint.h>
+#include "exosite.h"
+
+
+// DEFINES
+
+/*!< Longest sample, in urlencoded "alias=value&..." form, that can be queued.*/
+#define EXOQUEUE_SAMPLE_SIZE                    160
+
+/*!< Number of samples held in RAM before the oldest spill to the flash.
+   Should be at least the batch size used with exoQueue_isDue, so batching
+   doesn't wear the flash.*/
+#ifndef EXOQUEUE_RAM_SAMPLES
+#define EXOQUEUE_RAM_SAMPLES                    64
+#endif
+
+
+// TYPES
+/*!
+ * Queue counters, see exoQueue_getStats.
+ */
+typedef struct exoQueue_stats_tag
+{
+    uint16_t ramDepth;      /*!< samples waiting in RAM */
+    uint16_t spillDepth;    /*!< samples waiting in the spill file */
+    uint32_t spillBytes;    /*!< bytes written to the spill file */
+    uint32_t dropped;       /*!< samples lost, too long or no room left */
+    uint32_t drained;       /*!< samples uploaded */
+    uint32_t drainRequests; /*!< requests used to upload them */
+    uint32_t drainMs;       /*!< time spent in those requests */
+}exoQueue_stats_t;
+
+
+// PUBLIC FUNCTIONS
+void exoQueue_init();
+int8_t exoQueue_push(const char * data, uint16_t length);
+uint16_t exoQueue_depth();
+uint8_t exoQueue_isDue(uint16_t batchSize, uint32_t maxLatencyMs);
+uint16_t exoQueue_drain(exosite_ctx_t * ctx, uint8_t maxRequests);
+void exoQueue_getStats(exoQueue_stats_t * stats);
+
+#endif
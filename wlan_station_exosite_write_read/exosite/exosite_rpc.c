@@ -0,0 +1,659 @@
+/*****************************************************************************
+*
+*  exosite_rpc.c - Batched Exosite RPC calls
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+#include "exosite_pal.h"
+#include "exosite.h"
+#include "exosite_rpc.h"
+
+/*!
+ * Procedures a call can be queued for.
+ */
+#define EXORPC_PROCEDURE_WRITE      0
+#define EXORPC_PROCEDURE_READ       1
+#define EXORPC_PROCEDURE_RECORD     2
+#define EXORPC_PROCEDURE_RECORD_MANY 3
+
+/*!
+ * A queued call, waiting for its result.  Only what the call needs is kept,
+ * its JSON is written by exoRpc_writeCalls as the request goes out.
+ */
+typedef struct exoRpc_call_tag
+{
+    char alias[EXORPC_MAX_ALIAS_LENGTH + 1];
+    uint8_t procedure;  /*!< one of the EXORPC_PROCEDURE_ values */
+    uint8_t isForm;     /*!< value is urlencoded */
+    const char * value; /*!< value of a write or record, in the caller's memory */
+    uint16_t valueLength;
+    int32_t timestamp;  /*!< of a record */
+    exoRpc_entriesWriter writeEntries;  /*!< entries of a multi-value record */
+    void * entriesContext;
+    exoRpc_callback callback;
+    void * context;
+}exoRpc_call_t;
+
+static exoRpc_call_t calls[EXORPC_MAX_CALLS];
+static uint8_t callCount = 0;
+
+/*!
+ * Member of a response entry whose value is being read.
+ */
+#define EXORPC_MEMBER_OTHER         0
+#define EXORPC_MEMBER_ID            1
+#define EXORPC_MEMBER_STATUS        2
+#define EXORPC_MEMBER_RESULT        3
+
+/*!
+ * The response as it streams in, an array of
+ * {"id":N,"status":"ok","result":...} entries.  Each entry is dispatched to
+ * its call as soon as it is complete, so only the value of a read is kept.
+ */
+typedef struct exoRpc_response_tag
+{
+    exoJson_reader_t reader;
+    uint8_t isArray;            /*!< the response is an array of entries */
+    uint8_t member;             /*!< one of the EXORPC_MEMBER_ values */
+    int16_t id;                 /*!< id of the entry, -1 until read */
+    uint8_t isOk;
+    uint8_t points;             /*!< data points of a read result read so far */
+    uint8_t pointItems;         /*!< items of the current data point read so far */
+    uint8_t hasValue;
+    uint16_t valueLength;
+    char value[EXOJSON_TOKEN_SIZE];
+    uint8_t handled[EXORPC_MAX_CALLS];
+}exoRpc_response_t;
+
+static exoRpc_response_t response;
+
+// local functions
+static exoRpc_call_t * exoRpc_queueCall(const char * alias, uint16_t aliasLength, uint8_t procedure,
+                                        exoRpc_callback callback, void * context);
+static int8_t exoRpc_queueForm(const char * data, uint16_t length, uint8_t procedure,
+                               int32_t timestamp, exoRpc_callback callback, void * context);
+static void exoRpc_complete(EXORPC_STATUS status);
+static void exoRpc_writeCalls(exoJson_writer_t * writer, void * context);
+static void exoRpc_readResponse(void * context, const char * data, uint16_t length);
+static void exoRpc_onEvent(exoJson_reader_t * reader, EXOJSON_EVENT event,
+                           const char * token, uint16_t length);
+static void exoRpc_dispatch();
+
+
+/*!
+ * \brief  Starts a new batch, dropping any calls still queued
+ */
+void exoRpc_begin()
+{
+    callCount = 0;
+}
+
+
+/*!
+ * \brief  Queues a write of \a value to \a alias
+ *
+ * value isn't copied, it must stay as it is until exoRpc_flush.
+ *
+ * \param[in] alias Alias to write to, null terminated
+ * \param[in] value Value to write
+ * \param[in] length Length of value
+ * \param[in] callback Called with the result of the write, may be 0
+ * \param[in] context Passed to callback
+ *
+ * \return 0 if queued, -1 if the batch is full
+ */
+int8_t exoRpc_queueWrite(const char * alias, const char * value, uint16_t length,
+                         exoRpc_callback callback, void * context)
+{
+    exoRpc_call_t * call;
+
+    call = exoRpc_queueCall(alias, exoPal_strlen(alias), EXORPC_PROCEDURE_WRITE,
+                            callback, context);
+    if (!call)
+    {
+        return -1;
+    }
+    call->value = value;
+    call->valueLength = length;
+    return 0;
+}
+
+
+/*!
+ * \brief  Queues one write per alias of an urlencoded "a=1&b=2" string
+ *
+ * Takes the same data as exosite_write.  Either all of the pairs are queued or,
+ * if they don't fit in the batch, none are.  writeData isn't copied, it must
+ * stay as it is until exoRpc_flush.
+ *
+ * \param[in] writeData Urlencoded alias/value pairs
+ * \param[in] length Length of writeData
+ * \param[in] callback Called with the result of each write, may be 0
+ * \param[in] context Passed to callback
+ *
+ * \return 0 if queued, -1 if the batch is full
+ */
+int8_t exoRpc_queueWriteForm(const char * writeData, uint16_t length,
+                             exoRpc_callback callback, void * context)
+{
+    return exoRpc_queueForm(writeData, length, EXORPC_PROCEDURE_WRITE, 0,
+                            callback, context);
+}
+
+
+/*!
+ * \brief  Queues one timestamped record per alias of an urlencoded string
+ *
+ * Like exoRpc_queueWriteForm, but each value is recorded at \a timestamp
+ * instead of the time the server receives it.  A negative timestamp is that
+ * many seconds before the server receives the request.
+ *
+ * \param[in] writeData Urlencoded alias/value pairs
+ * \param[in] length Length of writeData
+ * \param[in] timestamp Unix time of the values, or negative seconds ago
+ * \param[in] callback Called with the result of each record, may be 0
+ * \param[in] context Passed to callback
+ *
+ * \return 0 if queued, -1 if the batch is full
+ */
+int8_t exoRpc_queueRecordForm(const char * writeData, uint16_t length, int32_t timestamp,
+                              exoRpc_callback callback, void * context)
+{
+    return exoRpc_queueForm(writeData, length, EXORPC_PROCEDURE_RECORD, timestamp,
+                            callback, context);
+}
+
+
+/*!
+ * \brief  Queues a record of several timestamped values to \a alias
+ *
+ * The values aren't given here, \a writeEntries writes them with
+ * exoRpc_writeEntry as the request goes out, so they can be read from
+ * wherever they are kept, e.g. the samples of exoQueue.
+ *
+ * \param[in] alias Alias to record to
+ * \param[in] aliasLength Length of alias
+ * \param[in] writeEntries Writes the entries of the record
+ * \param[in] entriesContext Passed to writeEntries
+ * \param[in] callback Called with the result of the record, may be 0
+ * \param[in] context Passed to callback
+ *
+ * \return 0 if queued, -1 if the batch is full
+ */
+int8_t exoRpc_queueRecord(const char * alias, uint16_t aliasLength,
+                          exoRpc_entriesWriter writeEntries, void * entriesContext,
+                          exoRpc_callback callback, void * context)
+{
+    exoRpc_call_t * call;
+
+    call = exoRpc_queueCall(alias, aliasLength, EXORPC_PROCEDURE_RECORD_MANY,
+                            callback, context);
+    if (!call)
+    {
+        return -1;
+    }
+    call->writeEntries = writeEntries;
+    call->entriesContext = entriesContext;
+    return 0;
+}
+
+
+/*!
+ * \brief  Writes one [timestamp,"value"] entry of a record
+ *
+ * \param[in] timestamp Unix time of the value, or negative seconds ago
+ * \param[in] value Urlencoded value
+ * \param[in] length Length of value
+ */
+void exoRpc_writeEntry(exoJson_writer_t * writer, int32_t timestamp,
+                       const char * value, uint16_t length)
+{
+    exoJson_beginArray(writer);
+    exoJson_int(writer, timestamp);
+    exoJson_formString(writer, value, length);
+    exoJson_endArray(writer);
+}
+
+
+/*!
+ * \brief  Queues a read of the latest value of \a alias
+ *
+ * \param[in] alias Alias to read, null terminated
+ * \param[in] callback Called with the value, may be 0
+ * \param[in] context Passed to callback
+ *
+ * \return 0 if queued, -1 if the batch is full
+ */
+int8_t exoRpc_queueRead(const char * alias, exoRpc_callback callback, void * context)
+{
+    if (!exoRpc_queueCall(alias, exoPal_strlen(alias), EXORPC_PROCEDURE_READ,
+                          callback, context))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+
+/*!
+ * \brief  Returns the number of calls queued in the current batch
+ */
+uint8_t exoRpc_pendingCalls()
+{
+    return callCount;
+}
+
+
+/*!
+ * \brief  Sends all queued calls in one /onep:v1/rpc/process request
+ *
+ * The callback of every queued call is invoked with its result before this
+ * returns, then a new batch is started.  The calls are made with the CIK of
+ * \a ctx, so the same batch API serves every device identity.
+ *
+ * The response is parsed as it arrives and each call's callback is invoked
+ * as soon as its result has been read, while the rest of the response is
+ * still coming in on the connection.  Callbacks mustn't make requests.
+ *
+ * \param[in] ctx Context to send the request on
+ *
+ * \return 0 if the request succeeded, -1 if no valid response was received
+ */
+int32_t exoRpc_flush(exosite_ctx_t * ctx)
+{
+    exosite_result_t result;
+    uint8_t i;
+
+    if (callCount == 0)
+    {
+        return 0;
+    }
+    exoJson_initReader(&response.reader, exoRpc_onEvent, 0);
+    response.isArray = 0;
+    for (i = 0; i < callCount; i++)
+    {
+        response.handled[i] = 0;
+    }
+
+    result = exosite_rpcRequest(ctx, exoRpc_writeCalls, 0, exoRpc_readResponse, 0);
+    if (result.status != 200 || !response.isArray)
+    {
+        // no response, or an {"error":...} for the whole request
+        exoRpc_complete(EXORPC_STATUS_REQUEST_ERROR);
+        return -1;
+    }
+
+    // calls the response didn't mention, or cut off before
+    exoRpc_complete(EXORPC_STATUS_NO_RESULT);
+    return 0;
+}
+
+
+/*!
+ * \brief  Writes the queued calls into the "calls" array of the request
+ *
+ * Each call is {"id":N,"procedure":"...","arguments":[{"alias":"..."},...]},
+ * its id the index in calls[] so the response entries can be matched up.
+ */
+static void exoRpc_writeCalls(exoJson_writer_t * writer, void * context)
+{
+    exoRpc_call_t * call;
+    uint8_t i;
+
+    for (i = 0; i < callCount; i++)
+    {
+        call = &calls[i];
+        exoJson_beginObject(writer);
+        exoJson_key(writer, "id");
+        exoJson_int(writer, i);
+        exoJson_key(writer, "procedure");
+        switch (call->procedure)
+        {
+        case EXORPC_PROCEDURE_READ:
+            exoJson_string(writer, "read", 4);
+            break;
+        case EXORPC_PROCEDURE_WRITE:
+            exoJson_string(writer, "write", 5);
+            break;
+        default:
+            exoJson_string(writer, "record", 6);
+            break;
+        }
+        exoJson_key(writer, "arguments");
+        exoJson_beginArray(writer);
+        exoJson_beginObject(writer);
+        exoJson_key(writer, "alias");
+        exoJson_string(writer, call->alias, exoPal_strlen(call->alias));
+        exoJson_endObject(writer);
+
+        switch (call->procedure)
+        {
+        case EXORPC_PROCEDURE_READ:
+            // only the latest value
+            exoJson_beginObject(writer);
+            exoJson_key(writer, "limit");
+            exoJson_int(writer, 1);
+            exoJson_endObject(writer);
+            break;
+        case EXORPC_PROCEDURE_RECORD:
+            exoJson_beginArray(writer);
+            exoRpc_writeEntry(writer, call->timestamp, call->value, call->valueLength);
+            exoJson_endArray(writer);
+            break;
+        case EXORPC_PROCEDURE_RECORD_MANY:
+            exoJson_beginArray(writer);
+            call->writeEntries(writer, call->alias, call->entriesContext);
+            exoJson_endArray(writer);
+            break;
+        default:
+            if (call->isForm)
+            {
+                exoJson_formString(writer, call->value, call->valueLength);
+            }
+            else
+            {
+                exoJson_string(writer, call->value, call->valueLength);
+            }
+            break;
+        }
+        if (call->procedure != EXORPC_PROCEDURE_READ)
+        {
+            // no options
+            exoJson_beginObject(writer);
+            exoJson_endObject(writer);
+        }
+        exoJson_endArray(writer);
+        exoJson_endObject(writer);
+    }
+}
+
+
+/*!
+ * \brief  Queues a write or record for each pair of an urlencoded string
+ *
+ * All or nothing, a batch that fills up part way is put back as it was.
+ *
+ * \return 0 if successful, -1 if it doesn't fit
+ */
+static int8_t exoRpc_queueForm(const char * data, uint16_t length, uint8_t procedure,
+                               int32_t timestamp, exoRpc_callback callback, void * context)
+{
+    exoRpc_call_t * call;
+    uint8_t startCalls = callCount;
+    uint16_t keyStart = 0;
+    uint16_t valueStart = 0;
+    uint16_t i;
+
+    for (i = 0; i <= length; i++)
+    {
+        if (i < length && data[i] == '=' && valueStart <= keyStart)
+        {
+            valueStart = i + 1;
+        }
+        else if ((i == length || data[i] == '&') && valueStart > keyStart)
+        {
+            call = exoRpc_queueCall(&data[keyStart], valueStart - 1 - keyStart,
+                                    procedure, callback, context);
+            if (!call)
+            {
+                callCount = startCalls;
+                return -1;
+            }
+            call->isForm = 1;
+            call->value = &data[valueStart];
+            call->valueLength = i - valueStart;
+            call->timestamp = timestamp;
+            keyStart = i + 1;
+        }
+        else if (i < length && data[i] == '&')
+        {
+            // pair without a value
+            keyStart = i + 1;
+        }
+    }
+    return 0;
+}
+
+
+/*!
+ * \brief  Adds a call to the batch
+ *
+ * \return The call, for the caller to fill in its value, 0 if the batch is
+ *         full or the alias too long
+ */
+static exoRpc_call_t * exoRpc_queueCall(const char * alias, uint16_t aliasLength, uint8_t procedure,
+                                        exoRpc_callback callback, void * context)
+{
+    exoRpc_call_t * call;
+
+    if (callCount >= EXORPC_MAX_CALLS || aliasLength > EXORPC_MAX_ALIAS_LENGTH)
+    {
+        return 0;
+    }
+
+    call = &calls[callCount++];
+    exoPal_memcpy(call->alias, alias, aliasLength);
+    call->alias[aliasLength] = '\0';
+    call->procedure = procedure;
+    call->isForm = 0;
+    call->value = 0;
+    call->valueLength = 0;
+    call->timestamp = 0;
+    call->writeEntries = 0;
+    call->entriesContext = 0;
+    call->callback = callback;
+    call->context = context;
+    return call;
+}
+
+
+/*!
+ * \brief  Feeds a piece of the response to the reader
+ */
+static void exoRpc_readResponse(void * context, const char * data, uint16_t length)
+{
+    // a malformed response stops the reader, the calls it didn't get to
+    // have no result
+    exoJson_feed(&response.reader, data, length);
+}
+
+
+/*!
+ * \brief  Checks whether a token read from the response is \a str
+ */
+static uint8_t exoRpc_isToken(const char * token, uint16_t length, const char * str)
+{
+    uint16_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        if (str[i] != token[i])
+        {
+            return 0;
+        }
+    }
+    return str[length] == '\0';
+}
+
+
+/*!
+ * \brief  Follows the response entries, dispatching each once it ends
+ *
+ * Depth 1 is the array of entries and 2 their members.  A read result is
+ * [[timestamp,value],...] at depths 3 and 4; the value of its first, latest,
+ * data point is kept.
+ */
+static void exoRpc_onEvent(exoJson_reader_t * reader, EXOJSON_EVENT event,
+                           const char * token, uint16_t length)
+{
+    if (reader->depth == 1)
+    {
+        if (event == EXOJSON_EVENT_BEGIN_ARRAY)
+        {
+            response.isArray = 1;
+        }
+        return;
+    }
+    if (!response.isArray)
+    {
+        return;
+    }
+
+    if (reader->depth == 2)
+    {
+        switch (event)
+        {
+        case EXOJSON_EVENT_BEGIN_OBJECT:
+            response.member = EXORPC_MEMBER_OTHER;
+            response.id = -1;
+            response.isOk = 0;
+            response.points = 0;
+            response.hasValue = 0;
+            break;
+        case EXOJSON_EVENT_END_OBJECT:
+            exoRpc_dispatch();
+            break;
+        case EXOJSON_EVENT_KEY:
+            if (exoRpc_isToken(token, length, "id"))
+            {
+                response.member = EXORPC_MEMBER_ID;
+            }
+            else if (exoRpc_isToken(token, length, "status"))
+            {
+                response.member = EXORPC_MEMBER_STATUS;
+            }
+            else if (exoRpc_isToken(token, length, "result"))
+            {
+                response.member = EXORPC_MEMBER_RESULT;
+            }
+            else
+            {
+                response.member = EXORPC_MEMBER_OTHER;
+            }
+            break;
+        case EXOJSON_EVENT_NUMBER:
+            if (response.member == EXORPC_MEMBER_ID)
+            {
+                response.id = exoPal_atoi((char *)token);
+            }
+            break;
+        case EXOJSON_EVENT_STRING:
+            if (response.member == EXORPC_MEMBER_STATUS)
+            {
+                response.isOk = exoRpc_isToken(token, length, "ok");
+            }
+            break;
+        default:
+            break;
+        }
+        return;
+    }
+
+    if (response.member != EXORPC_MEMBER_RESULT || reader->depth != 4)
+    {
+        return;
+    }
+    if (event == EXOJSON_EVENT_BEGIN_ARRAY)
+    {
+        response.pointItems = 0;
+    }
+    else if (event == EXOJSON_EVENT_END_ARRAY)
+    {
+        response.points++;
+    }
+    else if (event == EXOJSON_EVENT_STRING || event == EXOJSON_EVENT_NUMBER ||
+             event == EXOJSON_EVENT_LITERAL)
+    {
+        if (response.points == 0 && response.pointItems++ == 1)
+        {
+            exoPal_memcpy(response.value, token, length);
+            response.valueLength = length;
+            response.hasValue = 1;
+        }
+    }
+}
+
+
+/*!
+ * \brief  Passes the result of the entry just read to its call
+ */
+static void exoRpc_dispatch()
+{
+    exoRpc_call_t * call;
+    int16_t id = response.id;
+
+    if (id < 0 || id >= callCount || response.handled[id])
+    {
+        return;
+    }
+    response.handled[id] = 1;
+    call = &calls[id];
+    if (!call->callback)
+    {
+        return;
+    }
+    if (!response.isOk)
+    {
+        call->callback(call->context, call->alias, EXORPC_STATUS_CALL_ERROR, 0, 0);
+    }
+    else if (call->procedure != EXORPC_PROCEDURE_READ)
+    {
+        call->callback(call->context, call->alias, EXORPC_STATUS_OK, 0, 0);
+    }
+    else if (response.hasValue)
+    {
+        call->callback(call->context, call->alias, EXORPC_STATUS_OK,
+                       response.value, response.valueLength);
+    }
+    else
+    {
+        call->callback(call->context, call->alias, EXORPC_STATUS_NO_RESULT, 0, 0);
+    }
+}
+
+
+/*!
+ * \brief  Completes every call that has no result yet with \a status and
+ *         starts a new batch
+ */
+static void exoRpc_complete(EXORPC_STATUS status)
+{
+    uint8_t i;
+
+    for (i = 0; i < callCount; i++)
+    {
+        if (!response.handled[i] && calls[i].callback)
+        {
+            calls[i].callback(calls[i].context, calls[i].alias, status, 0, 0);
+        }
+    }
+    exoRpc_begin();
+}
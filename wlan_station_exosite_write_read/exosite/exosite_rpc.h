@@ -0,0 +1,106 @@
+/*****************************************************************************
+*
+*  exosite_rpc.h - Batched Exosite RPC interface
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+#ifndef EXOSITE_RPC_H
+#define EXOSITE_RPC_H
+
+#include <stdint.h>
+#include "exosite.h"
+
+
+// DEFINES
+
+/*!< Maximum number of calls that can be queued for one batch.  Calls are
+   kept as small descriptors and written out as the request is sent, so the
+   size of the request isn't limited by a buffer.*/
+#ifndef EXORPC_MAX_CALLS
+#define EXORPC_MAX_CALLS                        64
+#endif
+
+/*!< Longest alias that can be queued.*/
+#define EXORPC_MAX_ALIAS_LENGTH                 20
+
+
+// ENUMS
+/*!
+ * Result of one queued call, passed to its callback.
+ */
+typedef enum EXORPC_STATUS_tag
+{
+    EXORPC_STATUS_OK,           /*!< Call succeeded */
+    EXORPC_STATUS_CALL_ERROR,   /*!< Exosite returned an error for this call */
+    EXORPC_STATUS_NO_RESULT,    /*!< No result for this call in the response */
+    EXORPC_STATUS_REQUEST_ERROR /*!< The batch request itself failed */
+}EXORPC_STATUS;
+
+
+// TYPES
+/*!
+ * Called once per queued call when the batch completes.  For reads \a value
+ * points at the latest value of the alias, without quotes and not null
+ * terminated, and is only valid during the callback.  Values longer than
+ * EXOJSON_TOKEN_SIZE are cut short.  For writes and records \a value is 0.
+ */
+typedef void (*exoRpc_callback)(void * context, const char * alias,
+                                EXORPC_STATUS status,
+                                const char * value, uint16_t length);
+
+/*!
+ * Writes the entries of a record queued with exoRpc_queueRecord, one
+ * exoRpc_writeEntry each.  Called twice per flush, once to measure the
+ * request and once to send it, and has to write the same entries both times.
+ */
+typedef void (*exoRpc_entriesWriter)(exoJson_writer_t * writer, const char * alias,
+                                     void * context);
+
+
+// PUBLIC FUNCTIONS
+void exoRpc_begin();
+int8_t exoRpc_queueWrite(const char * alias, const char * value, uint16_t length,
+                         exoRpc_callback callback, void * context);
+int8_t exoRpc_queueWriteForm(const char * writeData, uint16_t length,
+                             exoRpc_callback callback, void * context);
+int8_t exoRpc_queueRecordForm(const char * writeData, uint16_t length, int32_t timestamp,
+                              exoRpc_callback callback, void * context);
+int8_t exoRpc_queueRecord(const char * alias, uint16_t aliasLength,
+                          exoRpc_entriesWriter writeEntries, void * entriesContext,
+                          exoRpc_callback callback, void * context);
+void exoRpc_writeEntry(exoJson_writer_t * writer, int32_t timestamp,
+                       const char * value, uint16_t length);
+int8_t exoRpc_queueRead(const char * alias, exoRpc_callback callback, void * context);
+uint8_t exoRpc_pendingCalls();
+int32_t exoRpc_flush(exosite_ctx_t * ctx);
+
+#endif
@@ -0,0 +1,472 @@
+/*****************************************************************************
+*
+*  exosite_bench.c - End-to-end benchmark of the Exosite library
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+/*
+ * Runs the unmodified library over the POSIX PAL against exosite_server, or
+ * anything else that speaks the API, and reports requests/s, p50/p99 latency
+ * and bytes on the wire for each call:
+ *
+ *   ./exosite_server -l 20 &
+ *   ./exosite_bench -p 8080 -n 1000
+ *
+ * Run the server with -c 1 to see the cost of a connection per request,
+ * or with -b 1000 to make the rpcReads results about 50 KB.
+ * Over TLS, tls counts the handshakes and resumed the abbreviated ones:
+ *
+ *   ./exosite_server -p 8443 -C exosite_tls.crt -K exosite_tls.key -c 1 &
+ *   ./exosite_bench -h localhost -p 8443 -T exosite_tls.crt
+ *   ./exosite_bench -h localhost -p 8443 -T exosite_tls.crt -R
+ *
+ * A request answered with 401 drops the CIK.  The bench then waits for
+ * exosite_provision to activate the device again, as a device's main loop
+ * would, and prints each attempt to stderr.  The wait isn't counted in the
+ * results.  To see the backoff, have the server revoke the CIK at the 50th
+ * request and refuse the next three activations:
+ *
+ *   ./exosite_server -r 50 -a 3 &
+ *   ./exosite_bench -p 8080 write
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "exosite.h"
+#include "exosite_pal.h"
+#include "exosite_pal_posix.h"
+#include "exosite_rpc.h"
+
+#define DEFAULT_PORT        8080
+#define DEFAULT_ITERATIONS  200
+#define READ_BUFFER_SIZE    2048
+#define STREAM_CALLS        48
+#define MAX_ACTIVATIONS     8
+
+typedef struct
+{
+    const char * name;
+    uint8_t (*run)(void);   /* 1 if the request succeeded */
+} api_t;
+
+static exosite_ctx_t ctx;
+static char writeData[1024];
+static uint16_t writeLength;
+static char readBuffer[READ_BUFFER_SIZE];
+static exosite_longPoll_t longPoll = {"bench", 0, ""};
+static uint32_t rpcResults;
+static exoJson_reader_t streamReader;
+static uint8_t isStatusKey;
+
+
+static uint64_t nowUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static uint8_t runWrite(void)
+{
+    return exosite_write(&ctx, writeData, writeLength).status == 204;
+}
+
+
+static uint8_t runRead(void)
+{
+    return exosite_read(&ctx, "bench", readBuffer, sizeof(readBuffer)).status == 200;
+}
+
+
+static uint8_t runReadMany(void)
+{
+    static const char * aliases[] = {"bench", "temp", "humidity", "lux"};
+    exosite_value_t values[4];
+
+    values[0].decimals = values[1].decimals = values[2].decimals = values[3].decimals = 2;
+    return exosite_readMany(&ctx, aliases, 4, values, readBuffer, sizeof(readBuffer)).status == 200;
+}
+
+
+static uint8_t runLongPoll(void)
+{
+    int16_t status = exosite_readLongPoll(&ctx, &longPoll, readBuffer, sizeof(readBuffer)).status;
+
+    return status == 200 || status == 304;
+}
+
+
+static void rpcCallback(void * context, const char * alias, EXORPC_STATUS status,
+                        const char * value, uint16_t length)
+{
+    if (status == EXORPC_STATUS_OK)
+    {
+        rpcResults++;
+    }
+}
+
+
+static uint8_t runRpc(void)
+{
+    rpcResults = 0;
+    exoRpc_queueWrite("temp", "21.50", 5, rpcCallback, 0);
+    exoRpc_queueWrite("humidity", "40.25", 5, rpcCallback, 0);
+    exoRpc_queueRead("bench", rpcCallback, 0);
+    exoRpc_flush(&ctx);
+    return rpcResults == 3;
+}
+
+
+/* timestamped records, streamed with no request buffer */
+static void writeRecordCalls(exoJson_writer_t * writer, void * context)
+{
+    int32_t i;
+
+    for (i = 0; i < STREAM_CALLS; i++)
+    {
+        exoJson_beginObject(writer);
+        exoJson_key(writer, "id");
+        exoJson_int(writer, i);
+        exoJson_key(writer, "procedure");
+        exoJson_string(writer, "record", 6);
+        exoJson_key(writer, "arguments");
+        exoJson_beginArray(writer);
+        exoJson_beginObject(writer);
+        exoJson_key(writer, "alias");
+        exoJson_string(writer, "temp", 4);
+        exoJson_endObject(writer);
+        exoJson_beginArray(writer);
+        exoJson_beginArray(writer);
+        exoJson_int(writer, 1400000000 + i);
+        exoJson_formString(writer, &writeData[6], writeLength - 6);
+        exoJson_endArray(writer);
+        exoJson_endArray(writer);
+        exoJson_beginObject(writer);
+        exoJson_endObject(writer);
+        exoJson_endArray(writer);
+        exoJson_endObject(writer);
+    }
+}
+
+
+/* reads of as many aliases, run the server with -b for large results */
+static void writeReadCalls(exoJson_writer_t * writer, void * context)
+{
+    char alias[8];
+    int32_t i;
+
+    for (i = 0; i < STREAM_CALLS; i++)
+    {
+        exoJson_beginObject(writer);
+        exoJson_key(writer, "id");
+        exoJson_int(writer, i);
+        exoJson_key(writer, "procedure");
+        exoJson_string(writer, "read", 4);
+        exoJson_key(writer, "arguments");
+        exoJson_beginArray(writer);
+        exoJson_beginObject(writer);
+        exoJson_key(writer, "alias");
+        exoJson_string(writer, alias, sprintf(alias, "r%d", i));
+        exoJson_endObject(writer);
+        exoJson_beginObject(writer);
+        exoJson_key(writer, "limit");
+        exoJson_int(writer, 1);
+        exoJson_endObject(writer);
+        exoJson_endArray(writer);
+        exoJson_endObject(writer);
+    }
+}
+
+
+/* counts the "status":"ok" of the response entries */
+static void onStreamEvent(exoJson_reader_t * reader, EXOJSON_EVENT event,
+                          const char * token, uint16_t length)
+{
+    if (reader->depth != 2)
+    {
+        return;
+    }
+    if (event == EXOJSON_EVENT_KEY)
+    {
+        isStatusKey = strcmp(token, "status") == 0;
+    }
+    else if (event == EXOJSON_EVENT_STRING && isStatusKey && strcmp(token, "ok") == 0)
+    {
+        rpcResults++;
+    }
+}
+
+
+static void readStream(void * context, const char * data, uint16_t length)
+{
+    exoJson_feed(&streamReader, data, length);
+}
+
+
+static uint8_t runStream(exosite_rpcCallsWriter writeCalls)
+{
+    int16_t status;
+
+    rpcResults = 0;
+    exoJson_initReader(&streamReader, onStreamEvent, 0);
+    status = exosite_rpcRequest(&ctx, writeCalls, 0, readStream, 0).status;
+    return status == 200 && exoJson_isComplete(&streamReader) && rpcResults == STREAM_CALLS;
+}
+
+
+static uint8_t runRpcRecords(void)
+{
+    return runStream(writeRecordCalls);
+}
+
+
+static uint8_t runRpcReads(void)
+{
+    return runStream(writeReadCalls);
+}
+
+
+static uint8_t runTimestamp(void)
+{
+    int32_t timestamp;
+
+    return exosite_getTimestamp(&ctx, &timestamp).status == 200;
+}
+
+
+static const api_t apis[] =
+{
+    {"write",     runWrite},
+    {"read",      runRead},
+    {"readMany",  runReadMany},
+    {"longPoll",  runLongPoll},
+    {"rpc",       runRpc},
+    {"rpcRecords", runRpcRecords},
+    {"rpcReads",  runRpcReads},
+    {"timestamp", runTimestamp},
+};
+
+#define API_COUNT (sizeof(apis) / sizeof(apis[0]))
+
+
+static int compareUs(const void * a, const void * b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/* waits for exosite_provision to activate the device again, returns the
+   time it took */
+static uint64_t reactivate(const api_t * api, uint32_t request)
+{
+    uint64_t start = nowUs();
+    uint32_t attempts = 0;
+    EXO_STATE state;
+
+    fprintf(stderr, "%s %u: CIK rejected, activating again\n", api->name, request);
+    for (;;)
+    {
+        state = exosite_provision(&ctx);
+        if (state == EXO_STATE_NOT_COMPLETE)
+        {
+            usleep(1000);
+            continue;
+        }
+        fprintf(stderr, "  activation %u: %s after %.0f ms\n", ++attempts,
+                state == EXO_STATE_INIT_COMPLETE ? "done" : "failed",
+                (nowUs() - start) / 1000.0);
+        if (state == EXO_STATE_INIT_COMPLETE)
+        {
+            return nowUs() - start;
+        }
+        if (attempts == MAX_ACTIVATIONS)
+        {
+            fprintf(stderr, "giving up\n");
+            exit(1);
+        }
+    }
+}
+
+
+static void bench(const api_t * api, uint32_t iterations, uint32_t * latencies)
+{
+    exoPal_wireStats_t before;
+    exoPal_wireStats_t after;
+    exoPal_connStats_t connsBefore;
+    exoPal_connStats_t connsAfter;
+    exoPal_dnsStats_t dnsBefore;
+    exoPal_dnsStats_t dnsAfter;
+    uint64_t start;
+    uint64_t total;
+    uint64_t t;
+    uint32_t ok = 0;
+    uint32_t i;
+
+    exoPal_getWireStats(&before);
+    exoPal_getConnStats(&ctx.socket, &connsBefore);
+    exoPal_getDnsStats(&dnsBefore);
+    start = nowUs();
+    for (i = 0; i < iterations; i++)
+    {
+        if (ctx.isProvisionDue)
+        {
+            start += reactivate(api, i);
+        }
+        t = nowUs();
+        ok += api->run();
+        latencies[i] = nowUs() - t;
+    }
+    total = nowUs() - start;
+    exoPal_getWireStats(&after);
+    exoPal_getConnStats(&ctx.socket, &connsAfter);
+    exoPal_getDnsStats(&dnsAfter);
+
+    qsort(latencies, iterations, sizeof(latencies[0]), compareUs);
+    printf("%-10s %6u %6u %9.1f %8.2f %8.2f %8.1f %8.1f %6u %5u %5u %7u\n",
+           api->name, ok, iterations - ok,
+           iterations * 1e6 / (total ? total : 1),
+           latencies[iterations / 2] / 1000.0,
+           latencies[(iterations * 99) / 100] / 1000.0,
+           (double)(after.bytesSent - before.bytesSent) / iterations,
+           (double)(after.bytesReceived - before.bytesReceived) / iterations,
+           connsAfter.opened - connsBefore.opened,
+           dnsAfter.lookups - dnsBefore.lookups,
+           after.tlsHandshakes - before.tlsHandshakes,
+           after.tlsResumed - before.tlsResumed);
+}
+
+
+static void usage(const char * name)
+{
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-n iterations] [-s value_bytes] [-k keepalive_ms]\n"
+            "          [-w longpoll_ms] [-T ca_file [-R]] [api ...]\n"
+            "  -h  server address (127.0.0.1)\n"
+            "  -p  server port (%d)\n"
+            "  -n  requests per api (%d)\n"
+            "  -s  size of the value written (5)\n"
+            "  -k  keep-alive idle timeout, 0 closes after every request (%d)\n"
+            "  -w  Request-Timeout of long-poll reads (0)\n"
+            "  -T  use TLS, verifying the server against this PEM file\n"
+            "  -R  don't resume TLS sessions\n"
+            "  apis: write read readMany longPoll rpc rpcRecords rpcReads timestamp, default all\n",
+            name, DEFAULT_PORT, DEFAULT_ITERATIONS, EXOPAL_KEEPALIVE_TIMEOUT_MS);
+    exit(2);
+}
+
+
+int main(int argc, char ** argv)
+{
+    const char * host = "127.0.0.1";
+    uint16_t port = DEFAULT_PORT;
+    uint32_t iterations = DEFAULT_ITERATIONS;
+    uint32_t valueSize = 5;
+    uint32_t * latencies;
+    char uuid[24];
+    EXO_STATE state;
+    uint32_t i;
+    int opt;
+    int arg;
+
+    // a new device every run, so the server needn't remember it
+    snprintf(uuid, sizeof(uuid), "bench-%ld", (long)getpid());
+    exoPal_setCikFile(0);
+    exosite_ctxInit(&ctx, uuid, 0);
+
+    while ((opt = getopt(argc, argv, "h:p:n:s:k:w:T:R")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': iterations = atoi(optarg); break;
+            case 's': valueSize = atoi(optarg); break;
+            case 'k': exoPal_setKeepAliveTimeout(&ctx.socket, atoi(optarg)); break;
+            case 'w': longPoll.timeoutMs = atoi(optarg); break;
+            case 'T':
+                if (exoPal_setTls(1, optarg) != 0)
+                {
+                    fprintf(stderr, "can't use TLS with %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'R': exoPal_setTlsResumption(0); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (iterations == 0 || valueSize > sizeof(writeData) - sizeof("bench="))
+    {
+        usage(argv[0]);
+    }
+
+    writeLength = sprintf(writeData, "bench=");
+    memset(&writeData[writeLength], '7', valueSize);
+    writeLength += valueSize;
+
+    exoPal_setServer(host, port);
+    state = exosite_init(&ctx, "exosite", "bench");
+    if (state != EXO_STATE_INIT_COMPLETE)
+    {
+        fprintf(stderr, "exosite_init failed: %d\n", state);
+        return 1;
+    }
+
+    latencies = malloc(iterations * sizeof(uint32_t));
+    printf("%-10s %6s %6s %9s %8s %8s %8s %8s %6s %5s %5s %7s\n",
+           "api", "ok", "failed", "req/s", "p50 ms", "p99 ms", "tx B/req", "rx B/req", "conns", "dns",
+           "tls", "resumed");
+    for (i = 0; i < API_COUNT; i++)
+    {
+        if (optind < argc)
+        {
+            for (arg = optind; arg < argc && strcmp(argv[arg], apis[i].name) != 0; arg++)
+            {
+            }
+            if (arg == argc)
+            {
+                continue;
+            }
+        }
+        bench(&apis[i], iterations, latencies);
+    }
+    free(latencies);
+    return 0;
+}
@@ -0,0 +1,658 @@
+/*****************************************************************************
+*
+*  exosite_fleet.c - Fleet load generator of virtual Exosite devices
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+/*
+ * Simulates a fleet of devices from one process to see how it loads the
+ * ingestion path.  Each device activates with its own serial number, then
+ * follows the cloud_demo schedule: the sensors are written every 2 s, only
+ * the ones past their deadband, and the LED aliases read every 1 s.
+ *
+ * Every device is an exosite_ctx_t driven through the async calls, so the
+ * requests on the wire are the library's own.  Like the real device, each
+ * has at most one request in flight on its own kept-alive connection.  The
+ * sockets of all the contexts share an epoll set, and exosite_poll steps a
+ * device when its socket is ready.
+ *
+ *   ./exosite_server &
+ *   ./exosite_fleet -n 2000 -t 30
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "exosite.h"
+#include "exosite_fmt.h"
+#include "exosite_pal_posix.h"
+
+#define DEFAULT_PORT            "8080"
+#define DEFAULT_DEVICES         100
+#define DEFAULT_DURATION_S      10
+#define DEFAULT_WRITE_MS        2000    /* write_interval of 4 loops of 500 ms */
+#define DEFAULT_READ_MS         1000    /* read_interval of 2 loops */
+#define DEFAULT_RAMP_MS         1000
+#define ACTIVATE_RETRY_MS       5000
+#define SENSOR_MAX_SILENCE_MS   300000
+#define TICK_MS                 5
+
+typedef enum
+{
+    REQUEST_ACTIVATE,
+    REQUEST_WRITE,
+    REQUEST_READ,
+    REQUEST_COUNT
+} request_t;
+
+static const char * requestNames[REQUEST_COUNT] = {"activate", "write", "read"};
+
+typedef enum
+{
+    DEVICE_WAITING,         /* no CIK, activates at nextActivateUs */
+    DEVICE_IDLE,            /* activated, no request in flight */
+    DEVICE_BUSY,            /* request in flight, see exosite_poll */
+    DEVICE_FAILED           /* activation refused, stays out of the run */
+} deviceState_t;
+
+/* the sensors table of cloud_demo, values scaled by 1000 */
+typedef struct
+{
+    const char * alias;
+    uint8_t decimals;
+    int32_t deadband;
+    int32_t initial;
+    int32_t step;           /* largest change per sample */
+} sensor_t;
+
+static const sensor_t sensors[] =
+{
+    {"usrsw1",   0, 0,     0,         0},
+    {"usrsw2",   0, 0,     0,         0},
+    {"tmp006",   3, 100,   24093,     60},
+    {"bmp180_T", 3, 100,   23850,     60},
+    {"bmp180_P", 3, 20000, 100266200, 15000},
+    {"sht21_H",  3, 500,   47764,     300},
+    {"sht21_T",  3, 100,   23500,     60},
+    {"isl29023", 3, 1000,  63980,     1500}
+};
+
+#define SENSOR_COUNT (sizeof(sensors) / sizeof(sensors[0]))
+
+typedef struct
+{
+    exosite_ctx_t ctx;
+    int fd;                 /* ctx.socket.id as registered with epoll */
+    deviceState_t state;
+    request_t request;
+    char leds[64];          /* body of the LED read */
+    uint64_t startUs;
+    uint64_t nextActivateUs;
+    uint64_t nextWriteUs;
+    uint64_t nextReadUs;
+    int32_t values[SENSOR_COUNT];
+    int32_t lastSent[SENSOR_COUNT];
+    uint64_t lastSentUs[SENSOR_COUNT];
+    uint8_t hasSent[SENSOR_COUNT];
+    uint8_t isPending[SENSOR_COUNT];   /* in the write in flight */
+} device_t;
+
+/* latency samples of one request kind */
+typedef struct
+{
+    uint32_t * us;
+    uint32_t count;
+    uint32_t size;
+    uint64_t ok;
+    uint64_t httpErrors;
+    uint64_t failures;
+} requestStats_t;
+
+typedef struct
+{
+    uint64_t timeouts;
+    uint64_t writesSkipped;     /* nothing past its deadband */
+    uint32_t open;
+} fleetStats_t;
+
+static struct
+{
+    const char * host;
+    const char * port;
+    uint32_t devices;
+    uint32_t durationS;
+    uint32_t writeMs;
+    uint32_t readMs;
+    uint32_t rampMs;
+    uint8_t keepAlive;
+} options = {"127.0.0.1", DEFAULT_PORT, DEFAULT_DEVICES, DEFAULT_DURATION_S,
+             DEFAULT_WRITE_MS, DEFAULT_READ_MS, DEFAULT_RAMP_MS, 1};
+
+static int epollFd;
+static device_t * devices;
+static requestStats_t requestStats[REQUEST_COUNT];
+static fleetStats_t stats;
+
+
+static uint64_t nowUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+static void addSample(requestStats_t * s, uint32_t us)
+{
+    if (s->count == s->size)
+    {
+        s->size = s->size ? s->size * 2 : 4096;
+        s->us = realloc(s->us, s->size * sizeof(uint32_t));
+    }
+    s->us[s->count++] = us;
+}
+
+
+/*
+ * Keeps epoll in step with the context's socket.  A socket the PAL closed
+ * has already left the epoll set, a new one is only created by the first
+ * exosite_poll of a request, see step().
+ */
+static void watch(device_t * device, uint8_t isNewRequest)
+{
+    struct epoll_event event;
+    int fd = device->ctx.socket.id;
+
+    if (fd == device->fd && !isNewRequest)
+    {
+        return;
+    }
+    if (device->fd >= 0 && fd != device->fd)
+    {
+        stats.open--;
+    }
+    if (fd >= 0)
+    {
+        // edge triggered, exosite_poll reads and sends until it would block
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.ptr = device;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == 0 && fd != device->fd)
+        {
+            stats.open++;
+        }
+    }
+    device->fd = fd;
+}
+
+
+/* steps the request in flight, the callbacks below are called from here */
+static void step(device_t * device, uint8_t isNewRequest)
+{
+    exosite_poll(&device->ctx);
+    watch(device, isNewRequest);
+}
+
+
+static void startRequest(device_t * device, request_t request, uint64_t now)
+{
+    device->request = request;
+    device->startUs = now;
+    device->state = DEVICE_BUSY;
+    // a kept-alive socket is already writable, so there's no edge to wait for
+    step(device, 1);
+}
+
+
+static uint8_t completeRequest(device_t * device, int16_t httpStatus)
+{
+    requestStats_t * s = &requestStats[device->request];
+    uint64_t now = nowUs();
+
+    addSample(s, now - device->startUs);
+    device->state = DEVICE_IDLE;
+    if (httpStatus == 0)
+    {
+        s->failures++;
+        if (now - device->startUs >= ASYNC_TIMEOUT_MS * 1000ULL)
+        {
+            stats.timeouts++;
+        }
+        return 0;
+    }
+    if (httpStatus >= 200 && httpStatus < 300)
+    {
+        s->ok++;
+        return 1;
+    }
+    s->httpErrors++;
+    return 0;
+}
+
+
+static void onActivated(void * context, int16_t httpStatus, uint32_t latencyMs)
+{
+    device_t * device = context;
+    uint64_t now = nowUs();
+
+    completeRequest(device, httpStatus);
+    if (httpStatus == 200 && exosite_isCIKValid(exosite_currentCIK(&device->ctx)))
+    {
+        device->nextWriteUs = now + (uint64_t)(rand() % options.writeMs) * 1000;
+        device->nextReadUs = now + (uint64_t)(rand() % options.readMs) * 1000;
+    }
+    else if (httpStatus == 409)
+    {
+        // this serial number is already activated elsewhere
+        device->state = DEVICE_FAILED;
+    }
+    else
+    {
+        device->state = DEVICE_WAITING;
+        device->nextActivateUs = now + ACTIVATE_RETRY_MS * 1000;
+    }
+}
+
+
+static void onWritten(void * context, int16_t httpStatus, uint32_t latencyMs)
+{
+    device_t * device = context;
+    uint8_t isAccepted = completeRequest(device, httpStatus);
+    uint32_t i;
+
+    // the deadband only moves on once the values are accepted
+    for (i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (device->isPending[i] && isAccepted)
+        {
+            device->hasSent[i] = 1;
+            device->lastSent[i] = device->values[i];
+            device->lastSentUs[i] = device->startUs;
+        }
+        device->isPending[i] = 0;
+    }
+}
+
+
+static void onRead(void * context, int16_t httpStatus, uint32_t latencyMs)
+{
+    completeRequest(context, httpStatus);
+}
+
+
+/* a 401 dropped the CIK, activate again */
+static void deactivate(device_t * device, uint64_t now)
+{
+    device->state = DEVICE_WAITING;
+    device->nextActivateUs = now;
+}
+
+
+static void activate(device_t * device, uint64_t now)
+{
+    if (exosite_activateAsync(&device->ctx, "exosite", "fleet", onActivated, device) == 0)
+    {
+        startRequest(device, REQUEST_ACTIVATE, now);
+    }
+}
+
+
+/* random walk of every sensor, see Sample_Sensors in cloud_demo */
+static void sample(device_t * device)
+{
+    uint32_t i;
+
+    for (i = 0; i < SENSOR_COUNT; i++)
+    {
+        if (sensors[i].step == 0)
+        {
+            // switches are pressed now and then
+            if (rand() % 100 == 0)
+            {
+                device->values[i] ^= 1;
+            }
+        }
+        else
+        {
+            device->values[i] += rand() % (2 * sensors[i].step + 1) - sensors[i].step;
+        }
+    }
+}
+
+
+static uint8_t isDue(device_t * device, uint32_t i, uint64_t now)
+{
+    int32_t change;
+
+    if (!device->hasSent[i] || now - device->lastSentUs[i] >= SENSOR_MAX_SILENCE_MS * 1000ULL)
+    {
+        return 1;
+    }
+    change = device->values[i] - device->lastSent[i];
+    return (change < 0 ? -change : change) > sensors[i].deadband;
+}
+
+
+static void writeSensors(device_t * device, uint64_t now)
+{
+    char form[256];
+    uint16_t formLength = 0;
+    uint32_t i;
+
+    sample(device);
+    for (i = 0; i < SENSOR_COUNT; i++)
+    {
+        device->isPending[i] = isDue(device, i, now) &&
+            exoFmt_appendField(form, sizeof(form), &formLength, sensors[i].alias,
+                               device->values[i], sensors[i].decimals) == 0;
+    }
+    if (formLength == 0)
+    {
+        stats.writesSkipped++;
+        return;
+    }
+    if (exosite_writeAsync(&device->ctx, form, formLength, onWritten, device) == 0)
+    {
+        startRequest(device, REQUEST_WRITE, now);
+    }
+    else if (!exosite_isCIKValid(exosite_currentCIK(&device->ctx)))
+    {
+        deactivate(device, now);
+    }
+}
+
+
+static void readLeds(device_t * device, uint64_t now)
+{
+    if (exosite_readAsync(&device->ctx, "ledd2&ledd3", device->leds, sizeof(device->leds),
+                          onRead, device) == 0)
+    {
+        startRequest(device, REQUEST_READ, now);
+    }
+    else if (!exosite_isCIKValid(exosite_currentCIK(&device->ctx)))
+    {
+        deactivate(device, now);
+    }
+}
+
+
+/* starts whatever each idle device has due */
+static void schedule(uint64_t now)
+{
+    device_t * device;
+    uint32_t i;
+
+    for (i = 0; i < options.devices; i++)
+    {
+        device = &devices[i];
+        switch (device->state)
+        {
+            case DEVICE_WAITING:
+                if (now >= device->nextActivateUs)
+                {
+                    activate(device, now);
+                }
+                break;
+            case DEVICE_IDLE:
+                if (now >= device->nextWriteUs)
+                {
+                    device->nextWriteUs += options.writeMs * 1000ULL;
+                    writeSensors(device, now);
+                }
+                else if (now >= device->nextReadUs)
+                {
+                    device->nextReadUs += options.readMs * 1000ULL;
+                    readLeds(device, now);
+                }
+                break;
+            case DEVICE_BUSY:
+                // only exosite_poll times a request out
+                if (now - device->startUs >= ASYNC_TIMEOUT_MS * 1000ULL)
+                {
+                    step(device, 0);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+
+static int compareUs(const void * a, const void * b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+static double percentileMs(const requestStats_t * s, uint32_t perMille)
+{
+    return s->count ? s->us[(uint64_t)(s->count - 1) * perMille / 1000] / 1000.0 : 0;
+}
+
+
+/* connection counters of every device's socket, summed */
+static void sumConnStats(exoPal_connStats_t * total)
+{
+    exoPal_connStats_t conn;
+    uint32_t i;
+
+    memset(total, 0, sizeof(*total));
+    for (i = 0; i < options.devices; i++)
+    {
+        exoPal_getConnStats(&devices[i].ctx.socket, &conn);
+        total->opened += conn.opened;
+        total->reused += conn.reused;
+        total->reopened += conn.reopened;
+        total->idleClosed += conn.idleClosed;
+    }
+}
+
+
+static void report(double seconds)
+{
+    const requestStats_t * s;
+    exoPal_connStats_t conn;
+    exoPal_wireStats_t wire;
+    uint64_t total = 0;
+    uint32_t i;
+
+    printf("\n%-9s %9s %8s %7s %7s %8s %8s %8s %8s\n",
+           "request", "ok", "http err", "failed", "req/s", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (i = 0; i < REQUEST_COUNT; i++)
+    {
+        s = &requestStats[i];
+        qsort(s->us, s->count, sizeof(uint32_t), compareUs);
+        total += s->count;
+        printf("%-9s %9llu %8llu %7llu %7.0f %8.2f %8.2f %8.2f %8.2f\n", requestNames[i],
+               (unsigned long long)s->ok, (unsigned long long)s->httpErrors,
+               (unsigned long long)s->failures, s->count / seconds,
+               percentileMs(s, 500), percentileMs(s, 900), percentileMs(s, 990),
+               percentileMs(s, 1000));
+    }
+    sumConnStats(&conn);
+    exoPal_getWireStats(&wire);
+    printf("\n%.0f req/s over %.1f s, %llu writes skipped\n",
+           total / seconds, seconds, (unsigned long long)stats.writesSkipped);
+    printf("connections: %u opened (%.1f/s), %u reused, %u reopened after a server close, "
+           "%u idle closed, %llu timeouts\n",
+           conn.opened, conn.opened / seconds, conn.reused, conn.reopened, conn.idleClosed,
+           (unsigned long long)stats.timeouts);
+    printf("wire: %.0f B/s sent, %.0f B/s received\n",
+           wire.bytesSent / seconds, wire.bytesReceived / seconds);
+}
+
+
+static void usage(const char * name)
+{
+    fprintf(stderr,
+            "usage: %s [-h host] [-p port] [-n devices] [-t seconds] [-w write_ms]\n"
+            "          [-r read_ms] [-R ramp_ms] [-T ca.crt] [-k]\n"
+            "  -h  server (127.0.0.1, e.g. exosite_server)\n"
+            "  -p  port (" DEFAULT_PORT ")\n"
+            "  -n  devices (%d)\n"
+            "  -t  run time in seconds (%d)\n"
+            "  -w  write period (%d)\n"
+            "  -r  read period (%d)\n"
+            "  -R  activations are spread over this long (%d)\n"
+            "  -T  TLS, trusting this CA certificate\n"
+            "  -k  close the connection after every request\n",
+            name, DEFAULT_DEVICES, DEFAULT_DURATION_S, DEFAULT_WRITE_MS, DEFAULT_READ_MS,
+            DEFAULT_RAMP_MS);
+    exit(2);
+}
+
+
+int main(int argc, char ** argv)
+{
+    struct epoll_event events[256];
+    struct rlimit limit;
+    exoPal_connStats_t conn;
+    char uuid[32];
+    uint64_t start;
+    uint64_t now;
+    uint64_t end;
+    uint64_t nextReportUs;
+    uint64_t lastRequests = 0;
+    uint64_t requests;
+    uint32_t i;
+    int count;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "h:p:n:t:w:r:R:T:k")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': options.host = optarg; break;
+            case 'p': options.port = optarg; break;
+            case 'n': options.devices = atoi(optarg); break;
+            case 't': options.durationS = atoi(optarg); break;
+            case 'w': options.writeMs = atoi(optarg); break;
+            case 'r': options.readMs = atoi(optarg); break;
+            case 'R': options.rampMs = atoi(optarg); break;
+            case 'T':
+                if (exoPal_setTls(1, optarg) != 0)
+                {
+                    fprintf(stderr, "can't use TLS with %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'k': options.keepAlive = 0; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (options.devices == 0 || options.writeMs == 0 || options.readMs == 0)
+    {
+        usage(argv[0]);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // one descriptor per device
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < options.devices + 16)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (limit.rlim_cur < options.devices + 16)
+        {
+            fprintf(stderr, "warning: only %lu descriptors\n", (unsigned long)limit.rlim_cur);
+        }
+    }
+
+    exoPal_setServer(options.host, atoi(options.port));
+    // each context keeps its CIK, the shared RAM slot is only read by
+    // exosite_ctxInit, before any device has activated
+    exoPal_setCikFile(0);
+    epollFd = epoll_create1(0);
+
+    start = nowUs();
+    srand(start);
+    devices = calloc(options.devices, sizeof(device_t));
+    for (i = 0; i < options.devices; i++)
+    {
+        snprintf(uuid, sizeof(uuid), "fleet-%ld-%u", (long)getpid(), i);
+        exosite_ctxInit(&devices[i].ctx, uuid, 0);
+        if (!options.keepAlive)
+        {
+            exoPal_setKeepAliveTimeout(&devices[i].ctx.socket, 0);
+        }
+        devices[i].fd = -1;
+        devices[i].state = DEVICE_WAITING;
+        devices[i].nextActivateUs = start + (uint64_t)options.rampMs * 1000 * i / options.devices;
+        for (opt = 0; opt < (int)SENSOR_COUNT; opt++)
+        {
+            devices[i].values[opt] = sensors[opt].initial;
+        }
+    }
+
+    printf("%u devices against %s:%s for %u s\n", options.devices, options.host, options.port,
+           options.durationS);
+    end = start + options.durationS * 1000000ULL;
+    nextReportUs = start + 1000000;
+    for (now = start; now < end; now = nowUs())
+    {
+        schedule(now);
+        count = epoll_wait(epollFd, events, sizeof(events) / sizeof(events[0]), TICK_MS);
+        for (opt = 0; opt < count; opt++)
+        {
+            // also wakes an idle device, which has nothing to step
+            step(events[opt].data.ptr, 0);
+        }
+
+        now = nowUs();
+        if (now >= nextReportUs)
+        {
+            for (requests = 0, i = 0; i < REQUEST_COUNT; i++)
+            {
+                requests += requestStats[i].count;
+            }
+            sumConnStats(&conn);
+            printf("%3llu s  %7llu req/s  %6u open  %7u opened\n",
+                   (unsigned long long)((now - start) / 1000000),
+                   (unsigned long long)(requests - lastRequests), stats.open, conn.opened);
+            lastRequests = requests;
+            nextReportUs += 1000000;
+        }
+    }
+
+    report((nowUs() - start) / 1e6);
+    return 0;
+}
@@ -0,0 +1,1484 @@
+/*****************************************************************************
+*
+*  exosite_pal_posix.c - Exosite PAL on POSIX sockets
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+/*
+ * Implements exosite_pal.h on BSD sockets so the unmodified client runs on
+ * Linux gateways and build hosts.  It behaves like the SimpleLink PAL:
+ * connections are kept alive, requests are staged into one send, and the
+ * async calls use a non-blocking socket.  The CIK is kept in a file, the
+ * spill files in RAM.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#ifdef __linux__
+#include <linux/if_packet.h>
+#endif
+#if EXOPAL_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+#include "exosite_pal.h"
+#include "exosite_pal_posix.h"
+
+#define CIK_LENGTH 40
+#define CIK_FILENAME "exosite_cik.txt"
+#define DEFAULT_SERVER "m2.exosite.com"
+#define DEFAULT_PORT 80
+
+// server requests go to, see exoPal_setServer
+static char serverHost[256] = DEFAULT_SERVER;
+static char serverPort[6] = "80";
+
+// file the CIK is kept in, "" to keep it in RAM, see exoPal_setCikFile
+static char cikFile[256] = CIK_FILENAME;
+
+// overrides the MAC address as UUID if set, see exoPal_setUuid
+static char uuidOverride[41];
+
+static exoPal_wireStats_t wireStats;
+
+// addresses serverHost resolved to, see exoPal_resolveServer.  Kept after
+// they expire or are invalidated, as the fallback if a new lookup fails.
+static struct addrinfo * serverAddresses = 0;
+static uint8_t isResolved = 0;
+static uint32_t resolvedMs;
+static uint8_t hasLookupFailed = 0;
+static uint32_t lookupFailedMs;
+static uint8_t connectFailures = 0;
+static exoPal_dnsStats_t dnsStats;
+
+#if EXOPAL_OPENSSL
+/*
+ * One TLS connection, kept in exoPal_socket_t.tls.  The BIO counters are
+ * the raw socket bytes, so wireStats can count what went over the wire.
+ */
+typedef struct exoPal_tls_tag
+{
+    SSL * ssl;
+    uint64_t bytesRead;         /* BIO counters already added to wireStats */
+    uint64_t bytesWritten;
+}exoPal_tls_t;
+
+// set up by exoPal_setTls, 0 for plain TCP
+static SSL_CTX * tlsContext = 0;
+static uint8_t isTlsVerified = 0;
+static uint8_t isTlsResumptionEnabled = 1;
+
+// session of the last handshake, offered to the server on the next one
+static SSL_SESSION * tlsSession = 0;
+#endif
+// the spill file, and the CIK if there's no CIK file, only live as long as
+// the process
+static char cikStore[EXOPAL_CIK_SLOTS][CIK_LENGTH];
+static uint8_t hasCik[EXOPAL_CIK_SLOTS];
+static char spillStore[2][EXOPAL_SPILL_FILE_SIZE];
+
+/*
+ * The spill follows the rules of the SimpleLink PAL's two spill files, so
+ * the queue can be tried out against them here: a file can't be appended to
+ * again once it has been read, appends then go to the other file, which
+ * can only be started once everything in it has been released.
+ */
+#define SPILL_FREE      0
+#define SPILL_WRITING   1
+#define SPILL_CLOSED    2
+
+static uint8_t spillMode[2];
+static uint32_t spillBase[2];
+static uint32_t spillEnd[2];
+static uint8_t spillCurrent = 0;
+
+static void exoPal_applyRecvTimeout(exoPal_socket_t * sock);
+static void exoPal_setNonBlocking(exoPal_socket_t * sock, uint8_t nonBlocking);
+
+
+/*!
+ * \brief Sets the server requests are sent to, m2.exosite.com:80 by default
+ *
+ * Sockets already open stay connected to the old server until closed.
+ *
+ * \param[in] host Host name or address, resolved by the next connect
+ * \param[in] port TCP port
+ */
+void exoPal_setServer(const char * host, uint16_t port)
+{
+    snprintf(serverHost, sizeof(serverHost), "%s", host);
+    snprintf(serverPort, sizeof(serverPort), "%u", port);
+
+    // the old addresses are no fallback for a different server
+    if (serverAddresses)
+    {
+        freeaddrinfo(serverAddresses);
+        serverAddresses = 0;
+    }
+    isResolved = 0;
+    hasLookupFailed = 0;
+    connectFailures = 0;
+}
+
+#if EXOPAL_OPENSSL
+/*!
+ * \brief Keeps the session the server just issued for the next handshake
+ *
+ * Called by OpenSSL for TLS 1.2 session IDs as well as TLS 1.3 tickets.
+ *
+ * \return 1 to keep the reference to \a session, 0 to let OpenSSL free it
+ */
+static int exoPal_tlsNewSession(SSL * ssl, SSL_SESSION * session)
+{
+    (void)ssl;
+    if (!isTlsResumptionEnabled)
+    {
+        return 0;
+    }
+    if (tlsSession)
+    {
+        SSL_SESSION_free(tlsSession);
+    }
+    tlsSession = session;
+    return 1;
+}
+
+/*!
+ * \brief Drops the cached session, the next handshake is a full one
+ */
+static void exoPal_tlsForgetSession()
+{
+    if (tlsSession)
+    {
+        SSL_SESSION_free(tlsSession);
+        tlsSession = 0;
+    }
+}
+#endif
+
+/*!
+ * \brief Makes new connections use TLS
+ *
+ * Connections already open are left as they are.  Point exoPal_setServer at
+ * the TLS port, 443 for Exosite.
+ *
+ * \param[in] enabled 1 for TLS, 0 for plain TCP
+ * \param[in] caFile PEM file of the certificates the server is verified
+ *            against, or 0 to skip verification, e.g. for a test server
+ *
+ * \return 0 if successful, 1 if TLS wasn't built in, 2 if caFile can't be
+ *         loaded
+ */
+uint8_t exoPal_setTls(uint8_t enabled, const char * caFile)
+{
+#if EXOPAL_OPENSSL
+    exoPal_tlsForgetSession();
+    if (tlsContext)
+    {
+        SSL_CTX_free(tlsContext);
+        tlsContext = 0;
+    }
+    if (!enabled)
+    {
+        return 0;
+    }
+
+    // SSL_write can't be passed MSG_NOSIGNAL
+    signal(SIGPIPE, SIG_IGN);
+
+    tlsContext = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_min_proto_version(tlsContext, TLS1_2_VERSION);
+    SSL_CTX_set_options(tlsContext, SSL_OP_IGNORE_UNEXPECTED_EOF);
+    SSL_CTX_set_mode(tlsContext, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                 SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_session_cache_mode(tlsContext, SSL_SESS_CACHE_CLIENT |
+                                               SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(tlsContext, exoPal_tlsNewSession);
+
+    isTlsVerified = caFile != 0;
+    if (caFile)
+    {
+        if (SSL_CTX_load_verify_locations(tlsContext, caFile, 0) != 1)
+        {
+            SSL_CTX_free(tlsContext);
+            tlsContext = 0;
+            return 2;
+        }
+        SSL_CTX_set_verify(tlsContext, SSL_VERIFY_PEER, 0);
+    }
+    return 0;
+#else
+    (void)caFile;
+    return enabled ? 1 : 0;
+#endif
+}
+
+/*!
+ * \brief Turns TLS session resumption on or off, on by default
+ *
+ * With it off every connection pays for a full handshake, which is only
+ * useful to measure what resumption saves.
+ */
+void exoPal_setTlsResumption(uint8_t enabled)
+{
+#if EXOPAL_OPENSSL
+    isTlsResumptionEnabled = enabled;
+    if (!enabled)
+    {
+        exoPal_tlsForgetSession();
+    }
+#else
+    (void)enabled;
+#endif
+}
+
+/*!
+ * \brief Sets the file the CIK is kept in, exosite_cik.txt by default
+ *
+ * \param[in] path File name, or 0 to keep the CIK in RAM only
+ */
+void exoPal_setCikFile(const char * path)
+{
+    snprintf(cikFile, sizeof(cikFile), "%s", path ? path : "");
+    memset(hasCik, 0, sizeof(hasCik));
+}
+
+/*!
+ * \brief Sets the UUID the device activates with instead of its MAC address
+ *
+ * \param[in] uuid Null terminated UUID, or 0 to go back to the MAC address
+ */
+void exoPal_setUuid(const char * uuid)
+{
+    snprintf(uuidOverride, sizeof(uuidOverride), "%s", uuid ? uuid : "");
+}
+
+/*!
+ * \brief Retrieves the bytes sent and received so far
+ *
+ * \param[out] stats Filled with the current counters
+ */
+void exoPal_getWireStats(exoPal_wireStats_t * stats)
+{
+    *stats = wireStats;
+}
+
+/*!
+ * \brief Initializes a connection handle
+ */
+void exoPal_socketInit(exoPal_socket_t * sock)
+{
+    memset(sock, 0, sizeof(exoPal_socket_t));
+    sock->id = -1;
+    sock->keepAliveTimeoutMs = EXOPAL_KEEPALIVE_TIMEOUT_MS;
+    sock->recvTimeoutMs = EXOPAL_RECV_TIMEOUT_MS;
+}
+
+#if EXOPAL_OPENSSL
+/*!
+ * \brief Adds the socket bytes of a TLS connection to wireStats
+ */
+static void exoPal_tlsCountBytes(exoPal_tls_t * tls)
+{
+    uint64_t bytesRead = BIO_number_read(SSL_get_rbio(tls->ssl));
+    uint64_t bytesWritten = BIO_number_written(SSL_get_wbio(tls->ssl));
+
+    wireStats.bytesReceived += bytesRead - tls->bytesRead;
+    wireStats.bytesSent += bytesWritten - tls->bytesWritten;
+    tls->bytesRead = bytesRead;
+    tls->bytesWritten = bytesWritten;
+}
+
+/*!
+ * \brief Maps the result of an SSL_ call to a send/recv style return
+ *
+ * \return \a result if it is positive, 0 if the server closed the
+ *         connection, else -1 with errno EAGAIN if the call would block
+ */
+static ssize_t exoPal_tlsResult(exoPal_tls_t * tls, int result)
+{
+    exoPal_tlsCountBytes(tls);
+    if (result > 0)
+    {
+        return result;
+    }
+    switch (SSL_get_error(tls->ssl, result))
+    {
+    case SSL_ERROR_WANT_READ:
+    case SSL_ERROR_WANT_WRITE:
+        // also what a read that hit SO_RCVTIMEO returns
+        errno = EAGAIN;
+        return -1;
+    case SSL_ERROR_ZERO_RETURN:
+        return 0;
+    default:
+        errno = EPROTO;
+        return -1;
+    }
+}
+#endif
+
+/*!
+ * \brief Starts TLS on the newly connected socket, if it is enabled
+ *
+ * Offers the cached session, so the handshake is an abbreviated one if the
+ * server still knows it.  The handshake itself is run by exoPal_tlsHandshake.
+ *
+ * \return 0 if successful, else error code
+ */
+static uint8_t exoPal_tlsStart(exoPal_socket_t * sock)
+{
+#if EXOPAL_OPENSSL
+    exoPal_tls_t * tls;
+    unsigned char address[sizeof(struct in6_addr)];
+
+    if (!tlsContext)
+    {
+        return 0;
+    }
+    tls = calloc(1, sizeof(exoPal_tls_t));
+    tls->ssl = SSL_new(tlsContext);
+    SSL_set_fd(tls->ssl, sock->id);
+    sock->tls = tls;
+
+    if (inet_pton(AF_INET, serverHost, address) == 1 ||
+        inet_pton(AF_INET6, serverHost, address) == 1)
+    {
+        if (isTlsVerified)
+        {
+            X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(tls->ssl), serverHost);
+        }
+    }
+    else
+    {
+        SSL_set_tlsext_host_name(tls->ssl, serverHost);
+        if (isTlsVerified)
+        {
+            SSL_set1_host(tls->ssl, serverHost);
+        }
+    }
+    if (isTlsResumptionEnabled && tlsSession)
+    {
+        SSL_set_session(tls->ssl, tlsSession);
+    }
+#else
+    (void)sock;
+#endif
+    return 0;
+}
+
+/*!
+ * \brief Runs the TLS handshake, if TLS was started on the socket
+ *
+ * \return 0 once done, 1 if a non-blocking socket would block, else -1
+ */
+static int8_t exoPal_tlsHandshake(exoPal_socket_t * sock)
+{
+#if EXOPAL_OPENSSL
+    exoPal_tls_t * tls = (exoPal_tls_t *)sock->tls;
+    ssize_t result;
+
+    if (!tls)
+    {
+        return 0;
+    }
+    result = exoPal_tlsResult(tls, SSL_connect(tls->ssl));
+    if (result < 0 && errno == EAGAIN)
+    {
+        return sock->isNonBlocking ? 1 : -1;
+    }
+    if (result <= 0)
+    {
+        // the server may have dropped the session, don't offer it again
+        exoPal_tlsForgetSession();
+        return -1;
+    }
+    wireStats.tlsHandshakes++;
+    if (SSL_session_reused(tls->ssl))
+    {
+        wireStats.tlsResumed++;
+    }
+#else
+    (void)sock;
+#endif
+    return 0;
+}
+
+/*!
+ * \brief Sends on the socket, through TLS if it was started
+ *
+ * \return Like send
+ */
+static ssize_t exoPal_transportSend(exoPal_socket_t * sock, const char * buffer, uint16_t len)
+{
+    ssize_t result;
+
+#if EXOPAL_OPENSSL
+    if (sock->tls)
+    {
+        exoPal_tls_t * tls = (exoPal_tls_t *)sock->tls;
+        return exoPal_tlsResult(tls, SSL_write(tls->ssl, buffer, len));
+    }
+#endif
+    result = send(sock->id, buffer, len, MSG_NOSIGNAL);
+    if (result > 0)
+    {
+        wireStats.bytesSent += result;
+    }
+    return result;
+}
+
+/*!
+ * \brief Receives from the socket, through TLS if it was started
+ *
+ * \return Like recv
+ */
+static ssize_t exoPal_transportRecv(exoPal_socket_t * sock, char * buffer, uint16_t len)
+{
+    ssize_t result;
+
+#if EXOPAL_OPENSSL
+    if (sock->tls)
+    {
+        exoPal_tls_t * tls = (exoPal_tls_t *)sock->tls;
+        return exoPal_tlsResult(tls, SSL_read(tls->ssl, buffer, len));
+    }
+#endif
+    result = recv(sock->id, buffer, len, 0);
+    if (result > 0)
+    {
+        wireStats.bytesReceived += result;
+    }
+    return result;
+}
+
+/*!
+ * \brief Closes a tcp socket
+ *
+ * \return 0 if successful, else error code
+ * \sa exoPal_tcpSocketOpen
+ */
+uint8_t exoPal_tcpSocketClose(exoPal_socket_t * sock)
+{
+#if EXOPAL_OPENSSL
+    exoPal_tls_t * tls = (exoPal_tls_t *)sock->tls;
+
+    if (tls)
+    {
+        // send close_notify, without waiting for the server's
+        if (!sock->isConnectPending)
+        {
+            SSL_shutdown(tls->ssl);
+            exoPal_tlsCountBytes(tls);
+        }
+        SSL_free(tls->ssl);
+        free(tls);
+        sock->tls = 0;
+    }
+#endif
+    if (sock->id >= 0)
+    {
+        close(sock->id);
+    }
+    sock->id = -1;
+    sock->txLength = 0;
+    sock->isNonBlocking = 0;
+    sock->isConnectPending = 0;
+    return 0;
+}
+
+/*!
+ * \brief Releases the socket at the end of a request
+ *
+ * \param[in] keepAlive 1 if the connection can be reused, else 0
+ *
+ * \return 0 if successful, else error code
+ * \sa exoPal_tcpSocketOpen
+ */
+uint8_t exoPal_tcpSocketRelease(exoPal_socket_t * sock, uint8_t keepAlive)
+{
+    if (!keepAlive || sock->keepAliveTimeoutMs == 0)
+    {
+        return exoPal_tcpSocketClose(sock);
+    }
+    sock->lastActivityMs = exoPal_getTimeMs();
+    return 0;
+}
+
+/*!
+ * \brief Closes the kept-alive socket once it has been idle too long
+ */
+void exoPal_socketService(exoPal_socket_t * sock)
+{
+    if ((sock->id >= 0) && !sock->isConnectPending &&
+        (exoPal_getTimeMs() - sock->lastActivityMs >= sock->keepAliveTimeoutMs))
+    {
+        exoPal_tcpSocketClose(sock);
+        sock->stats.idleClosed++;
+    }
+}
+
+/*!
+ * \brief Sets how long an idle connection is kept open for reuse
+ *
+ * \param[in] timeoutMs Idle timeout in ms, 0 closes after every request
+ */
+void exoPal_setKeepAliveTimeout(exoPal_socket_t * sock, uint32_t timeoutMs)
+{
+    sock->keepAliveTimeoutMs = timeoutMs;
+}
+
+/*!
+ * \brief Sets how long exoPal_socketRead waits for data
+ *
+ * \param[in] timeoutMs Receive timeout in ms
+ */
+void exoPal_setRecvTimeout(exoPal_socket_t * sock, uint32_t timeoutMs)
+{
+    if (timeoutMs == sock->recvTimeoutMs)
+    {
+        return;
+    }
+    sock->recvTimeoutMs = timeoutMs;
+    if (sock->id >= 0)
+    {
+        exoPal_applyRecvTimeout(sock);
+    }
+}
+
+/*!
+ * \brief Retrieves the connection reuse counters
+ *
+ * \param[out] stats Filled with the current counters
+ */
+void exoPal_getConnStats(const exoPal_socket_t * sock, exoPal_connStats_t * stats)
+{
+    *stats = sock->stats;
+}
+
+/*!
+ * \brief Nothing to do, the time base is the monotonic clock
+ */
+void exoPal_tick()
+{
+}
+
+/*!
+ * \brief Returns the ms elapsed on the monotonic clock
+ */
+uint32_t exoPal_getTimeMs()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)(now.tv_sec * 1000 + now.tv_nsec / 1000000);
+}
+
+/*!
+ * \brief Sets the receive timeout of the open socket to sock->recvTimeoutMs
+ */
+static void exoPal_applyRecvTimeout(exoPal_socket_t * sock)
+{
+    struct timeval timeVal;
+
+    timeVal.tv_sec = sock->recvTimeoutMs / 1000;
+    timeVal.tv_usec = (sock->recvTimeoutMs % 1000) * 1000;
+    setsockopt(sock->id, SOL_SOCKET, SO_RCVTIMEO, &timeVal, sizeof(timeVal));
+}
+
+/*!
+ * \brief Switches the open socket between blocking and non-blocking mode
+ */
+static void exoPal_setNonBlocking(exoPal_socket_t * sock, uint8_t nonBlocking)
+{
+    int flags;
+
+    if (nonBlocking == sock->isNonBlocking)
+    {
+        return;
+    }
+    flags = fcntl(sock->id, F_GETFL, 0);
+    fcntl(sock->id, F_SETFL, nonBlocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK));
+    sock->isNonBlocking = nonBlocking;
+}
+
+/*!
+ * \brief Checks if the server closed the kept-alive socket
+ *
+ * \return 1 if the socket is still usable, else 0
+ */
+static uint8_t exoPal_isSocketAlive(exoPal_socket_t * sock)
+{
+    struct pollfd fd = {sock->id, POLLIN, 0};
+
+    if (poll(&fd, 1, 0) == 0)
+    {
+        return 1;
+    }
+#if EXOPAL_OPENSSL
+    if (sock->tls)
+    {
+        // readable may only be a TLS 1.3 session ticket, which is consumed
+        // without any data for the caller
+        exoPal_tls_t * tls = (exoPal_tls_t *)sock->tls;
+        uint8_t wasNonBlocking = sock->isNonBlocking;
+        ssize_t peekStatus;
+        char byte;
+
+        exoPal_setNonBlocking(sock, 1);
+        peekStatus = exoPal_tlsResult(tls, SSL_peek(tls->ssl, &byte, 1));
+        exoPal_setNonBlocking(sock, wasNonBlocking);
+        return peekStatus < 0 && errno == EAGAIN;
+    }
+#endif
+    return 0;
+}
+
+/*!
+ * \brief Nothing to set up on a host
+ */
+void exoPal_init()
+{
+    return;
+}
+
+/*!
+ * \brief Looks the server up, replacing the cached addresses if it succeeds
+ *
+ * \return 0 if successful, else error code
+ */
+static uint8_t exoPal_lookupServer()
+{
+    struct addrinfo hints;
+    struct addrinfo * addresses;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    dnsStats.lookups++;
+    if (getaddrinfo(serverHost, serverPort, &hints, &addresses) != 0)
+    {
+        dnsStats.failures++;
+        hasLookupFailed = 1;
+        lookupFailedMs = exoPal_getTimeMs();
+        return 1;
+    }
+    if (serverAddresses)
+    {
+        freeaddrinfo(serverAddresses);
+    }
+    serverAddresses = addresses;
+    isResolved = 1;
+    resolvedMs = exoPal_getTimeMs();
+    hasLookupFailed = 0;
+    return 0;
+}
+
+/*!
+ * \brief Checks if the cached addresses are older than \a maxAgeMs
+ *
+ * \return 1 if they should be looked up again, 0 if they are recent enough
+ *         or a lookup failed less than EXOPAL_DNS_RETRY_MS ago
+ */
+static uint8_t exoPal_isLookupDue(uint32_t maxAgeMs)
+{
+    uint32_t now = exoPal_getTimeMs();
+
+    if (hasLookupFailed && (now - lookupFailedMs < EXOPAL_DNS_RETRY_MS))
+    {
+        return 0;
+    }
+    return !isResolved || (now - resolvedMs >= maxAgeMs);
+}
+
+/*!
+ * \brief Resolves the server
+ *
+ * Returns the cached addresses, only looking them up again once they
+ * expire.  If that lookup fails the last addresses that resolved are used.
+ *
+ * \return The addresses to try, owned by the cache, or 0 if the server has
+ *         never resolved
+ */
+static const struct addrinfo * exoPal_resolveServer()
+{
+    if (exoPal_isLookupDue(EXOPAL_DNS_TTL_MS))
+    {
+        exoPal_lookupServer();
+    }
+    if (serverAddresses &&
+        (!isResolved || (exoPal_getTimeMs() - resolvedMs >= EXOPAL_DNS_TTL_MS)))
+    {
+        dnsStats.stale++;
+    }
+    return serverAddresses;
+}
+
+/*!
+ * \brief Records the outcome of a connect to the cached addresses
+ *
+ * After EXOPAL_DNS_MAX_CONNECT_FAILURES failures in a row they are
+ * invalidated, so the next connect looks the server up again.
+ *
+ * \param[in] failed 1 if the connect failed
+ */
+static void exoPal_connectResult(uint8_t failed)
+{
+    if (!failed)
+    {
+        connectFailures = 0;
+        return;
+    }
+    connectFailures++;
+    if (connectFailures >= EXOPAL_DNS_MAX_CONNECT_FAILURES)
+    {
+        connectFailures = 0;
+        isResolved = 0;
+        hasLookupFailed = 0;
+        dnsStats.invalidated++;
+    }
+}
+
+/*!
+ * \brief Refreshes the server addresses before they expire
+ */
+void exoPal_dnsService()
+{
+    if (exoPal_isLookupDue(EXOPAL_DNS_TTL_MS - EXOPAL_DNS_REFRESH_MS))
+    {
+        exoPal_lookupServer();
+    }
+}
+
+/*!
+ * \brief Retrieves the server address cache counters
+ */
+void exoPal_getDnsStats(exoPal_dnsStats_t * stats)
+{
+    *stats = dnsStats;
+}
+
+/*!
+ * \brief Creates a socket for \a address, set up like every Exosite socket
+ *
+ * Requests are staged into a single send, so Nagle only delays them.
+ *
+ * \return The socket, or -1 on error
+ */
+static int exoPal_createSocket(const struct addrinfo * address)
+{
+    int sock = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    int one = 1;
+
+    if (sock >= 0)
+    {
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return sock;
+}
+
+/*!
+ * \brief Opens a new tcp socket to Exosite
+ *
+ * Tries each address the server resolves to in turn.
+ *
+ * \return 0 if successful, else error code
+ */
+static uint8_t exoPal_tcpSocketConnect(exoPal_socket_t * sock)
+{
+    const struct addrinfo * addresses = exoPal_resolveServer();
+    const struct addrinfo * address;
+    int socketId = -1;
+
+    if (!addresses)
+    {
+        return 1;
+    }
+    for (address = addresses; address; address = address->ai_next)
+    {
+        socketId = exoPal_createSocket(address);
+        if (socketId < 0)
+        {
+            continue;
+        }
+        if (connect(socketId, address->ai_addr, address->ai_addrlen) == 0)
+        {
+            break;
+        }
+        close(socketId);
+        socketId = -1;
+    }
+    if (socketId < 0)
+    {
+        exoPal_connectResult(1);
+        return 2;
+    }
+    exoPal_connectResult(0);
+    sock->id = socketId;
+    exoPal_applyRecvTimeout(sock);
+
+    exoPal_tlsStart(sock);
+    if (exoPal_tlsHandshake(sock) != 0)
+    {
+        exoPal_tcpSocketClose(sock);
+        return 3;
+    }
+    sock->stats.opened++;
+
+    return 0;
+}
+
+/*!
+ * \brief Opens a tcp socket
+ *
+ * Reuses the kept-alive socket if there is one that hasn't timed out and
+ * hasn't been closed by the server, otherwise opens a new one.
+ *
+ * \return 0 if successful, else error code
+ */
+uint8_t exoPal_tcpSocketOpen(exoPal_socket_t * sock)
+{
+    sock->requestBytesSent = 0;
+    sock->isReused = 0;
+    sock->txLength = 0;
+
+    exoPal_socketService(sock);
+    if (sock->id >= 0)
+    {
+        if (!sock->isConnectPending && exoPal_isSocketAlive(sock))
+        {
+            sock->isReused = 1;
+            sock->stats.reused++;
+            exoPal_setNonBlocking(sock, 0);
+            return 0;
+        }
+        // server closed the connection while it was idle
+        exoPal_tcpSocketClose(sock);
+        sock->stats.reopened++;
+    }
+
+    return exoPal_tcpSocketConnect(sock);
+}
+
+/*!
+ * \brief Sends the staged request bytes to the open tcp socket
+ *
+ * If the first bytes of a request can't be sent on a reused socket, the
+ * connection is reopened and the buffer sent again.
+ *
+ * \return 0 if successful, else error code
+ */
+static uint8_t exoPal_socketSend(exoPal_socket_t * sock, const char * buffer, uint16_t len)
+{
+    ssize_t writeStatus;
+    uint16_t sent = 0;
+
+    while (sent < len)
+    {
+        writeStatus = exoPal_transportSend(sock, &buffer[sent], len - sent);
+        if ((writeStatus <= 0) && sock->isReused && (sock->requestBytesSent == 0))
+        {
+            // stale keep-alive connection, reconnect and try again
+            exoPal_tcpSocketClose(sock);
+            sock->isReused = 0;
+            sock->stats.reopened++;
+            if (exoPal_tcpSocketConnect(sock) != 0)
+            {
+                return 1;
+            }
+            continue;
+        }
+        if (writeStatus <= 0)
+        {
+            exoPal_tcpSocketClose(sock);
+            return 1;
+        }
+        sent += writeStatus;
+        sock->requestBytesSent += writeStatus;
+    }
+
+    return 0;
+}
+
+/*!
+ * \brief Sends data to the open tcp socket
+ *
+ * Staged like the SimpleLink PAL, see exoPal_sendingComplete.
+ *
+ * \return 0 if successful, else error code
+ */
+uint8_t exoPal_socketWrite(exoPal_socket_t * sock, const char * buffer, uint16_t len)
+{
+    uint16_t chunk;
+
+    if (sock->id < 0)
+    {
+        return 1;
+    }
+    while (len > 0)
+    {
+        chunk = EXOPAL_TX_BUFFER_SIZE - sock->txLength;
+        if (chunk > len)
+        {
+            chunk = len;
+        }
+        memcpy(&sock->txBuffer[sock->txLength], buffer, chunk);
+        sock->txLength += chunk;
+        buffer += chunk;
+        len -= chunk;
+
+        if (sock->txLength == EXOPAL_TX_BUFFER_SIZE)
+        {
+            chunk = sock->txLength;
+            sock->txLength = 0;
+            if (exoPal_socketSend(sock, sock->txBuffer, chunk) != 0)
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/*!
+ * \brief Reads data from the socket into \a buffer, null terminated
+ *
+ * \return 0 if successful, else EXOPAL_READ_ERROR, EXOPAL_READ_TIMEOUT or
+ *         EXOPAL_READ_CLOSED; the socket is closed on any of them
+ */
+uint8_t exoPal_socketRead(exoPal_socket_t * sock, char * buffer, uint16_t bufferSize, uint16_t * responseLength)
+{
+    ssize_t readStatus;
+
+    *responseLength = 0;
+    buffer[0] = '\0';
+    if (sock->id < 0)
+    {
+        return EXOPAL_READ_ERROR;
+    }
+
+    readStatus = exoPal_transportRecv(sock, buffer, bufferSize - 1);
+    if (readStatus <= 0)
+    {
+        exoPal_tcpSocketClose(sock);
+        if (readStatus == 0)
+        {
+            return EXOPAL_READ_CLOSED;
+        }
+        // SO_RCVTIMEO expired
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? EXOPAL_READ_TIMEOUT : EXOPAL_READ_ERROR;
+    }
+    buffer[readStatus] = '\0';
+    *responseLength = readStatus;
+    return 0;
+}
+
+/*!
+ * \brief Opens a tcp socket without blocking
+ *
+ * \return EXOPAL_ASYNC_DONE once connected
+ *
+ * \sa exoPal_tcpSocketOpen
+ */
+EXOPAL_ASYNC exoPal_tcpSocketOpenAsync(exoPal_socket_t * sock)
+{
+    const struct addrinfo * addresses;
+    struct pollfd fd;
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+
+    if (!sock->isConnectPending)
+    {
+        sock->requestBytesSent = 0;
+        sock->isReused = 0;
+        sock->txLength = 0;
+
+        exoPal_socketService(sock);
+        if (sock->id >= 0)
+        {
+            if (exoPal_isSocketAlive(sock))
+            {
+                sock->isReused = 1;
+                sock->stats.reused++;
+                exoPal_setNonBlocking(sock, 1);
+                return EXOPAL_ASYNC_DONE;
+            }
+            // server closed the connection while it was idle
+            exoPal_tcpSocketClose(sock);
+            sock->stats.reopened++;
+        }
+
+        // only the first address is tried, the connect can't be retried
+        // without blocking
+        addresses = exoPal_resolveServer();
+        if (!addresses)
+        {
+            return EXOPAL_ASYNC_ERROR;
+        }
+        sock->id = exoPal_createSocket(addresses);
+        if (sock->id < 0)
+        {
+            return EXOPAL_ASYNC_ERROR;
+        }
+        exoPal_applyRecvTimeout(sock);
+        exoPal_setNonBlocking(sock, 1);
+        if (connect(sock->id, addresses->ai_addr, addresses->ai_addrlen) < 0 &&
+            errno != EINPROGRESS)
+        {
+            exoPal_tcpSocketClose(sock);
+            exoPal_connectResult(1);
+            return EXOPAL_ASYNC_ERROR;
+        }
+        sock->isConnectPending = 1;
+    }
+
+    if (!sock->tls)
+    {
+        // writable once the tcp handshake completes
+        fd.fd = sock->id;
+        fd.events = POLLOUT;
+        if (poll(&fd, 1, 0) == 0)
+        {
+            return EXOPAL_ASYNC_PENDING;
+        }
+        getsockopt(sock->id, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+        if (error != 0)
+        {
+            exoPal_tcpSocketClose(sock);
+            exoPal_connectResult(1);
+            return EXOPAL_ASYNC_ERROR;
+        }
+        exoPal_connectResult(0);
+        exoPal_tlsStart(sock);
+    }
+
+    // then the TLS one, if TLS is enabled
+    switch (exoPal_tlsHandshake(sock))
+    {
+    case 0:
+        break;
+    case 1:
+        return EXOPAL_ASYNC_PENDING;
+    default:
+        exoPal_tcpSocketClose(sock);
+        return EXOPAL_ASYNC_ERROR;
+    }
+    sock->isConnectPending = 0;
+    sock->stats.opened++;
+    return EXOPAL_ASYNC_DONE;
+}
+
+/*!
+ * \brief Sends data without blocking
+ *
+ * \return EXOPAL_ASYNC_DONE once all of buffer is sent
+ */
+EXOPAL_ASYNC exoPal_socketSendAsync(exoPal_socket_t * sock, const char * buffer, uint16_t len, uint16_t * sent)
+{
+    ssize_t writeStatus;
+
+    while (*sent < len)
+    {
+        writeStatus = exoPal_transportSend(sock, &buffer[*sent], len - *sent);
+        if (writeStatus < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return EXOPAL_ASYNC_PENDING;
+        }
+        if (writeStatus <= 0)
+        {
+            exoPal_tcpSocketClose(sock);
+            return EXOPAL_ASYNC_ERROR;
+        }
+        *sent += writeStatus;
+        sock->requestBytesSent += writeStatus;
+    }
+    return EXOPAL_ASYNC_DONE;
+}
+
+/*!
+ * \brief Reads whatever data has arrived without blocking
+ *
+ * \return EXOPAL_ASYNC_DONE if data was read, EXOPAL_ASYNC_PENDING if none
+ *         has arrived, EXOPAL_ASYNC_ERROR if the socket was closed
+ */
+EXOPAL_ASYNC exoPal_socketReadAsync(exoPal_socket_t * sock, char * buffer, uint16_t bufSize, uint16_t * responseLength)
+{
+    ssize_t readStatus;
+
+    *responseLength = 0;
+    buffer[0] = '\0';
+    if (sock->id < 0)
+    {
+        return EXOPAL_ASYNC_ERROR;
+    }
+
+    readStatus = exoPal_transportRecv(sock, buffer, bufSize - 1);
+    if (readStatus < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        return EXOPAL_ASYNC_PENDING;
+    }
+    if (readStatus <= 0)
+    {
+        exoPal_tcpSocketClose(sock);
+        return EXOPAL_ASYNC_ERROR;
+    }
+    buffer[readStatus] = '\0';
+    *responseLength = readStatus;
+    return EXOPAL_ASYNC_DONE;
+}
+
+/*!
+ * \brief Sends whatever is left of the request staged by exoPal_socketWrite
+ *
+ * \return 0 if successful
+ */
+int32_t exoPal_sendingComplete(exoPal_socket_t * sock)
+{
+    uint16_t len = sock->txLength;
+
+    if (len == 0)
+    {
+        return 0;
+    }
+    sock->txLength = 0;
+    if (sock->id < 0)
+    {
+        return 1;
+    }
+    return exoPal_socketSend(sock, sock->txBuffer, len);
+}
+
+/*!
+ * \brief Builds the file name of a CIK slot
+ *
+ * Slot 0 uses the CIK file as is, other slots append the slot number.
+ */
+static void exoPal_cikFileName(uint8_t slot, char * fileName, size_t size)
+{
+    if (slot == 0)
+    {
+        snprintf(fileName, size, "%s", cikFile);
+    }
+    else
+    {
+        snprintf(fileName, size, "%s.%u", cikFile, slot);
+    }
+}
+
+/*!
+ * \brief Sets the cik
+ *
+ * Written to a temporary file first and renamed over the CIK file, so a
+ * crash part way through never leaves a truncated CIK.
+ *
+ * \return 0 if successful, else error code
+ */
+uint8_t exoPal_setCik(uint8_t slot, const char * cik)
+{
+    char fileName[sizeof(cikFile) + 4];
+    char tmpFile[sizeof(fileName) + 4];
+    FILE * file;
+    uint8_t failed;
+
+    if (slot >= EXOPAL_CIK_SLOTS)
+    {
+        return 1;
+    }
+    memcpy(cikStore[slot], cik, CIK_LENGTH);
+    hasCik[slot] = cik[0] != '\0';
+    if (cikFile[0] == '\0')
+    {
+        return 0;
+    }
+
+    exoPal_cikFileName(slot, fileName, sizeof(fileName));
+    snprintf(tmpFile, sizeof(tmpFile), "%s.tmp", fileName);
+    file = fopen(tmpFile, "w");
+    if (!file)
+    {
+        return 1;
+    }
+    failed = fwrite(cik, 1, CIK_LENGTH, file) != CIK_LENGTH;
+    failed |= fflush(file) != 0 || fsync(fileno(file)) != 0;
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmpFile, fileName) != 0)
+    {
+        remove(tmpFile);
+        return 1;
+    }
+    return 0;
+}
+
+/*!
+ * \brief Retrieves the cik
+ *
+ * \return 0 if successful, else error code
+ */
+uint8_t exoPal_getCik(uint8_t slot, char * read_buffer)
+{
+    char fileName[sizeof(cikFile) + 4];
+    FILE * file;
+    size_t length;
+
+    if (slot >= EXOPAL_CIK_SLOTS)
+    {
+        return 1;
+    }
+    if (!hasCik[slot] && cikFile[0] != '\0')
+    {
+        exoPal_cikFileName(slot, fileName, sizeof(fileName));
+        file = fopen(fileName, "r");
+        if (!file)
+        {
+            return 1;
+        }
+        length = fread(cikStore[slot], 1, CIK_LENGTH, file);
+        fclose(file);
+        hasCik[slot] = length == CIK_LENGTH;
+    }
+    if (!hasCik[slot])
+    {
+        return 1;
+    }
+    memcpy(read_buffer, cikStore[slot], CIK_LENGTH);
+    return 0;
+}
+
+/*!
+ * \brief Retrieves the device model
+ */
+uint8_t exoPal_getModel(char * read_buffer)
+{
+    exoPal_memcpy(read_buffer,"test",sizeof("test"));
+    return 0;
+}
+
+/*!
+ * \brief Retrieves the device vendor
+ */
+uint8_t exoPal_getVendor(char * read_buffer)
+{
+    exoPal_memcpy(read_buffer,"chiefmarley",sizeof("chiefmarley"));
+    return 0;
+}
+
+/*!
+ * \brief Retrieves UUID from device
+ *
+ * The MAC address of the first network interface that has one, like the
+ * SimpleLink PAL, unless one was set with exoPal_setUuid.
+ *
+ * \return 0 if successful, else error code
+ */
+uint8_t exoPal_getUuid(char * read_buffer)
+{
+    uint8_t status = 1;
+#ifdef __linux__
+    struct ifaddrs * interfaces;
+    struct ifaddrs * interface;
+    const struct sockaddr_ll * link;
+#endif
+
+    if (uuidOverride[0] != '\0')
+    {
+        strcpy(read_buffer, uuidOverride);
+        return 0;
+    }
+#ifdef __linux__
+    if (getifaddrs(&interfaces) != 0)
+    {
+        return 1;
+    }
+    for (interface = interfaces; interface && status; interface = interface->ifa_next)
+    {
+        if (!interface->ifa_addr || interface->ifa_addr->sa_family != AF_PACKET ||
+            (interface->ifa_flags & IFF_LOOPBACK))
+        {
+            continue;
+        }
+        link = (const struct sockaddr_ll *)interface->ifa_addr;
+        if (link->sll_halen != 6)
+        {
+            continue;
+        }
+        snprintf(read_buffer, 13, "%02x%02x%02x%02x%02x%02x",
+                 link->sll_addr[0], link->sll_addr[1], link->sll_addr[2],
+                 link->sll_addr[3], link->sll_addr[4], link->sll_addr[5]);
+        status = 0;
+    }
+    freeifaddrs(interfaces);
+#endif
+    return status;
+}
+
+/*!
+ * \brief Appends to the spill, kept in RAM
+ *
+ * Appends keep working while a drain is pending, see the SimpleLink PAL.
+ *
+ * \return 0 if successful, else error code
+ */
+uint8_t exoPal_spillWrite(uint32_t offset, const char * data, uint16_t length)
+{
+    if (spillMode[spillCurrent] == SPILL_CLOSED)
+    {
+        if (spillMode[!spillCurrent] != SPILL_FREE)
+        {
+            return 3;
+        }
+        spillCurrent = !spillCurrent;
+    }
+    if (spillMode[spillCurrent] == SPILL_FREE)
+    {
+        spillMode[spillCurrent] = SPILL_WRITING;
+        spillBase[spillCurrent] = offset;
+        spillEnd[spillCurrent] = offset;
+    }
+    if (offset != spillEnd[spillCurrent] ||
+        offset - spillBase[spillCurrent] + length > EXOPAL_SPILL_FILE_SIZE)
+    {
+        return 1;
+    }
+    memcpy(&spillStore[spillCurrent][offset - spillBase[spillCurrent]], data, length);
+    spillEnd[spillCurrent] += length;
+    return 0;
+}
+
+/*!
+ * \brief Reads back from the spill
+ *
+ * \return 0 if successful, 3 if it can't be read until the data before it
+ *         has been released, else error code
+ */
+uint8_t exoPal_spillRead(uint32_t offset, char * data, uint16_t length)
+{
+    uint8_t index = !spillCurrent;
+
+    if (spillMode[index] == SPILL_FREE || offset < spillBase[index] || offset >= spillEnd[index])
+    {
+        index = spillCurrent;
+    }
+    if (spillMode[index] == SPILL_FREE || offset < spillBase[index] ||
+        offset + length > spillEnd[index])
+    {
+        return 1;
+    }
+    if (spillMode[index] == SPILL_WRITING)
+    {
+        if (spillMode[!index] != SPILL_FREE)
+        {
+            return 3;
+        }
+        spillMode[index] = SPILL_CLOSED;
+    }
+    memcpy(data, &spillStore[index][offset - spillBase[index]], length);
+    return 0;
+}
+
+/*!
+ * \brief Frees the spill files that only hold data before \a offset
+ */
+void exoPal_spillRelease(uint32_t offset)
+{
+    uint8_t index;
+
+    for (index = 0; index < 2; index++)
+    {
+        if (spillMode[index] == SPILL_CLOSED && spillEnd[index] <= offset)
+        {
+            spillMode[index] = SPILL_FREE;
+        }
+    }
+}
+
+/*!
+ * \brief Empties the spill
+ */
+void exoPal_spillReset()
+{
+    spillMode[0] = SPILL_FREE;
+    spillMode[1] = SPILL_FREE;
+    spillCurrent = 0;
+}
+
+/*!
+ * \brief memcpy implementation
+ */
+uint8_t exoPal_memcpy(char * dst, const char * src, uint16_t length)
+{
+    memcpy(dst,src,length);
+    return 0;
+}
+
+/*!
+ * \brief returns the length of the null terminated string
+ */
+uint16_t exoPal_strlen(const char *s)
+{
+    return strlen(s);
+}
+
+/*!
+ * \brief Gets the decimal ascii representation of an integer
+ *
+ * \return Length of string written to buf
+ */
+uint8_t exoPal_itoa(int value, char* buf, uint8_t bufSize)
+{
+    int length = snprintf(buf, bufSize, "%d", value);
+
+    return length < bufSize ? length : bufSize - 1;
+}
+
+int32_t exoPal_atoi(char* val)
+{
+    return atoi(val);
+}
+
+char* exoPal_strstr(const char *str1, const char *str2)
+{
+    return strstr(str1, str2);
+}
@@ -0,0 +1,65 @@
+/*****************************************************************************
+*
+*  exosite_pal_posix.h - Host extensions of the POSIX PAL
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+#ifndef EXOSITE_PAL_POSIX_H
+#define EXOSITE_PAL_POSIX_H
+
+#include <stdint.h>
+#include "exosite_pal.h"
+
+
+// TYPES
+/*!
+ * Bytes that went over the socket, see exoPal_getWireStats.  With TLS these
+ * are the encrypted bytes, handshakes included.
+ */
+typedef struct exoPal_wireStats_tag
+{
+    uint64_t bytesSent;
+    uint64_t bytesReceived;
+    uint32_t tlsHandshakes;     /*!< TLS handshakes completed */
+    uint32_t tlsResumed;        /*!< of those, how many resumed a session */
+}exoPal_wireStats_t;
+
+
+// PUBLIC FUNCTIONS
+void exoPal_setServer(const char * host, uint16_t port);
+void exoPal_setCikFile(const char * path);
+void exoPal_setUuid(const char * uuid);
+void exoPal_getWireStats(exoPal_wireStats_t * stats);
+uint8_t exoPal_setTls(uint8_t enabled, const char * caFile);
+void exoPal_setTlsResumption(uint8_t enabled);
+
+#endif
@@ -0,0 +1,1126 @@
+/*****************************************************************************
+*
+*  exosite_server.c - Host stand-in for the One Platform HTTP API
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+/*
+ * Serves just enough of the One Platform API for the client library to run
+ * against on a host:
+ *
+ *   POST /provision/activate   200 and a CIK the first time a serial number
+ *                              activates, 409 after that
+ *   POST /onep:v1/stack/alias  stores the form, 204
+ *   GET  /onep:v1/stack/alias  "alias=value&..." with Last-Modified, held as a
+ *                              long-poll when If-Modified-Since is current
+ *   POST /onep:v1/rpc/process  write, record and read calls
+ *   GET  /timestamp            the unix time
+ *
+ * Aliases are shared by all devices.  Run "exosite_server -?" for the
+ * latency, response size and connection-close options, and -r to revoke
+ * CIKs so clients have to activate again.  Given a certificate
+ * and key it serves TLS instead, with session IDs and tickets so clients
+ * can resume.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#if EXOPAL_OPENSSL
+#include <openssl/ssl.h>
+#endif
+
+#define DEFAULT_PORT        8080
+#define IN_BUFFER_SIZE      32768   /* a full RPC batch of queued samples */
+#define MAX_ALIASES         64
+#define MAX_ALIAS_LENGTH    32
+#define MAX_VALUE_LENGTH    1024
+#define MAX_DEVICES         4096
+#define CIK_LENGTH          40
+#define CIK_PREFIX          "a5e1c0de5e12a1"    /* + 26 hex digits of device index */
+#define HTTP_DATE_LENGTH    29
+
+/* a device's index is in the last digits of its CIK */
+#define CIK_INDEX_DIGITS    8
+
+typedef struct
+{
+    char name[MAX_ALIAS_LENGTH];
+    char value[MAX_VALUE_LENGTH];
+    uint16_t valueLength;
+    uint32_t version;           /* bumped on every write */
+    char modified[HTTP_DATE_LENGTH + 1];
+} alias_t;
+
+typedef struct
+{
+    int fd;
+    char in[IN_BUFFER_SIZE];
+    uint32_t inLength;
+    char * out;
+    uint32_t outLength;
+    uint32_t outSize;
+    uint32_t outSent;
+    uint64_t readyAtMs;         /* response is held back until this time */
+    uint32_t responses;
+    uint64_t lastActivityMs;
+    uint8_t isClosing;          /* close once the response is sent */
+#if EXOPAL_OPENSSL
+    SSL * ssl;                  /* 0 for plain TCP */
+    uint8_t isHandshaking;
+    uint8_t wantsWrite;         /* handshake is waiting for the socket to drain */
+#endif
+    /* long-poll in progress */
+    alias_t * heldAlias;
+    uint32_t heldVersion;
+    uint64_t heldUntilMs;
+} conn_t;
+
+typedef struct
+{
+    uint32_t latencyMs;
+    uint32_t valueSize;
+    uint32_t closeAfter;
+    uint32_t idleTimeoutMs;
+    uint32_t maxHoldMs;
+    uint32_t revokeAt;          /* a device's CIK is revoked at this request, 0 never */
+    uint32_t refusals;          /* activations refused with 409 after a revoke */
+    uint8_t verbose;
+} options_t;
+
+typedef struct
+{
+    char serial[48];            /* "" once the device has activated again */
+    uint32_t requests;          /* authorized so far */
+    uint32_t refusals;          /* activations still to refuse */
+    uint8_t isRevoked;
+    uint8_t isReactivated;      /* revoked once already, so not again */
+} device_t;
+
+static options_t options = {0, 4, 0, 0, 30000, 0, 0, 0};
+
+static alias_t aliases[MAX_ALIASES];
+static uint16_t aliasCount = 0;
+
+static device_t devices[MAX_DEVICES];
+static uint32_t deviceCount = 0;
+
+static conn_t ** conns = 0;
+static struct pollfd * fds = 0;
+static uint32_t connCount = 0;
+static uint32_t connSize = 0;
+
+static uint64_t requestCount = 0;
+
+#if EXOPAL_OPENSSL
+static SSL_CTX * tlsContext = 0;
+#endif
+
+
+static uint64_t nowMs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static void httpDate(time_t t, char * buf)
+{
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+    strftime(buf, HTTP_DATE_LENGTH + 1, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+
+/* finds an alias, adding it with a generated value if it isn't known yet */
+static alias_t * findAlias(const char * name, uint16_t length)
+{
+    alias_t * alias;
+    uint32_t i;
+
+    if (length == 0 || length >= MAX_ALIAS_LENGTH)
+    {
+        return 0;
+    }
+    for (i = 0; i < aliasCount; i++)
+    {
+        if (strlen(aliases[i].name) == length && memcmp(aliases[i].name, name, length) == 0)
+        {
+            return &aliases[i];
+        }
+    }
+    if (aliasCount == MAX_ALIASES)
+    {
+        return 0;
+    }
+    alias = &aliases[aliasCount++];
+    memcpy(alias->name, name, length);
+    alias->name[length] = '\0';
+    // a number of the configured size, "1000.25" for the default of 4 digits
+    alias->valueLength = options.valueSize < MAX_VALUE_LENGTH ? options.valueSize : MAX_VALUE_LENGTH - 1;
+    for (i = 0; i < alias->valueLength; i++)
+    {
+        alias->value[i] = i == 0 ? '1' : '0';
+    }
+    if (alias->valueLength >= 4)
+    {
+        memcpy(&alias->value[alias->valueLength - 3], ".25", 3);
+    }
+    alias->version = 1;
+    httpDate(time(0), alias->modified);
+    return alias;
+}
+
+
+static void setAlias(alias_t * alias, const char * value, uint16_t length)
+{
+    if (length >= MAX_VALUE_LENGTH)
+    {
+        length = MAX_VALUE_LENGTH - 1;
+    }
+    memcpy(alias->value, value, length);
+    alias->valueLength = length;
+    alias->version++;
+    httpDate(time(0), alias->modified);
+}
+
+
+static uint8_t isValidCik(const char * cik, uint16_t length)
+{
+    char index[CIK_INDEX_DIGITS + 1];
+
+    if (length != CIK_LENGTH || memcmp(cik, CIK_PREFIX, sizeof(CIK_PREFIX) - 1) != 0)
+    {
+        return 0;
+    }
+    memcpy(index, &cik[CIK_LENGTH - CIK_INDEX_DIGITS], CIK_INDEX_DIGITS);
+    index[CIK_INDEX_DIGITS] = '\0';
+    return strtoul(index, 0, 16) < deviceCount;
+}
+
+
+/* 1 if the request may go ahead, 0 for a 401.  With -r, a device's CIK is
+   revoked at its revokeAt'th request, once per device. */
+static uint8_t authorize(const char * cik, uint16_t length)
+{
+    char index[CIK_INDEX_DIGITS + 1];
+    device_t * device;
+
+    if (!isValidCik(cik, length))
+    {
+        return 0;
+    }
+    memcpy(index, &cik[CIK_LENGTH - CIK_INDEX_DIGITS], CIK_INDEX_DIGITS);
+    index[CIK_INDEX_DIGITS] = '\0';
+    device = &devices[strtoul(index, 0, 16)];
+    if (device->isRevoked)
+    {
+        return 0;
+    }
+    device->requests++;
+    if (options.revokeAt && device->requests == options.revokeAt && !device->isReactivated)
+    {
+        device->isRevoked = 1;
+        device->refusals = options.refusals;
+        if (options.verbose)
+        {
+            fprintf(stderr, "revoked %s\n", device->serial);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+
+/* value of a header, not null terminated, or 0 if it isn't there */
+static const char * findHeader(const char * headers, const char * end, const char * name,
+                               uint16_t * length)
+{
+    size_t nameLength = strlen(name);
+    const char * p = headers;
+    const char * lineEnd;
+
+    while (p < end)
+    {
+        lineEnd = memchr(p, '\r', end - p);
+        if (!lineEnd)
+        {
+            lineEnd = end;
+        }
+        if ((size_t)(lineEnd - p) > nameLength && strncasecmp(p, name, nameLength) == 0 &&
+            p[nameLength] == ':')
+        {
+            p += nameLength + 1;
+            while (p < lineEnd && *p == ' ')
+            {
+                p++;
+            }
+            *length = lineEnd - p;
+            return p;
+        }
+        p = lineEnd + 2;
+    }
+    return 0;
+}
+
+
+static void appendOut(conn_t * conn, const char * data, uint32_t length)
+{
+    if (conn->outLength + length > conn->outSize)
+    {
+        conn->outSize = (conn->outLength + length) * 2;
+        conn->out = realloc(conn->out, conn->outSize);
+    }
+    memcpy(&conn->out[conn->outLength], data, length);
+    conn->outLength += length;
+}
+
+
+static void respond(conn_t * conn, int status, const char * extraHeaders,
+                    const char * body, uint32_t bodyLength)
+{
+    const char * reason;
+    char header[512];
+    int length;
+
+    switch (status)
+    {
+        case 200: reason = "OK"; break;
+        case 204: reason = "No Content"; break;
+        case 304: reason = "Not Modified"; break;
+        case 400: reason = "Bad Request"; break;
+        case 401: reason = "Unauthorized"; break;
+        case 404: reason = "Not Found"; break;
+        case 409: reason = "Conflict"; break;
+        default: reason = "Error"; break;
+    }
+    conn->responses++;
+    if (options.closeAfter && conn->responses >= options.closeAfter)
+    {
+        conn->isClosing = 1;
+    }
+    length = snprintf(header, sizeof(header),
+                      "HTTP/1.1 %d %s\r\n"
+                      "Content-Length: %u\r\n"
+                      "%s%s\r\n",
+                      status, reason, bodyLength,
+                      extraHeaders ? extraHeaders : "",
+                      conn->isClosing ? "Connection: close\r\n" : "");
+    appendOut(conn, header, length);
+    appendOut(conn, body, bodyLength);
+    conn->readyAtMs = nowMs() + options.latencyMs;
+    requestCount++;
+}
+
+
+static void handleActivate(conn_t * conn, const char * body, uint32_t bodyLength)
+{
+    const char * sn = 0;
+    uint32_t snLength = 0;
+    const char * p;
+    char cik[CIK_LENGTH + 1];
+    uint8_t isReactivated = 0;
+    uint32_t i;
+
+    for (p = body; p < body + bodyLength; p++)
+    {
+        if ((p == body || p[-1] == '&') && strncmp(p, "sn=", 3) == 0)
+        {
+            sn = p + 3;
+            snLength = strcspn(sn, "&");
+            if (sn + snLength > body + bodyLength)
+            {
+                snLength = body + bodyLength - sn;
+            }
+        }
+    }
+    if (!sn || snLength == 0 || snLength >= sizeof(devices[0].serial))
+    {
+        respond(conn, 400, 0, "", 0);
+        return;
+    }
+    for (i = 0; i < deviceCount; i++)
+    {
+        if (strlen(devices[i].serial) == snLength && memcmp(devices[i].serial, sn, snLength) == 0)
+        {
+            // a revoked device gets a new CIK, once it's done being refused
+            if (!devices[i].isRevoked || devices[i].refusals > 0)
+            {
+                if (devices[i].refusals > 0)
+                {
+                    devices[i].refusals--;
+                }
+                respond(conn, 409, 0, "", 0);
+                return;
+            }
+            devices[i].serial[0] = '\0';
+            isReactivated = 1;
+            break;
+        }
+    }
+    if (deviceCount == MAX_DEVICES)
+    {
+        respond(conn, 409, 0, "", 0);
+        return;
+    }
+    memcpy(devices[deviceCount].serial, sn, snLength);
+    devices[deviceCount].serial[snLength] = '\0';
+    devices[deviceCount].isReactivated = isReactivated;
+    snprintf(cik, sizeof(cik), "%s%018x%08x", CIK_PREFIX, 0, deviceCount);
+    deviceCount++;
+    respond(conn, 200, "Content-Type: text/plain; charset=utf-8\r\n", cik, CIK_LENGTH);
+}
+
+
+static void handleWrite(conn_t * conn, const char * body, uint32_t bodyLength)
+{
+    const char * p = body;
+    const char * end = body + bodyLength;
+    const char * eq;
+    const char * amp;
+    alias_t * alias;
+
+    while (p < end)
+    {
+        amp = memchr(p, '&', end - p);
+        if (!amp)
+        {
+            amp = end;
+        }
+        eq = memchr(p, '=', amp - p);
+        if (eq && (alias = findAlias(p, eq - p)))
+        {
+            setAlias(alias, eq + 1, amp - eq - 1);
+        }
+        p = amp + 1;
+    }
+    respond(conn, 204, 0, "", 0);
+}
+
+
+static void respondRead(conn_t * conn, const char * query, uint32_t queryLength)
+{
+    const char * p = query;
+    const char * end = query + queryLength;
+    const char * amp;
+    alias_t * alias;
+    alias_t * first = 0;
+    char * body = malloc(MAX_ALIASES * (MAX_ALIAS_LENGTH + MAX_VALUE_LENGTH + 2));
+    uint32_t bodyLength = 0;
+    char header[64];
+
+    while (p < end)
+    {
+        amp = memchr(p, '&', end - p);
+        if (!amp)
+        {
+            amp = end;
+        }
+        alias = findAlias(p, amp - p);
+        if (alias)
+        {
+            if (!first)
+            {
+                first = alias;
+            }
+            bodyLength += sprintf(&body[bodyLength], "%s%s=", bodyLength ? "&" : "", alias->name);
+            memcpy(&body[bodyLength], alias->value, alias->valueLength);
+            bodyLength += alias->valueLength;
+        }
+        p = amp + 1;
+    }
+    if (first)
+    {
+        snprintf(header, sizeof(header), "Last-Modified: %s\r\n", first->modified);
+    }
+    respond(conn, 200, first ? header : 0, body, bodyLength);
+    free(body);
+}
+
+
+static void handleRead(conn_t * conn, const char * query, uint32_t queryLength,
+                       const char * headers, const char * headersEnd)
+{
+    const char * since;
+    const char * timeout;
+    uint16_t sinceLength;
+    uint16_t timeoutLength;
+    uint32_t holdMs;
+    alias_t * alias;
+
+    since = findHeader(headers, headersEnd, "If-Modified-Since", &sinceLength);
+    alias = findAlias(query, strcspn(query, "&") < queryLength ? strcspn(query, "&") : queryLength);
+    if (since && alias && sinceLength == strlen(alias->modified) &&
+        memcmp(since, alias->modified, sinceLength) == 0)
+    {
+        // nothing new yet, hold the request until the alias is written
+        timeout = findHeader(headers, headersEnd, "Request-Timeout", &timeoutLength);
+        holdMs = timeout ? strtoul(timeout, 0, 10) : 0;
+        if (holdMs > options.maxHoldMs)
+        {
+            holdMs = options.maxHoldMs;
+        }
+        conn->heldAlias = alias;
+        conn->heldVersion = alias->version;
+        conn->heldUntilMs = nowMs() + holdMs;
+        // the held request and its query stay at the front of conn->in
+        return;
+    }
+    respondRead(conn, query, queryLength);
+}
+
+
+/* "[[<now>,\"<value>\"]]" for a read call */
+static uint32_t rpcReadResult(char * out, alias_t * alias)
+{
+    uint32_t length = sprintf(out, ",\"result\":[[%ld,\"", (long)time(0));
+
+    memcpy(&out[length], alias->value, alias->valueLength);
+    length += alias->valueLength;
+    length += sprintf(&out[length], "\"]]");
+    return length;
+}
+
+
+static void handleRpc(conn_t * conn, const char * body, uint32_t bodyLength)
+{
+    char * request = malloc(bodyLength + 1);
+    char * response = malloc(MAX_ALIASES * (MAX_VALUE_LENGTH + 64) + 16);
+    uint32_t responseLength = 0;
+    const char * p;
+    const char * cik;
+    const char * procedure;
+    const char * name;
+    const char * value;
+    alias_t * alias;
+    long id;
+
+    memcpy(request, body, bodyLength);
+    request[bodyLength] = '\0';
+    cik = strstr(request, "\"cik\":\"");
+    if (!cik || !authorize(cik + 7, strcspn(cik + 7, "\"")))
+    {
+        respond(conn, 401, 0, "", 0);
+        goto done;
+    }
+
+    response[responseLength++] = '[';
+    p = strstr(request, "\"calls\":[");
+    while (p && (p = strstr(p, "{\"id\":")) && responseLength < MAX_ALIASES * MAX_VALUE_LENGTH)
+    {
+        id = strtol(p + 6, (char **)&p, 10);
+        procedure = strstr(p, "\"procedure\":\"");
+        name = strstr(p, "\"alias\":\"");
+        if (!procedure || !name)
+        {
+            break;
+        }
+        procedure += 13;
+        name += 9;
+        alias = findAlias(name, strcspn(name, "\""));
+        responseLength += sprintf(&response[responseLength], "%s{\"id\":%ld,\"status\":\"%s\"",
+                                  responseLength > 1 ? "," : "", id, alias ? "ok" : "error");
+        if (alias && strncmp(procedure, "read\"", 5) == 0)
+        {
+            responseLength += rpcReadResult(&response[responseLength], alias);
+        }
+        else if (alias && strncmp(procedure, "write\"", 6) == 0)
+        {
+            // ..."alias":"name"},"value",{}]}
+            value = name + strlen(alias->name) + 4;
+            setAlias(alias, value, strcspn(value, "\""));
+        }
+        else if (alias && strncmp(procedure, "record\"", 7) == 0)
+        {
+            alias->version++;
+        }
+        response[responseLength++] = '}';
+        p = name;
+    }
+    response[responseLength++] = ']';
+    respond(conn, 200, "Content-Type: application/json; charset=utf-8\r\n",
+            response, responseLength);
+done:
+    free(request);
+    free(response);
+}
+
+
+/* handles the request at the front of conn->in if all of it has arrived */
+static void handleRequest(conn_t * conn)
+{
+    char * headersEnd;
+    char * lineEnd;
+    char * path;
+    char * query;
+    const char * value;
+    const char * cik;
+    uint16_t valueLength;
+    uint16_t cikLength;
+    uint32_t contentLength = 0;
+    uint32_t requestLength;
+    char * body;
+
+    conn->in[conn->inLength] = '\0';
+    headersEnd = strstr(conn->in, "\r\n\r\n");
+    if (!headersEnd)
+    {
+        if (conn->inLength == IN_BUFFER_SIZE - 1)
+        {
+            conn->isClosing = 1;
+            respond(conn, 400, 0, "", 0);
+            conn->inLength = 0;
+        }
+        return;
+    }
+    lineEnd = strstr(conn->in, "\r\n");
+    value = findHeader(lineEnd + 2, headersEnd, "Content-Length", &valueLength);
+    if (value)
+    {
+        contentLength = strtoul(value, 0, 10);
+    }
+    requestLength = headersEnd + 4 - conn->in + contentLength;
+    if (requestLength >= IN_BUFFER_SIZE)
+    {
+        conn->isClosing = 1;
+        respond(conn, 400, 0, "", 0);
+        conn->inLength = 0;
+        return;
+    }
+    if (conn->inLength < requestLength)
+    {
+        return;
+    }
+    body = headersEnd + 4;
+
+    path = strchr(conn->in, ' ');
+    if (!path || path > lineEnd)
+    {
+        respond(conn, 400, 0, "", 0);
+        goto consumed;
+    }
+    path++;
+    if (options.verbose)
+    {
+        fprintf(stderr, "%.*s\n", (int)(lineEnd - conn->in), conn->in);
+    }
+
+    if (strncmp(conn->in, "GET /timestamp ", 15) == 0)
+    {
+        char timestamp[16];
+
+        respond(conn, 200, 0, timestamp, sprintf(timestamp, "%ld", (long)time(0)));
+    }
+    else if (strncmp(conn->in, "POST /provision/activate ", 25) == 0)
+    {
+        handleActivate(conn, body, contentLength);
+    }
+    else if (strncmp(conn->in, "POST /onep:v1/rpc/process ", 26) == 0)
+    {
+        handleRpc(conn, body, contentLength);
+    }
+    else if (strncmp(path, "/onep:v1/stack/alias", 20) == 0)
+    {
+        cik = findHeader(lineEnd + 2, headersEnd, "X-Exosite-CIK", &cikLength);
+        if (!cik || !authorize(cik, cikLength))
+        {
+            respond(conn, 401, 0, "", 0);
+        }
+        else if (strncmp(conn->in, "POST ", 5) == 0)
+        {
+            handleWrite(conn, body, contentLength);
+        }
+        else if (path[20] == '?')
+        {
+            query = path + 21;
+            handleRead(conn, query, strcspn(query, " "), lineEnd + 2, headersEnd);
+            if (conn->heldAlias)
+            {
+                return;
+            }
+        }
+        else
+        {
+            respond(conn, 400, 0, "", 0);
+        }
+    }
+    else
+    {
+        respond(conn, 404, 0, "", 0);
+    }
+
+consumed:
+    memmove(conn->in, &conn->in[requestLength], conn->inLength - requestLength);
+    conn->inLength -= requestLength;
+}
+
+
+/* answers a held long-poll once its alias is written or it times out */
+static void serviceHeld(conn_t * conn, uint64_t now)
+{
+    char * query;
+
+    if (!conn->heldAlias)
+    {
+        return;
+    }
+    if (conn->heldAlias->version != conn->heldVersion)
+    {
+        query = strchr(conn->in, '?') + 1;
+        conn->heldAlias = 0;
+        respondRead(conn, query, strcspn(query, " "));
+    }
+    else if (now >= conn->heldUntilMs)
+    {
+        conn->heldAlias = 0;
+        respond(conn, 304, 0, "", 0);
+    }
+    else
+    {
+        return;
+    }
+    // the request is done with, drop it from the input
+    query = strstr(conn->in, "\r\n\r\n") + 4;
+    conn->inLength -= query - conn->in;
+    memmove(conn->in, query, conn->inLength);
+}
+
+
+#if EXOPAL_OPENSSL
+static uint8_t setupTls(const char * certFile, const char * keyFile)
+{
+    tlsContext = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_set_min_proto_version(tlsContext, TLS1_2_VERSION);
+    SSL_CTX_set_mode(tlsContext, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                 SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    // session IDs for TLS 1.2 and tickets for both are on by default
+    SSL_CTX_set_session_id_context(tlsContext, (const unsigned char *)"exosite", 7);
+    if (SSL_CTX_use_certificate_chain_file(tlsContext, certFile) != 1 ||
+        SSL_CTX_use_PrivateKey_file(tlsContext, keyFile, SSL_FILETYPE_PEM) != 1)
+    {
+        fprintf(stderr, "exosite_server: can't load %s and %s\n", certFile, keyFile);
+        return 0;
+    }
+    return 1;
+}
+
+
+/* maps the result of an SSL_ call to a recv/send style one */
+static ssize_t tlsResult(conn_t * conn, int result)
+{
+    if (result > 0)
+    {
+        return result;
+    }
+    switch (SSL_get_error(conn->ssl, result))
+    {
+        case SSL_ERROR_WANT_READ:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_WANT_WRITE:
+            conn->wantsWrite = 1;
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        default:
+            errno = EPROTO;
+            return -1;
+    }
+}
+
+
+/* returns 1 once the handshake is done, 0 while it is in progress, -1 on error */
+static int8_t serviceHandshake(conn_t * conn)
+{
+    if (tlsResult(conn, SSL_accept(conn->ssl)) > 0)
+    {
+        conn->isHandshaking = 0;
+        if (options.verbose)
+        {
+            printf("%s handshake, %s\n", SSL_get_version(conn->ssl),
+                   SSL_session_reused(conn->ssl) ? "resumed" : "full");
+        }
+        return 1;
+    }
+    return errno == EAGAIN ? 0 : -1;
+}
+#endif
+
+
+static ssize_t connRecv(conn_t * conn, char * buffer, size_t length)
+{
+#if EXOPAL_OPENSSL
+    if (conn->ssl)
+    {
+        return tlsResult(conn, SSL_read(conn->ssl, buffer, length));
+    }
+#endif
+    return recv(conn->fd, buffer, length, 0);
+}
+
+
+static ssize_t connSend(conn_t * conn, const char * buffer, size_t length)
+{
+#if EXOPAL_OPENSSL
+    if (conn->ssl)
+    {
+        return tlsResult(conn, SSL_write(conn->ssl, buffer, length));
+    }
+#endif
+    return send(conn->fd, buffer, length, MSG_NOSIGNAL);
+}
+
+
+/* 1 if the connection has input buffered that poll won't report */
+static uint8_t hasPending(conn_t * conn)
+{
+#if EXOPAL_OPENSSL
+    return conn->ssl && SSL_pending(conn->ssl) > 0;
+#else
+    (void)conn;
+    return 0;
+#endif
+}
+
+
+static void addConn(int fd, uint8_t isTls)
+{
+    conn_t * conn = calloc(1, sizeof(conn_t));
+    int one = 1;
+
+    if (connCount == connSize)
+    {
+        connSize = connSize ? connSize * 2 : 64;
+        conns = realloc(conns, connSize * sizeof(conn_t *));
+        fds = realloc(fds, connSize * sizeof(struct pollfd));
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    // the TLS session tickets and the response are separate writes
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    conn->fd = fd;
+    conn->lastActivityMs = nowMs();
+#if EXOPAL_OPENSSL
+    if (isTls)
+    {
+        conn->ssl = SSL_new(tlsContext);
+        SSL_set_fd(conn->ssl, fd);
+        conn->isHandshaking = 1;
+    }
+#else
+    (void)isTls;
+#endif
+    conns[connCount] = conn;
+    fds[connCount].fd = fd;
+    connCount++;
+}
+
+
+static void removeConn(uint32_t i)
+{
+#if EXOPAL_OPENSSL
+    if (conns[i]->ssl)
+    {
+        if (!conns[i]->isHandshaking)
+        {
+            SSL_shutdown(conns[i]->ssl);
+        }
+        SSL_free(conns[i]->ssl);
+    }
+#endif
+    close(conns[i]->fd);
+    free(conns[i]->out);
+    free(conns[i]);
+    connCount--;
+    conns[i] = conns[connCount];
+    fds[i] = fds[connCount];
+}
+
+
+/* returns 0 once the connection should be closed */
+static uint8_t serviceConn(conn_t * conn, short revents, uint64_t now)
+{
+    ssize_t length;
+
+#if EXOPAL_OPENSSL
+    conn->wantsWrite = 0;
+    if (conn->ssl && conn->isHandshaking)
+    {
+        if (revents & (POLLERR | POLLHUP) && !(revents & POLLIN))
+        {
+            return 0;
+        }
+        switch (serviceHandshake(conn))
+        {
+            case 0: return 1;
+            case 1: conn->lastActivityMs = now; break;
+            default: return 0;
+        }
+    }
+#endif
+
+    if (revents & POLLIN || hasPending(conn))
+    {
+        // TLS may hold more of a record than poll shows, read until it's empty
+        do
+        {
+            length = connRecv(conn, &conn->in[conn->inLength], IN_BUFFER_SIZE - 1 - conn->inLength);
+            if (length == 0 || (length < 0 && errno != EAGAIN))
+            {
+                return 0;
+            }
+            if (length > 0)
+            {
+                conn->inLength += length;
+                conn->lastActivityMs = now;
+            }
+        } while (length > 0 && hasPending(conn) && conn->inLength < IN_BUFFER_SIZE - 1);
+    }
+    else if (revents & (POLLERR | POLLHUP))
+    {
+        return 0;
+    }
+
+    serviceHeld(conn, now);
+    // one request at a time, the client doesn't pipeline
+    if (conn->outLength == 0 && !conn->heldAlias && !conn->isClosing && conn->inLength > 0)
+    {
+        handleRequest(conn);
+    }
+
+    if (conn->outLength > 0 && now >= conn->readyAtMs)
+    {
+        length = connSend(conn, &conn->out[conn->outSent], conn->outLength - conn->outSent);
+        if (length < 0 && errno != EAGAIN)
+        {
+            return 0;
+        }
+        if (length > 0)
+        {
+            conn->outSent += length;
+            conn->lastActivityMs = now;
+        }
+        if (conn->outSent == conn->outLength)
+        {
+            conn->outLength = 0;
+            conn->outSent = 0;
+            if (conn->isClosing)
+            {
+                return 0;
+            }
+            // a request may have arrived while this one was delayed
+            if (conn->inLength > 0)
+            {
+                handleRequest(conn);
+            }
+        }
+    }
+
+    if (options.idleTimeoutMs && conn->outLength == 0 && !conn->heldAlias &&
+        now - conn->lastActivityMs >= options.idleTimeoutMs)
+    {
+        // dropped without a word, like a NAT or server timing out
+        return 0;
+    }
+    return 1;
+}
+
+
+static void usage(const char * name)
+{
+    fprintf(stderr,
+            "usage: %s [-p port] [-l latency_ms] [-b value_bytes] [-c close_after]\n"
+            "          [-i idle_timeout_ms] [-w max_hold_ms] [-r request [-a refusals]]\n"
+            "          [-C cert -K key] [-v]\n"
+            "  -p  port to listen on (%d)\n"
+            "  -l  delay before each response is sent (0)\n"
+            "  -b  size of the values of aliases that weren't written (4)\n"
+            "  -c  close the connection after this many responses, 0 never (0)\n"
+            "  -i  silently close connections idle this long, 0 never (0)\n"
+            "  -w  longest a long-poll read is held (30000)\n"
+            "  -r  answer a device's nth request with 401 and revoke its CIK, once (0)\n"
+            "  -a  then refuse its activation with 409 this many times (0)\n"
+            "  -C  serve TLS with this PEM certificate chain\n"
+            "  -K  and this PEM private key\n"
+            "  -v  print each request line\n",
+            name, DEFAULT_PORT);
+    exit(2);
+}
+
+
+int main(int argc, char ** argv)
+{
+    struct sockaddr_in addr;
+    int listenFd;
+    int fd;
+    int one = 1;
+    int opt;
+    int timeout;
+    uint16_t port = DEFAULT_PORT;
+    uint64_t now;
+    uint64_t next;
+    uint32_t i;
+    const char * certFile = 0;
+    const char * keyFile = 0;
+
+    while ((opt = getopt(argc, argv, "p:l:b:c:i:w:r:a:C:K:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p': port = atoi(optarg); break;
+            case 'l': options.latencyMs = atoi(optarg); break;
+            case 'b': options.valueSize = atoi(optarg); break;
+            case 'c': options.closeAfter = atoi(optarg); break;
+            case 'i': options.idleTimeoutMs = atoi(optarg); break;
+            case 'w': options.maxHoldMs = atoi(optarg); break;
+            case 'r': options.revokeAt = atoi(optarg); break;
+            case 'a': options.refusals = atoi(optarg); break;
+            case 'C': certFile = optarg; break;
+            case 'K': keyFile = optarg; break;
+            case 'v': options.verbose = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (!certFile != !keyFile)
+    {
+        usage(argv[0]);
+    }
+    if (certFile)
+    {
+#if EXOPAL_OPENSSL
+        if (!setupTls(certFile, keyFile))
+        {
+            return 1;
+        }
+#else
+        fprintf(stderr, "exosite_server: built without TLS\n");
+        return 1;
+#endif
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenFd, 1024) < 0)
+    {
+        perror("exosite_server");
+        return 1;
+    }
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL, 0) | O_NONBLOCK);
+    fprintf(stderr, "listening on %u%s, latency %u ms, values %u bytes, close after %u\n",
+            port, certFile ? " with TLS" : "", options.latencyMs, options.valueSize,
+            options.closeAfter);
+
+    // the listening socket stays in the first slot, removeConn only moves
+    // connections down from the end
+    addConn(listenFd, 0);
+    for (;;)
+    {
+        now = nowMs();
+        next = now + 100;
+        for (i = 0; i < connCount; i++)
+        {
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+            if (fds[i].fd == listenFd)
+            {
+                continue;
+            }
+            if (conns[i]->outLength > 0)
+            {
+                if (conns[i]->readyAtMs <= now)
+                {
+                    fds[i].events |= POLLOUT;
+                }
+                else if (conns[i]->readyAtMs < next)
+                {
+                    next = conns[i]->readyAtMs;
+                }
+            }
+#if EXOPAL_OPENSSL
+            if (conns[i]->wantsWrite)
+            {
+                fds[i].events |= POLLOUT;
+            }
+            if (hasPending(conns[i]))
+            {
+                next = now;
+            }
+#endif
+            if (conns[i]->heldAlias && conns[i]->heldUntilMs < next)
+            {
+                next = conns[i]->heldUntilMs;
+            }
+        }
+        timeout = next > now ? (int)(next - now) : 0;
+        if (poll(fds, connCount, timeout) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            return 1;
+        }
+
+        now = nowMs();
+        for (i = connCount; i-- > 0; )
+        {
+            if (fds[i].fd == listenFd)
+            {
+                while ((fd = accept(listenFd, 0, 0)) >= 0)
+                {
+                    addConn(fd, certFile != 0);
+                }
+                continue;
+            }
+            if (!serviceConn(conns[i], fds[i].revents, now))
+            {
+                removeConn(i);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*****************************************************************************
+*
+*  fmt_bench.c - Host benchmark of the sensor value formatter
+*  Copyright (C) 2012 Exosite LLC
+*
+*  Redistribution and use in source and binary forms, with or without
+*  modification, are permitted provided that the following conditions
+*  are met:
+*
+*    Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+*
+*    Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the
+*    distribution.
+*
+*    Neither the name of Texas Instruments Incorporated nor the names of
+*    its contributors may be used to endorse or promote products derived
+*    from this software without specific prior written permission.
+*
+*  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+*  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+*  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+*  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+*  OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+*  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+*  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+*  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+*  THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+*  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+*  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*****************************************************************************/
+
+/*
+ * Compares the old float split + snprintf("%2d.%02d") path the sensor readers
+ * used with Cloud_ToFixed + exoFmt_fixed.  Builds and runs on the host:
+ *
+ *   cc -O2 -I../exosite fmt_bench.c ../exosite/exosite_fmt.c -o fmt_bench
+ *   ./fmt_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "exosite_fmt.h"
+
+#define DECIMALS    3
+#define VALUES      8
+
+static const float values[VALUES] =
+{
+    24.093f, 23.85f, 100266.2f, 47.764f, -0.5f, -12.25f, 63.98f, 0.0f
+};
+
+static char payload[512];
+
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* what readTmp006Data and friends used to do */
+static int formatSnprintf(float value, char *buf, int size, int len)
+{
+    int32_t i32IntegerPart;
+    int32_t i32FractionPart;
+
+    i32IntegerPart = (int32_t)value;
+    i32FractionPart = (int32_t)(value * 1000.0f);
+    i32FractionPart = i32FractionPart - (i32IntegerPart * 1000);
+    if (i32FractionPart < 0)
+    {
+        i32FractionPart *= -1;
+    }
+    snprintf(&buf[len], size - len, "%2d.%02d", (int)i32IntegerPart, (int)i32FractionPart);
+    return strlen(buf);
+}
+
+
+static int formatFixed(float value, char *buf, int size, int len)
+{
+    int32_t fixed = (int32_t)(value * 1000 + (value < 0 ? -0.5f : 0.5f));
+
+    return len + exoFmt_fixed(fixed, DECIMALS, &buf[len], size - len);
+}
+
+
+static uint64_t run(int (*format)(float, char *, int, int), long iterations)
+{
+    uint64_t start;
+    long i;
+    int j;
+    int len;
+    volatile int sink = 0;
+
+    start = nowNs();
+    for (i = 0; i < iterations; i++)
+    {
+        len = 0;
+        for (j = 0; j < VALUES; j++)
+        {
+            len = format(values[j], payload, sizeof(payload), len);
+            payload[len++] = '&';
+        }
+        sink += len;
+    }
+    return nowNs() - start;
+}
+
+
+int main(int argc, char *argv[])
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    uint64_t snprintfNs;
+    uint64_t fixedNs;
+    char buf[32];
+    int j;
+
+    printf("%-12s %-14s %s\n", "value", "snprintf", "exoFmt_fixed");
+    for (j = 0; j < VALUES; j++)
+    {
+        buf[formatSnprintf(values[j], buf, sizeof(buf), 0)] = '\0';
+        printf("%-12.3f %-14s ", values[j], buf);
+        formatFixed(values[j], buf, sizeof(buf), 0);
+        printf("%s\n", buf);
+    }
+
+    snprintfNs = run(formatSnprintf, iterations);
+    fixedNs = run(formatFixed, iterations);
+
+    printf("\n%ld payloads of %d values\n", iterations, VALUES);
+    printf("snprintf:     %6.1f ns/value\n", (double)snprintfNs / iterations / VALUES);
+    printf("exoFmt_fixed: %6.1f ns/value (%.1fx)\n", (double)fixedNs / iterations / VALUES,
+            (double)snprintfNs / fixedNs);
+    return 0;
+}
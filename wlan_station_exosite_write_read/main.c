@@ -64,6 +64,7 @@
 #include "simplelink.h"
 #include "sl_common.h"
 #include "cloud_demo.h"
+#include "exosite_pal.h"
 #include "inc/hw_memmap.h"
 #include "inc/hw_types.h"
 #include "inc/hw_ints.h"
@@ -94,6 +95,17 @@
 
 #define SL_STOP_TIMEOUT        0xFF
 
+/*
+ * Set to 1 to skip configureSimpleLinkToDefaultState, and the sl_Start/sl_Stop
+ * cycles it costs, on boots where BOOT_CONFIG_FILE shows the device was
+ * already configured by it, and to ping the gateway in the background while
+ * the cloud demo starts.  Bump BOOT_CONFIG_VERSION whenever that function
+ * changes so devices in the field run it once more.
+ */
+#define FAST_BOOT               1
+#define BOOT_CONFIG_VERSION     1
+#define BOOT_CONFIG_FILE        "boot_config.bin"
+
 /* Use bit 32:
  *      1 in a 'status_variable', the device has completed the ping operation
  *      0 in a 'status_variable', the device has not completed the ping operation
@@ -205,7 +217,15 @@ void TMP006AppErrorHandler(char *pcFilename, uint_fast32_t ui32Line);
  */
 static _i32 configureSimpleLinkToDefaultState();
 static _i32 establishConnectionWithAP();
+#if !FAST_BOOT
 static _i32 checkLanConnection();
+#endif
+static _i32 startLanCheck();
+#if FAST_BOOT
+static _i32 startConfiguredSimpleLink();
+static _u8 isBootConfigCurrent();
+static _i32 writeBootConfig();
+#endif
 static _i32 initializeAppVariables();
 static void displayBanner();
 
@@ -465,6 +485,11 @@ Timer1BaseIntHandler(void)  // function for name change
 	//
 	ROM_TimerIntClear(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
 
+	//
+	// Advance the Exosite PAL time base.
+	//
+	exoPal_tick();
+
 	//
 	// Grab the current, debounced state of the buttons.
 	//
@@ -659,6 +684,18 @@ static void SimpleLinkPingReport(SlPingReport_t *pPingReport)
     }
 
     g_PingPacketsRecv = pPingReport->PacketsReceived;
+
+#if FAST_BOOT
+    /* main didn't wait for the ping, see startLanCheck */
+    if(0 == g_PingPacketsRecv)
+    {
+        UARTprintf(" Device couldn't connect to LAN \n\r");
+    }
+    else
+    {
+        UARTprintf(" Device successfully connected to the LAN\r\n");
+    }
+#endif
 }
 
 /*!
@@ -772,7 +809,7 @@ int main(int argc, char** argv)
 	//
 	ROM_TimerConfigure(TIMER1_BASE, TIMER_CFG_PERIODIC);
 	TimerIntRegister(TIMER1_BASE, TIMER_A, Timer1BaseIntHandler);
-	ROM_TimerLoadSet(TIMER1_BASE, TIMER_A, ui32SysClock / (100 * 3)); // 10 ms timer button debouncing
+	ROM_TimerLoadSet(TIMER1_BASE, TIMER_A, ui32SysClock / EXOPAL_TICK_HZ); // button debouncing and PAL time base
 
     //
     // Initialize I2C peripheral.
@@ -800,6 +837,18 @@ int main(int argc, char** argv)
 	//
 	ROM_TimerEnable(TIMER1_BASE, TIMER_A);
 
+#if FAST_BOOT
+    /*
+     * Starts the device once, configuring it to its default state first only
+     * if it hasn't been already, see FAST_BOOT
+     */
+    retVal = startConfiguredSimpleLink();
+    if(retVal < 0)
+    {
+        UARTprintf(" Failed to start the device \n\r");
+        LOOP_FOREVER();
+    }
+#else
     /*
      * Following function configures the device to default state by cleaning
      * the persistent settings stored in NVMEM (viz. connection profiles &
@@ -835,8 +884,9 @@ int main(int argc, char** argv)
         UARTprintf(" Failed to start the device \n\r");
         LOOP_FOREVER();
     }
+#endif
 
-    UARTprintf(" Device started as STATION \n\r");
+    UARTprintf(" Device started as STATION in %d ms \n\r", exoPal_getTimeMs());
 
     // Connecting to WLAN AP
     retVal = establishConnectionWithAP();
@@ -846,9 +896,18 @@ int main(int argc, char** argv)
     	LOOP_FOREVER();
     }
 
-    UARTprintf(" Connection established w/ AP and IP is acquired \n\r");
+    UARTprintf(" Connection established w/ AP and IP is acquired in %d ms \n\r",
+               exoPal_getTimeMs());
     UARTprintf(" Pinging...! \n\r");
 
+#if FAST_BOOT
+    /* SimpleLinkPingReport reports the result while the cloud demo starts */
+    retVal = startLanCheck();
+    if(retVal < 0)
+    {
+        UARTprintf(" Couldn't ping the gateway \n\r");
+    }
+#else
     retVal = checkLanConnection();
     if(retVal < 0)
     {
@@ -857,6 +916,7 @@ int main(int argc, char** argv)
     }
 
     UARTprintf(" Device successfully connected to the LAN\r\n");
+#endif
     UARTprintf(" Connecting to Exosite ! ! ! \n\r");
 
     cloud_demo();
@@ -1020,6 +1080,7 @@ static _i32 establishConnectionWithAP()
     return SUCCESS;
 }
 
+#if !FAST_BOOT
 /*!
     \brief This function checks the LAN connection by pinging the AP's gateway
 
@@ -1028,9 +1089,39 @@ static _i32 establishConnectionWithAP()
     \return     0 on success, negative error-code on error
 */
 static _i32 checkLanConnection()
+{
+    _i32 retVal = -1;
+
+    retVal = startLanCheck();
+    ASSERT_ON_ERROR(retVal);
+
+    /* Wait */
+    while(!IS_PING_DONE(g_Status)) { _SlNonOsMainLoopTask(); }
+
+    if(0 == g_PingPacketsRecv)
+    {
+        /* Problem with LAN connection */
+        ASSERT_ON_ERROR(LAN_CONNECTION_FAILED);
+    }
+
+    /* LAN connection is successful */
+    return SUCCESS;
+}
+#endif
+
+/*!
+    \brief This function starts pinging the AP's gateway without waiting for
+           the result, which SimpleLinkPingReport gets once all
+           NO_OF_ATTEMPTS pings are done
+
+    \param[in]  None
+
+    \return     0 on success, negative error-code on error
+*/
+static _i32 startLanCheck()
 {
     SlPingStartCommand_t pingParams = {0};
-    SlPingReport_t pingReport = {0};
+    static SlPingReport_t pingReport = {0};
 
     _i32 retVal = -1;
 
@@ -1050,18 +1141,111 @@ static _i32 checkLanConnection()
                                  (SlPingReport_t*)&pingReport, SimpleLinkPingReport);
     ASSERT_ON_ERROR(retVal);
 
-    /* Wait */
-    while(!IS_PING_DONE(g_Status)) { _SlNonOsMainLoopTask(); }
+    return SUCCESS;
+}
 
-    if(0 == g_PingPacketsRecv)
+#if FAST_BOOT
+/*!
+    \brief This function starts the device as a STATION in its default state,
+           with a single sl_Start when BOOT_CONFIG_FILE shows it was already
+           configured by configureSimpleLinkToDefaultState. Otherwise it
+           configures the device, starts it again and records that in
+           BOOT_CONFIG_FILE for the next boot
+
+    \param[in]  None
+
+    \return     0 on success, negative error-code on error
+*/
+static _i32 startConfiguredSimpleLink()
+{
+    _i32 retVal = -1;
+
+    retVal = sl_Start(0, 0, 0);
+    ASSERT_ON_ERROR(retVal);
+
+    if ((ROLE_STA == retVal) && isBootConfigCurrent())
     {
-        /* Problem with LAN connection */
-        ASSERT_ON_ERROR(LAN_CONNECTION_FAILED);
+        UARTprintf(" Device configuration is current, skipped reset \n\r");
+        return SUCCESS;
     }
 
-    /* LAN connection is successful */
+    retVal = sl_Stop(SL_STOP_TIMEOUT);
+    ASSERT_ON_ERROR(retVal);
+
+    retVal = configureSimpleLinkToDefaultState();
+    ASSERT_ON_ERROR(retVal);
+
+    UARTprintf(" Device is configured in default state \n\r");
+
+    retVal = sl_Start(0, 0, 0);
+    ASSERT_ON_ERROR(retVal);
+    if (ROLE_STA != retVal)
+    {
+        ASSERT_ON_ERROR(DEVICE_NOT_IN_STATION_MODE);
+    }
+
+    /* Not fatal, the next boot just configures the device again */
+    if (writeBootConfig() < 0)
+    {
+        UARTprintf(" Failed to store the configuration version \n\r");
+    }
+
+    return SUCCESS;
+}
+
+/*!
+    \brief This function checks whether BOOT_CONFIG_FILE holds the current
+           BOOT_CONFIG_VERSION
+
+    \param[in]  None
+
+    \return     1 if it does, 0 if it doesn't or there is no such file
+*/
+static _u8 isBootConfigCurrent()
+{
+    _u32 version = 0;
+    _u32 token = 0;
+    _i32 fileHandle = -1;
+    _i32 retVal = -1;
+
+    retVal = sl_FsOpen((_u8 *)BOOT_CONFIG_FILE, FS_MODE_OPEN_READ, &token, &fileHandle);
+    if(retVal < 0)
+    {
+        return 0;
+    }
+
+    retVal = sl_FsRead(fileHandle, 0, (_u8 *)&version, sizeof(version));
+    sl_FsClose(fileHandle, 0, 0, 0);
+
+    return ((_i32)sizeof(version) == retVal) && (BOOT_CONFIG_VERSION == version);
+}
+
+/*!
+    \brief This function stores BOOT_CONFIG_VERSION in BOOT_CONFIG_FILE
+
+    \param[in]  None
+
+    \return     0 on success, negative error-code on error
+*/
+static _i32 writeBootConfig()
+{
+    _u32 version = BOOT_CONFIG_VERSION;
+    _u32 token = 0;
+    _i32 fileHandle = -1;
+    _i32 retVal = -1;
+
+    retVal = sl_FsOpen((_u8 *)BOOT_CONFIG_FILE,
+                       FS_MODE_OPEN_CREATE(sizeof(version), _FS_FILE_OPEN_FLAG_COMMIT|_FS_FILE_PUBLIC_WRITE|_FS_FILE_PUBLIC_READ),
+                       &token, &fileHandle);
+    ASSERT_ON_ERROR(retVal);
+
+    retVal = sl_FsWrite(fileHandle, 0, (_u8 *)&version, sizeof(version));
+    sl_FsClose(fileHandle, 0, 0, 0);
+    ASSERT_ON_ERROR(retVal);
+
     return SUCCESS;
 }
+#endif
 
 
 
@@ -56,6 +56,8 @@
 extern _u32 g_SysClock;
 extern _u32  ui32SysClock;
 
+static SpiWriteStats_t g_SpiWriteStats = {0};
+
 int spi_Close(Fd_t fd)
 {
     /* Disable WLAN Interrupt ... */
@@ -121,6 +123,9 @@ int spi_Write(Fd_t fd, unsigned char *pBuff, int len)
     int len_to_return = len;
     unsigned long ulDummy;
 
+    g_SpiWriteStats.frames++;
+    g_SpiWriteStats.bytes += len;
+
     ASSERT_CS();
 
     while(len)
@@ -159,3 +164,8 @@ int spi_Read(Fd_t fd, unsigned char *pBuff, int len)
 
     return len;
 }
+
+void spi_GetWriteStats(SpiWriteStats_t *pStats)
+{
+    *pStats = g_SpiWriteStats;
+}
@@ -49,6 +49,15 @@ extern "C" {
 */
 typedef short* Fd_t;
 
+/*!
+    \brief   sl_IfWrite counters, see spi_GetWriteStats
+*/
+typedef struct
+{
+    unsigned long frames;   /* spi_Write calls, one chip select cycle each */
+    unsigned long bytes;    /* bytes clocked out by spi_Write */
+}SpiWriteStats_t;
+
 
 /*!
     \brief open spi communication port to be used for communicating with a
@@ -138,6 +147,21 @@ int spi_Read(Fd_t fd, unsigned char *pBuff, int len);
 */
 int spi_Write(Fd_t fd, unsigned char *pBuff, int len);
 
+/*!
+    \brief returns the number of SPI write frames and bytes sent to the
+           SimpleLink device since boot
+
+    \param[out]     pStats    -    filled with the current counters
+
+    \return         None
+
+    \sa             spi_Write
+    \note           Used to measure the SPI cost of host driver calls by
+                    sampling the counters before and after the call
+    \warning
+*/
+void spi_GetWriteStats(SpiWriteStats_t *pStats);
+
 #ifdef  __cplusplus
 }
 #endif /* __cplusplus */